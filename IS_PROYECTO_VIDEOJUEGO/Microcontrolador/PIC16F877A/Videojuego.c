@@ -1,6 +1,7 @@
-#include <xc.h>
 #define _XTAL_FREQ 4000000UL
+#include "hal.h"
 
+#ifndef HOST_BUILD
 #pragma config FOSC = XT
 #pragma config WDTE = OFF
 #pragma config PWRTE = ON
@@ -9,24 +10,57 @@
 #pragma config CPD = OFF
 #pragma config WRT = OFF
 #pragma config CP = OFF
+#endif
 
 // ============ DEFINICIONES DE HARDWARE ============
-#define SALTA PORTDbits.RD0
-#define AGACHA PORTDbits.RD1
-#define BOCINA PORTEbits.RE2
-#define LED PORTAbits.RA0
+// Pines y registros en hal.h (SALTA, AGACHA, BOCINA, LED y macros HAL_*)
 
 // Dimensiones del display
 #define COLUMNAS 16
 #define FILAS 2
 
-// Caracteres personalizados en CGRAM
-#define PERSONAJE 0
-#define OBSTACULO 1
+// Sprites lógicos (ver CACHÉ DE SPRITES EN CGRAM)
+#define SPR_PERSONAJE 0         // Fotogramas 0/1 (el 1 recoge las piernas)
+#define SPR_OBSTACULO 1
+#define SPR_BARRA_ARRIBA 2      // Parámetro: nivel 0..16 de la barra de meta
+#define SPR_BARRA_ABAJO 3
+#define SPR_PAJARO 4            // Fotogramas 0/1
+#define SPR_ROCA 5
+#define SPR_TROFEO 6
+#define SPR_CALAVERA 7
+#define SPR_NINGUNO 0xFF
+// El HD44780 tiene 8; el simulador puede compilar con menos para que los
+// sprites no quepan todos y cada pantalla obligue a desalojar (check-cgram)
+#ifndef CGRAM_SLOTS
+#define CGRAM_SLOTS 8
+#endif
+
+// Columna de la barra de progreso hacia la meta (dos celdas, 16 niveles)
+#define BARRA_COL 13
+#define BARRA_NIVELES 16
+#define BARRA_FILA 0x0E
 
 // Posición del score
 #define SCORE_COL 14
 
+// Perfilado por fases del loop principal (ver PERFILADO); con 0 no queda
+// ni código ni RAM, y TRAMA_PERFIL se contesta como trama desconocida
+#ifndef PERFILADO
+#define PERFILADO 0
+#endif
+
+// Contadores que solo lee el simulador (escrituras al LCD y a la CGRAM,
+// ocupación del buffer TX, tramas omitidas, uso del tick, latencia de los
+// botones). En el PIC no hay quien los lea y se quedan fuera para no
+// gastar RAM.
+#ifndef ESTADISTICAS
+#ifdef HOST_BUILD
+#define ESTADISTICAS 1
+#else
+#define ESTADISTICAS 0
+#endif
+#endif
+
 // ============ OPTIMIZACIÓN: BUFFER UART REDUCIDO ============
 #define BUFFER_SIZE 16
 #define BUFFER_MASK 0x0F
@@ -34,17 +68,160 @@ volatile unsigned char uartBuffer[BUFFER_SIZE];
 volatile unsigned char bufferWrite = 0;
 volatile unsigned char bufferRead = 0;
 
+// ============ PARSER JSON INCREMENTAL ============
+#define JSON_EN_CURSO 0
+#define JSON_COMPLETO 1
+#define JSON_ERR_SINTAXIS 2     // Carácter inesperado
+#define JSON_ERR_CLAVE 3        // Clave desconocida o repetida
+#define JSON_ERR_VALOR 4        // Número fuera de rango o goalType desconocido
+#define JSON_ERR_ARRAY 5        // Array sin exactamente 8 elementos
+#define JSON_ERR_FALTAN 6       // Objeto cerrado sin las cuatro claves
+
+#define JP_ESPERA_INICIO 0
+#define JP_ANTES_CLAVE 1
+#define JP_CLAVE 2
+#define JP_DOS_PUNTOS 3
+#define JP_VALOR 4
+#define JP_ARRAY 5
+#define JP_CADENA 6
+#define JP_NUMERO 7
+#define JP_TRAS_VALOR 8
+
+#define CLAVE_CHARACTER 0
+#define CLAVE_OBSTACLE 1
+#define CLAVE_GOALTYPE 2
+#define CLAVE_GOALVALUE 3
+#define CLAVE_SEED 4            // Opcional
+#define CLAVES_OBLIGATORIAS 0x0F
+
+typedef struct {
+    unsigned char estado;
+    unsigned char clave;        // Índice en clavesConfig
+    unsigned char candidatos;   // Bits de las entradas de la tabla que aún coinciden
+    unsigned char pos;          // Posición en la clave/cadena o índice del array
+    unsigned char digitos;
+    unsigned char separado;     // Hubo espacio tras los dígitos actuales
+    unsigned char vistos;       // Bit por clave ya leída
+    unsigned int numero;
+} JsonParser;
+
+JsonParser jp = { JP_ESPERA_INICIO };
+unsigned char configResultado = JSON_EN_CURSO;
+unsigned char configBinaria = 0;            // La última configuración llegó en una trama
+
+// ============ PROTOCOLO BINARIO (COBS + CRC-16) ============
+// Trama: 0x00, COBS(tipo, datos..., CRC-16 big endian), 0x00. El JSON nunca
+// contiene 0x00, así que el delimitador separa ambos protocolos sin ambigüedad.
+// CRC-16/CCITT-FALSE (polinomio 0x1021, valor inicial 0xFFFF).
+// Las peticiones llevan tras el tipo un número de secuencia que la
+// respuesta repite, para que el backend empareje cada ACK con su comando
+// (0 = trama ilegible). TRAMA_TELEMETRIA no es respuesta y no lo lleva.
+#define TRAMA_MAX 27                // Mayor trama COBS aceptada (config con semilla y ranura = 27)
+#define TRAMA_CONFIG 0x01           // character[8] obstacle[8] goalType goalValue(2) [seed(2)]
+#define TRAMA_PING 0x02             // Negociación: el backend pregunta por el protocolo
+#define TRAMA_BAUD 0x03             // Cambio de velocidad: índice en spbrgBaudios
+#define TRAMA_ECO 0x04              // Prueba de la nueva velocidad: se devuelve igual
+#define TRAMA_STREAM 0x05           // Telemetría en vivo: una trama cada N ticks (0 = no)
+#define TRAMA_GRABACION 0x06        // Volcado de la grabación de entradas desde un offset
+#define TRAMA_REPETIR 0x07          // total, semilla(2), offset, entradas...: arma la repetición
+#define TRAMA_SLOTS 0x08            // Hash de cada ranura de configuración de la EEPROM
+#define TRAMA_JUGAR_SLOT 0x09       // Arranca la configuración de una ranura: responde TRAMA_ACK
+#define TRAMA_PERFIL 0x0A           // Fase inicial del informe (+ PERF_REINICIA); solo con PERFILADO
+#define TRAMA_ACK 0x81              // Respuesta a TRAMA_CONFIG: código JSON_* 
+#define TRAMA_PONG 0x82             // Respuesta a TRAMA_PING: versión y velocidades
+#define TRAMA_BAUD_ACK 0x83         // Respuesta a TRAMA_BAUD: índice aceptado o 0xFF
+#define TRAMA_ECO_RESP 0x84
+#define TRAMA_STREAM_ACK 0x85       // Respuesta a TRAMA_STREAM: divisor aplicado
+#define TRAMA_GRABACION_RESP 0x86   // estado, longitud, semilla(2), offset, entradas...
+#define TRAMA_REPETIR_ACK 0x87      // Código JSON_*: EN_CURSO (faltan trozos) o COMPLETO (armada)
+#define TRAMA_SLOTS_RESP 0x88       // Número de ranuras y hash(2) de cada una
+#define TRAMA_PERFIL_RESP 0x89      // fase, fases, overruns, RX máx, uso máx ms y, por fase
+                                    // (hasta PERF_POR_TRAMA), máx(2), n, suma(2); big-endian.
+                                    // n y suma se dividen a la vez: n no es el número de ticks
+#define TRAMA_TELEMETRIA 0x90       // Sin petición: estado del juego durante la partida
+#define TRAMA_LEN_CONFIG 21
+#define TRAMA_LEN_CONFIG_SLOT (TRAMA_LEN_CONFIG + 3)    // Con semilla y ranura: se guarda en la EEPROM
+#define PROTOCOLO_VERSION 3
+
+#define JSON_ERR_CRC 7              // Trama con CRC o COBS inválido
+#define JSON_ERR_TRAMA 8            // Tipo o longitud de trama desconocidos
+#define JSON_ERR_OCUPADO 9          // Configuración recibida durante una partida
+#define JSON_ERR_SLOT 10            // Ranura vacía o con el hash que no cuadra
+
+unsigned char configSeq = 0;        // Secuencia de la TRAMA_CONFIG pendiente de ACK
+
+unsigned char trama[TRAMA_MAX];
+unsigned char tramaLen = 0;
+unsigned char tramaActiva = 0;      // Entre un 0x00 inicial y el de cierre
+
+// ============ VELOCIDAD DE LA UART ============
+// BRGH = 1: baud = Fosc / (16 * (SPBRG + 1)). Una velocidad se ofrece al
+// backend solo si SPBRG cabe en 8 bits y el error es menor del 2 %; a
+// 4 MHz quedan 9600 y 19200, con un cristal de 20 MHz llegan a 115200.
+#define BAUD_SPBRG(b) ((_XTAL_FREQ + 8UL * (b)) / (16UL * (b)) - 1)
+#define BAUD_REAL(b) (_XTAL_FREQ / (16UL * (BAUD_SPBRG(b) + 1)))
+#define BAUD_VALIDO(b) (BAUD_SPBRG(b) <= 255 && \
+                        BAUD_REAL(b) * 50 >= (b) * 49UL && BAUD_REAL(b) * 50 <= (b) * 51UL)
+
+#define BAUDIOS_VALIDOS ((BAUD_VALIDO(9600) << 0) | (BAUD_VALIDO(19200) << 1) | \
+                         (BAUD_VALIDO(38400) << 2) | (BAUD_VALIDO(57600) << 3) | \
+                         (BAUD_VALIDO(115200) << 4))
+#define BAUDIOS_N 5
+#define BAUD_PLAZO_MS 1000          // Sin eco en este plazo se vuelve a 9600
+#define BAUD_MAX_ERRORES 4          // Errores de trama seguidos que fuerzan 9600
+
+const unsigned char spbrgBaudios[BAUDIOS_N] = {
+    (unsigned char)BAUD_SPBRG(9600), (unsigned char)BAUD_SPBRG(19200),
+    (unsigned char)BAUD_SPBRG(38400), (unsigned char)BAUD_SPBRG(57600),
+    (unsigned char)BAUD_SPBRG(115200)
+};
+
+unsigned char baudActual = 0;               // Índice en spbrgBaudios
+volatile unsigned int baudPlazoMs = 0;      // Cambio pendiente de confirmar por eco
+volatile unsigned char baudVencido = 0;
+volatile unsigned char uartErroresTrama = 0;
+
+// ============ BUFFER UART DE TRANSMISIÓN (VACIADO POR INTERRUPCIÓN) ============
+// Cabe una trama de telemetría (TELE_BYTES), que es lo único que se envía
+// sin esperar durante la partida. Las respuestas y la línea final esperan
+// en UART_Escr si no caben.
+#define TX_BUFFER_SIZE 16
+#define TX_BUFFER_MASK (TX_BUFFER_SIZE - 1)
+volatile unsigned char uartTxBuffer[TX_BUFFER_SIZE];
+volatile unsigned char txBufferWrite = 0;
+volatile unsigned char txBufferRead = 0;
+#if ESTADISTICAS
+unsigned char txOcupacionMax = 0;           // Marca de agua alta del buffer TX
+#endif
+
 // ============ ESTRUCTURA OPTIMIZADA DE CONFIGURACIÓN ============
 typedef struct {
     unsigned char character[8];
     unsigned char obstacle[8];
     unsigned char goalType;
     unsigned int goalValue;
+    unsigned int seed;    // 0: semilla al azar
     unsigned char flags;  // Bit 0:charLoaded, Bit 1:obstLoaded, Bit 2:goalLoaded
 } LevelConfig;
 
 LevelConfig nivel;
 
+// ============ RANURAS DE CONFIGURACIÓN EN EEPROM ============
+// Cada ranura guarda los 21 bytes de una TRAMA_CONFIG con semilla
+// (character, obstacle, goalType, goalValue, seed) y su CRC-16 como hash.
+// El backend pide los hashes con TRAMA_SLOTS y, si el PIC ya tiene la
+// configuración, la arranca con TRAMA_JUGAR_SLOT en lugar de subirla.
+// Al jugar una ranura se recalcula el CRC: una ranura borrada (0xFF) o
+// una escritura cortada a medias no validan.
+#define SLOTS_N 8
+#define SLOT_DESPLAZA 5
+#define SLOT_BYTES (1 << SLOT_DESPLAZA)    // 8 x 32 = los 256 bytes de la EEPROM
+#define SLOT_DATOS 21
+#define SLOT_NINGUNA 0xFF
+
+unsigned char configSlot = SLOT_NINGUNA;    // Ranura donde guardar la configuración pendiente
+unsigned int configHash = 0;                // CRC-16 de sus SLOT_DATOS bytes
+
 // ============ ESTRUCTURA OPTIMIZADA DE TELEMETRÍA ============
 typedef struct {
     unsigned int obstaclesEsquivados;
@@ -54,15 +231,106 @@ typedef struct {
 
 GameTelemetry telemetria;
 
+// ============ CONTADORES BCD ============
+// El PIC16 no divide por hardware: cada / 10 o % 10 es una llamada a la
+// división de 16 bits por software. Lo que se muestra se lleva también en
+// BCD (un dígito por byte, unidades primero), se incrementa con acarreo y
+// bcd_texto lo formatea para el LCD y la UART sin dividir.
+#define BCD_DIGITOS 5
+
+typedef struct {
+    unsigned char d[BCD_DIGITOS];
+} ContadorBCD;
+
+ContadorBCD bcdEsquivados;      // Obstáculos esquivados (también el score)
+ContadorBCD bcdSegundos;        // Lo avanza la ISR junto a tiempoTranscurrido
+
+// ============ TELEMETRÍA EN VIVO ============
+// TRAMA_TELEMETRIA: tipo, tick (2), estado, esquivados (2), segundos (2).
+// Con CRC, COBS y los dos 0x00 ocupa como mucho TELE_BYTES en la línea.
+// Si el buffer TX no tiene sitio la trama se omite: el juego nunca espera
+// a la UART, y el backend ve el hueco en el número de tick. Se monta en
+// trama[], así que también se omite mientras llega una trama del backend.
+#define TELE_LEN 8
+#define TELE_BYTES (TELE_LEN + 2 + 1 + 2)
+#define TELE_FILA 0x01              // Fila del personaje
+#define TELE_GENERADO 0x02          // Obstáculo nuevo desde la trama anterior
+#define TELE_FILA_GENERADO 0x04     // Fila del último obstáculo generado
+#define TELE_FIN 0x08               // Última trama de la partida
+#define TELE_VICTORIA 0x10
+
+unsigned char streamDivisor = 0;
+unsigned char streamCuenta = 0;
+unsigned char streamEventos = 0;
+#if ESTADISTICAS
+unsigned char streamOmitidas = 0;
+#endif
+unsigned int ticksPartida = 0;
+
 // ============ VARIABLES DEL JUEGO - OPTIMIZADAS ============
-unsigned char displayBuffer[FILAS][13];
+// Mundo en bitboard: un bit por columna (bit 0 = columna 0), 1 = obstáculo.
+// Desplazar es un shift, y colisión/columna libre son tests de un bit.
+// Los glifos solo se generan al renderizar.
+#define MUNDO_COLUMNAS 13
+#define COL_GENERACION (MUNDO_COLUMNAS - 1)
+#define MUNDO_BIT(col) (1U << (col))
+unsigned int mundo[FILAS];
+// Mismo formato: 1 = obstáculo de la variante de la fila (pájaro arriba,
+// roca abajo) en lugar del de la configuración. Solo afecta al glifo.
+unsigned int mundoTipo[FILAS];
+
+// ============ COLA DEL LCD (VACIADO DESDE LA ISR) ============
+// Un frame de juego escribe unas 12 celdas. Los que pasan de LCD_COLA (el
+// primero de la partida llega a 27) esperan en LCD_Encola a que la ISR
+// saque una por ms, dentro del margen del tick.
+#define LCD_COLA 16
+#define LCD_COLA_MASK (LCD_COLA - 1)
+unsigned char lcdColaDato[LCD_COLA];
+unsigned char lcdColaRS[LCD_COLA / 8];      // Bit a 1: dato (RS=1), a 0: comando
+volatile unsigned char lcdColaEscr = 0;
+volatile unsigned char lcdColaLee = 0;
+
+// ============ SOMBRA DEL LCD (RENDER DIFERENCIAL) ============
+// Copia de lo que muestra el HD44780: solo se envían las celdas que cambian
+unsigned char lcdSombra[FILAS][COLUMNAS];
+unsigned char lcdCursor = 0xFF;      // Dirección DDRAM del cursor (0xFF = desconocida)
+
+#if ESTADISTICAS
+// Escrituras al bus del LCD (COMANDO + DIGITO) por frame de juego
+unsigned char lcdEscrituras = 0;
+unsigned char lcdEscriturasFrame = 0;
+unsigned char lcdEscriturasMax = 0;
+#endif
+
+// ============ CACHÉ DE SPRITES EN CGRAM ============
+// Qué sprite (y con qué parámetro: fotograma o nivel) guarda cada uno de los
+// 8 caracteres de la CGRAM. Las filas que tenía un slot se recalculan con
+// esa pareja, así que no hace falta copia de la CGRAM para subir solo las
+// filas que cambian. Un byte por slot: sprite en los bits 5-7 y parámetro
+// (0..BARRA_NIVELES) en los 0-4; SPR_NINGUNO no es ninguna pareja válida.
+#define SLOT_DE(id, param) ((unsigned char)(((id) << 5) | (param)))
+#define SLOT_SPRITE(v) ((v) >> 5)
+#define SLOT_PARAM(v) ((v) & 0x1F)
+unsigned char slotSprite[CGRAM_SLOTS];        // SPR_NINGUNO desde LCD_Init
+unsigned char cgramVisible = 0;     // Bit por slot dibujado desde el último LCD_Limpiar
+unsigned int spritesHash = 0;       // CRC de character+obstacle ya subidos a la CGRAM
+unsigned char animFotograma = 0;
+unsigned char barraNivel = 0;
+unsigned int barraUmbral = 0;       // (barraNivel + 1) * goalValue
+// Códigos de carácter del frame actual
+unsigned char codPersonaje, codObstaculo, codPajaro, codRoca, codBarra[FILAS];
+
+#if ESTADISTICAS
+// Filas escritas en la CGRAM: total y por frame de juego
+unsigned int cgramEscrituras = 0;
+unsigned char cgramFilasFrame = 0;
+unsigned char cgramFilasMax = 0;
+#endif
+
 
 // Variables de estado - empaquetadas
 unsigned char Fila_Personaje = 1;
-unsigned char Ult_Fila_Personaje = 1;
 unsigned char Cont_Obstaculo = 1;
-unsigned char puntuacion = 0;
-unsigned char semilla = 0;
 
 // Flags combinados en un byte
 unsigned char gameFlags = 0;
@@ -70,15 +338,231 @@ unsigned char gameFlags = 0;
 #define GAME_INIT       0x02
 
 // Variables de tiempo - optimizadas
-volatile unsigned char timerTicks = 0;
-unsigned char segundosJuego = 0;
+volatile unsigned char timerTicks = 0;      // Medios segundos
+volatile unsigned int msMedioSegundo = 0;
+
+// ============ GENERADOR PSEUDOALEATORIO ============
+// xorshift de 16 bits (7, 9, 8): periodo 65535 con solo desplazamientos y
+// XOR. El estado nunca es 0. Con la misma semilla se repite la secuencia
+// de obstáculos, y la final de la partida informa de la que se usó.
+unsigned int azar = 1;
+
+// ============ GRABACIÓN Y REPETICIÓN DE ENTRADAS ============
+// Cada partida graba lo que hizo leer_botones_rapido en cada tick, con los
+// ticks sin acción comprimidos: un byte por cambio de fila, bit 7 = SALTA
+// (0 = AGACHA) y bits 0-6 = ticks sin acción antes de este. Un 127 en los
+// bits 0-6 son 127 ticks sin acción y ningún cambio. Con la semilla de la
+// partida basta para repetir el mismo resultado y la misma telemetría.
+// TRAMA_REPETIR carga una grabación en el mismo buffer y la siguiente
+// partida juega con ella en lugar de los botones.
+#ifndef GRABACION_MAX
+#define GRABACION_MAX 32
+#endif
+#define GRAB_SALTA 0x80
+#define GRAB_ESPERA 0x7F
+#define GRAB_TROZO 16               // Entradas por TRAMA_GRABACION_RESP/TRAMA_REPETIR
+#define GRAB_TRUNCADA 0x01          // Estado: la grabación se quedó sin sitio
+#define GRAB_EN_CURSO 0x02          // Estado: la partida grabada no ha terminado
+
+#define ACCION_NINGUNA 0
+#define ACCION_SALTA 1
+#define ACCION_AGACHA 2
+
+unsigned char grabacion[GRABACION_MAX];
+unsigned char grabacionLen = 0;
+unsigned char grabacionEspera = 0;      // Ticks sin acción aún no escritos
+unsigned char grabacionLlena = 0;
+unsigned int grabacionSemilla = 1;      // También la semilla de la partida en curso
+unsigned char repeticionArmada = 0;     // La próxima partida usa grabacion[]
+unsigned char repeticionActiva = 0;
+unsigned char repeticionPos = 0;
+unsigned char repeticionEspera = 0;
+
+// ============ SCHEDULER DE TICK FIJO (TIMER2) ============
+// Timer2 interrumpe cada 1 ms (Fosc/4, prescaler 1:4, PR2 = 249) y marca un
+// tick de juego cada periodoTickMs. El loop principal espera la marca en
+// lugar de usar __delay_ms, así el periodo no depende de lo que tarde el frame.
+#define T2_PR2_1MS 249
+#define T2_CON_1MS 0x05
+#define PERIODO_TICK_MS 110
+
+unsigned char periodoTickMs = PERIODO_TICK_MS;
+volatile unsigned char msTick = 0;          // ms transcurridos del tick actual
+volatile unsigned char tickListo = 0;
+#if PERFILADO || ESTADISTICAS
+volatile unsigned char tickOverruns = 0;    // Ticks de juego que llegaron con el anterior sin consumir
+unsigned char tickUsoMaxMs = 0;             // Peor duración de un tick de juego
+#endif
+
+#if PERFILADO
+// ============ PERFILADO ============
+// Marcas de Timer1 (1 µs = 1 ciclo de instrucción a 4 MHz) entre fases del
+// tick y alrededor de cada atender_uart. Incluye lo que roben las
+// interrupciones. Las medias se calculan fuera (suma / n) para no dividir;
+// cuando n llega a 255 o la suma no cabe en 16 bits se dividen las dos entre 2.
+// 5 bytes por fase y 4 fases: con más, el perfilado no cabe en los 368
+// bytes del PIC junto a la pila compilada.
+#define PERF_LOGICA 0               // Entrada, generación, desplazamiento, colisión y metas
+#define PERF_RENDER 1
+#define PERF_SCORE 2
+#define PERF_UART 3
+#define PERF_FASES 4
+#define PERF_POR_TRAMA 2
+#define PERF_REINICIA 0x80          // En TRAMA_PERFIL: poner a cero tras responder
+
+typedef struct {
+    unsigned int max;
+    unsigned char n;
+    unsigned int suma;
+} PerfFase;
+
+PerfFase perf[PERF_FASES];
+unsigned int perfMarca;
+unsigned char rxOcupacionMax = 0;           // Marca de agua alta del buffer RX
+
+#define PERF_INICIO() HAL_T1_LEE(perfMarca)
+#define PERF_FASE(f) perf_fase(f)
+#else
+#define PERF_INICIO() ((void)0)
+#define PERF_FASE(f) ((void)0)
+#endif
+
+// ============ BOTONES (MUESTREO EN TIMER2) ============
+// La ISR de 1 ms muestrea SALTA y AGACHA; un botón cambia de estado tras
+// BOTON_FILTRO muestras seguidas distintas de su estado filtrado y cada
+// pulsación deja un evento en la cola (soltar no hace nada en el juego).
+// El loop principal aplica las pulsaciones en cuanto llegan, también entre
+// ticks, con una acción como mucho por tick (la que se graba).
+// El filtro es un contador vertical: botonVc1:botonVc0 son los dos bits
+// del contador de cada botón, un bit por botón en cada byte, y se cuentan
+// los dos a la vez con operaciones lógicas. Un evento solo es el botón,
+// así que la cola entera cabe en un byte (bit n = evento n).
+#define BOTON_FILTRO 4
+#define BOTON_SALTA 0
+#define BOTON_AGACHA 1
+#define BOTON_COLA 8
+#define BOTON_COLA_MASK (BOTON_COLA - 1)
+
+unsigned char botonEstable = 0;             // Bit por botón: estado filtrado (1 = pulsado)
+unsigned char botonVc0 = 0;
+unsigned char botonVc1 = 0;
+volatile unsigned char botonCola = 0;       // Bit a 1: BOTON_AGACHA, a 0: BOTON_SALTA
+volatile unsigned char botonColaEscr = 0;
+volatile unsigned char botonColaLee = 0;
+unsigned char accionTick = 0;               // Acción ya aplicada para el próximo tick
+
+#if ESTADISTICAS
+volatile unsigned char msLibre = 0;         // ms a rueda libre, marca de tiempo de los eventos
+unsigned char botonColaMs[BOTON_COLA];
+unsigned char botonPerdidos = 0;            // Eventos con la cola llena
+
+// Pulsación -> personaje movido, en ms desde la primera muestra del flanco
+unsigned char latenciaMaxMs = 0;
+unsigned int latenciaSumaMs = 0;
+unsigned int latenciaEventos = 0;
+#endif
 
-// Buffer temporal
-unsigned char tempBuffer[4];
 unsigned char proxima_generacion = 0;
 unsigned char separacion_minima = 2;
 unsigned char separacion_maxima = 5;
 
+// ============ SECUENCIADOR DE AUDIO (CCP1 + TIMER1) ============
+// Las canciones son tablas en ROM de pares (nota, duración):
+//  - nota > 0: la duración es el número de repeticiones de 32 periodos
+//    (lo que duraba cada llamada a las antiguas funciones de nota).
+//  - NOTA_SILENCIO: la duración va en unidades de 10 ms.
+// Timer1 corre libre a 1 MHz y CCP1 en modo comparación genera una
+// interrupción por cada semiperiodo, donde se conmuta BOCINA. Los silencios
+// se cuentan en el tick de 1 ms de Timer2. La CPU queda libre mientras suena.
+#define NOTA_SILENCIO 0
+#define FIN_CANCION 0xFF
+
+#define NOTA_MI5 1
+#define NOTA_DO5 2
+#define NOTA_SOL5 3
+#define NOTA_SOL4 4
+#define NOTA_LA4 5
+#define NOTA_FA5 6
+#define NOTA_FA2 7
+#define NOTA_SOL2 8
+#define NOTA_LA2 9
+#define NOTA_LAS2 10
+#define NOTA_DO3 11
+#define NOTA_RE3 12
+#define NOTA_MI3 13
+#define NOTA_FA3 14
+#define NOTA_SOL3 15
+#define NOTA_SI4 16
+#define NOTA_RE5 17
+#define NOTA_LA3 18
+#define NOTA_SI3 19
+#define NOTA_DO4 20
+#define NOTA_MI4 21
+#define NOTA_LA5 22
+#define NOTA_SI5 23
+#define NOTA_DO6 24
+#define NOTA_RE6 25
+
+#define CCP1_COMPARA_INT 0x0A   // Comparación: solo interrupción, pin RC2 intacto
+
+// Semiperiodo de cada nota en µs (ciclos de Timer1)
+const unsigned int semiperiodoNota[] = {
+    0,
+    379, 478, 319, 638, 568, 358,
+    2863, 2551, 2273, 2145,
+    1911, 1703, 1517, 1432, 1276,
+    506, 426, 1136, 1012, 956, 758,
+    284, 253, 239, 212
+};
+
+// Los __delay_ms(0.1) entre notas de la versión anterior no se conservan
+const unsigned char cancionInicio[] = {
+    NOTA_MI5, 2, NOTA_SILENCIO, 10,
+    NOTA_MI5, 2, NOTA_SILENCIO, 20,
+    NOTA_MI5, 2, NOTA_SILENCIO, 20,
+    NOTA_DO5, 2, NOTA_SILENCIO, 10,
+    NOTA_MI5, 2, NOTA_SILENCIO, 20,
+    NOTA_SOL5, 4, NOTA_SILENCIO, 40,
+    NOTA_SOL4, 6, NOTA_SILENCIO, 10,
+    FIN_CANCION, 0
+};
+
+const unsigned char cancionMuerte[] = {
+    NOTA_SOL3, 1, NOTA_SOL4, 1, NOTA_SI4, 1, NOTA_SILENCIO, 10,
+    NOTA_RE5, 1, NOTA_FA5, 1, NOTA_SILENCIO, 20,
+    NOTA_SOL3, 1, NOTA_RE5, 1, NOTA_FA5, 1, NOTA_SILENCIO, 10,
+    NOTA_SOL3, 1, NOTA_RE5, 1, NOTA_FA5, 1, NOTA_SILENCIO, 10,
+    NOTA_LA3, 1, NOTA_DO5, 1, NOTA_MI5, 1, NOTA_SILENCIO, 10,
+    NOTA_SI3, 1, NOTA_SI4, 1, NOTA_RE5, 1, NOTA_SILENCIO, 10,
+    NOTA_DO4, 1, NOTA_SOL4, 1, NOTA_DO5, 1, NOTA_SILENCIO, 10,
+    NOTA_MI4, 1, NOTA_SILENCIO, 10,
+    NOTA_SOL3, 1, NOTA_SILENCIO, 10,
+    NOTA_MI4, 1, NOTA_SILENCIO, 10,
+    NOTA_DO3, 1, NOTA_DO4, 1,
+    FIN_CANCION, 0
+};
+
+const unsigned char cancionVictoria[] = {
+    NOTA_SILENCIO, 100,
+    NOTA_FA3, 1, NOTA_LA4, 1, NOTA_DO5, 1, NOTA_SILENCIO, 10,
+    NOTA_SI4, 1, NOTA_RE5, 1, NOTA_SILENCIO, 10,
+    NOTA_DO5, 1, NOTA_MI5, 1, NOTA_SILENCIO, 10,
+    NOTA_FA3, 1, NOTA_RE5, 1, NOTA_FA5, 7, NOTA_SILENCIO, 10,
+    NOTA_FA3, 1, NOTA_MI5, 1, NOTA_SOL5, 1, NOTA_SILENCIO, 10,
+    NOTA_SOL3, 1, NOTA_FA5, 1, NOTA_LA5, 1, NOTA_SILENCIO, 10,
+    NOTA_SOL3, 1, NOTA_SOL5, 1, NOTA_SI5, 1, NOTA_SILENCIO, 10,
+    NOTA_DO3, 1, NOTA_LA5, 1, NOTA_DO6, 1, NOTA_SILENCIO, 40,
+    NOTA_DO3, 1, NOTA_MI4, 1, NOTA_DO5, 1, NOTA_SILENCIO, 10,
+    FIN_CANCION, 0
+};
+
+const unsigned char *cancionPtr;
+unsigned int semiperiodoActual;
+unsigned int proximoFlanco;
+volatile unsigned int togglesRestantes = 0;
+volatile unsigned int silencioMs = 0;
+volatile unsigned char cancionSonando = 0;
+
 // ============ MACROS INLINE PARA VELOCIDAD ============
 #define SET_FLAG(var, flag) ((var) |= (flag))
 #define CLR_FLAG(var, flag) ((var) &= ~(flag))
@@ -92,204 +576,549 @@ unsigned char separacion_maxima = 5;
 #define CLR_GAME_INIT() CLR_FLAG(gameFlags, GAME_INIT)
 
 // ============ PROTOTIPOS ============
-void E_ENC(void);
-void COMANDO(unsigned char valor);
-void DIGITO(unsigned char valor);
+void LCD_Encola(unsigned char valor, unsigned char rs);
 void LCD_Init(void);
 void LCD_Posicion(unsigned char col, unsigned char fila);
 void LCD_Escr_String(const char *str);
-void LCD_CargarSprites(void);
+unsigned char sprite_fila(unsigned char id, unsigned char param, unsigned char fila);
+unsigned char sprite_param(unsigned char id);
+unsigned char sprite_usar(unsigned char id);
+void sprites_frame(void);
+void sprites_nueva_partida(void);
+void LCD_Limpiar(void);
+void LCD_Celda(unsigned char col, unsigned char fila, unsigned char c);
 
 void UART_Init(void);
-void UART_Escr(unsigned char dato);
+void UART_Baudios(unsigned char indice);
+void baud_plazo(unsigned int ms);
+void vigilar_baudios(void);
+unsigned char UART_TxEncola(unsigned char dato);
+unsigned char UART_TxLibre(void);
 void UART_Escr_String(const char *str);
 unsigned char UART_Disp(void);
 unsigned char UART_LeeBuffer(void);
-unsigned char buscaChar(unsigned char c);
-void UART_LimpiaBuffer(void);
+void atender_uart(void);
+#if PERFILADO
+void perf_fase(unsigned char f);
+void perf_reiniciar(void);
+void enviar_perfil(unsigned char fase);
+#endif
+
+void bcd_cero(ContadorBCD *c);
+void bcd_incrementar(ContadorBCD *c);
+void bcd_desde(ContadorBCD *c, unsigned int valor);
+unsigned char bcd_texto(const ContadorBCD *c, char *texto);
+unsigned int segundos_leer(ContadorBCD *copia);
 
 void inicializar_juego(void);
 void actualizar_pantalla_rapido(void);
 void desplazar_mundo_rapido(void);
 void generar_obstaculo(void);
 void actualizar_score_rapido(void);
+void calcular_score(unsigned char *celdas);
+void renderizar_frame(void);
+unsigned int azar_siguiente(void);
 unsigned char random_number(unsigned char max);
 void leer_botones_rapido(void);
+void botones_muestrear(void);
+void atender_botones(void);
+void pintar_personaje(void);
+void grabar_accion(unsigned char accion);
+unsigned char repeticion_accion(void);
+void enviar_grabacion(unsigned char desde);
+void cargar_repeticion(unsigned char n);
 unsigned char detectar_colision(void);
+unsigned char glifo_mundo(unsigned char col, unsigned char fila);
 void evaluar_metas(void);
 void inicializar_telemetria(void);
 void enviar_telemetria(void);
+void enviar_telemetria_vivo(unsigned char estado);
+unsigned char stream_divisor_minimo(void);
 void Timer1_Init(void);
+void Timer2_Init(void);
+void esperar_tick(void);
+void reiniciar_scheduler(void);
+void tick_juego(void);
 void mostrar_victoria(void);
 void mostrar_derrota(void);
 
-void JSON_Parse(void);
-unsigned int strToUInt(unsigned char len);
-unsigned char leerDigitos(void);
+unsigned char JSON_Filtrar(const char * const *tabla, unsigned char n, unsigned char c);
+unsigned char JSON_Resolver(const char * const *tabla, unsigned char n);
+void JSON_Reinicia(void);
+unsigned char JSON_GuardaElemento(void);
+unsigned char JSON_TrasValor(unsigned char c);
+unsigned char JSON_Paso(unsigned char c);
+unsigned char JSON_Byte(unsigned char c);
+unsigned int CRC16(const unsigned char *datos, unsigned char n);
+unsigned char COBS_Decodifica(unsigned char *b, unsigned char n);
+void UART_EnviaTrama(unsigned char *datos, unsigned char n);
+void procesar_trama(void);
+void enviarAckTrama(unsigned char seq, unsigned char codigo);
 void enviarConfirmacion(void);
+void enviarErrorConfig(unsigned char codigo);
 unsigned char validarConfiguracion(void);
 void inicializarNivel(void);
+void nivel_desde_trama(void);
+unsigned char eeprom_leer(unsigned char dir);
+void eeprom_escribir(unsigned char dir, unsigned char dato);
+void enviar_slots(void);
+unsigned char cargar_slot(unsigned char slot);
+void guardar_slot(void);
 void calcular_proxima_separacion(void);
 
 // Prototipos de música
 void PARPADEO(void);
-void iniciar(void);
-void death(void);
-void victoria(void);
-
-// Notas musicales
-void MI_OCT_5(void);
-void DO_OCT_5(void);
-void SOL_OCT_5(void);
-void SOL_OCT_4(void);
-void LA_OCT_4(void);
-void FA_OCT_5(void);
-void FA_OCT_2(void);
-void SOL_OCT_2(void);
-void LA_OCT_2(void);
-void LAS_OCT_2(void);
-void DO_OCT_3(void);
-void RE_OCT_3(void);
-void MI_OCT_3(void);
-void FA_OCT_3(void);
-void SOL_OCT_3(void);
-void SI_OCT_4(void);
-void RE_OCT_5(void);
-void LA_OCT_3(void);
-void SI_OCT_3(void);
-void DO_OCT_4(void);
-void MI_OCT_4(void);
-void DO_OCT_3(void);
-void LA_OCT_5(void);
-void SI_OCT_5(void);
-void DO_OCT_6(void);
-void RE_OCT_6(void);
+void reproducir_cancion(const unsigned char *cancion);
 
 // ============ FUNCIONES LCD - OPTIMIZADAS ============
-void E_ENC(void) {
-    PORTCbits.RC2 = 1;
-    __delay_us(100);
-    PORTCbits.RC2 = 0;
-}
-
-void COMANDO(unsigned char valor) {
-    PORTB = valor;
-    PORTCbits.RC0 = 0;
-    PORTCbits.RC1 = 0;
-    E_ENC();
-    __delay_us(50);
-}
+// COMANDO y DIGITO solo encolan; la ISR de Timer2 vacía la cola
+// consultando el busy flag en lugar de retardos fijos. Son macros para no
+// gastar un nivel de pila (ver la ISR).
+#define COMANDO(valor) LCD_Encola((valor), 0)
+#define DIGITO(valor) LCD_Encola((valor), 1)
 
-void DIGITO(unsigned char valor) {
-    PORTB = valor;
-    PORTCbits.RC0 = 1;
-    PORTCbits.RC1 = 0;
-    E_ENC();
+void LCD_Encola(unsigned char valor, unsigned char rs) {
+    unsigned char pos, mascara;
+    
+    while((unsigned char)(lcdColaEscr - lcdColaLee) >= LCD_COLA) HAL_ESPERA();
+    
+    pos = lcdColaEscr & LCD_COLA_MASK;
+    mascara = 1 << (pos & 7);
+    lcdColaDato[pos] = valor;
+    if(rs) lcdColaRS[pos >> 3] |= mascara;
+    else lcdColaRS[pos >> 3] &= ~mascara;
+    lcdColaEscr++;
+#if ESTADISTICAS
+    lcdEscrituras++;
+#endif
 }
 
+// Requiere Timer2 en marcha para que la cola se vacíe
 void LCD_Init(void) {
-    TRISB = 0x00;
-    TRISCbits.TRISC0 = 0;
-    TRISCbits.TRISC1 = 0;
-    TRISCbits.TRISC2 = 0;
+    unsigned char slot;
+    
+    HAL_LCD_PINES();
     
+    // Reset interno del HD44780 tras el encendido; el busy flag no es
+    // fiable hasta que termina
     __delay_ms(50);
     
     COMANDO(0x38);
     COMANDO(0x0C);
     COMANDO(0x01);
     COMANDO(0x06);
-    __delay_ms(2);
+    
+    // La CGRAM arranca con contenido indefinido
+    for(slot = 0; slot < CGRAM_SLOTS; slot++) slotSprite[slot] = SPR_NINGUNO;
 }
 
-void LCD_CargarSprites(void) {
-    unsigned char i;
-    
-    COMANDO(0x40);
-    for(i = 0; i < 8; i++) DIGITO(nivel.character[i]);
+void LCD_Posicion(unsigned char col, unsigned char fila) {
+    COMANDO((fila == 0) ? (0x80 + col) : (0xC0 + col));
+    lcdCursor = 0xFF;
+}
+
+void LCD_Limpiar(void) {
+    unsigned char fil, col;
     
-    COMANDO(0x48);
-    for(i = 0; i < 8; i++) DIGITO(nivel.obstacle[i]);
+    COMANDO(0x01);
     
-    COMANDO(0x80);
-    SET_FLAG(nivel.flags, 0x03);
+    for(fil = 0; fil < FILAS; fil++)
+        for(col = 0; col < COLUMNAS; col++)
+            lcdSombra[fil][col] = ' ';
+    lcdCursor = 0x80;
+    // Los slots dibujados ya no están a la vista: sprite_usar puede desalojarlos
+    cgramVisible = 0;
 }
 
-void LCD_Posicion(unsigned char col, unsigned char fila) {
-    COMANDO((fila == 0) ? (0x80 + col) : (0xC0 + col));
+// Escribe una celda solo si difiere de la sombra; el reposicionamiento se
+// omite cuando el cursor ya quedó en la celda por el autoincremento.
+void LCD_Celda(unsigned char col, unsigned char fila, unsigned char c) {
+    unsigned char dir;
+    
+    if(lcdSombra[fila][col] == c) return;
+    
+    dir = (fila == 0) ? (0x80 + col) : (0xC0 + col);
+    if(lcdCursor != dir) COMANDO(dir);
+    DIGITO(c);
+    
+    lcdSombra[fila][col] = c;
+    lcdCursor = dir + 1;
 }
 
+
 void LCD_Escr_String(const char *str) {
     while(*str) DIGITO(*str++);
 }
 
+// ============ SPRITES EN CGRAM ============
+// Sprites fijos en ROM: pájaro (2 fotogramas), roca, trofeo y calavera
+const unsigned char spritesROM[5][8] = {
+    { 0x00, 0x11, 0x0A, 0x04, 0x0E, 0x04, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x04, 0x0E, 0x15, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x0E, 0x1F, 0x1F, 0x1F },
+    { 0x1F, 0x1F, 0x1F, 0x0E, 0x04, 0x04, 0x0E, 0x1F },
+    { 0x0E, 0x1F, 0x15, 0x1F, 0x0E, 0x0E, 0x0A, 0x00 }
+};
+
+// Fila `fila` (0 = arriba) del sprite `id` dibujado con `param`
+unsigned char sprite_fila(unsigned char id, unsigned char param, unsigned char fila) {
+    unsigned char v;
+    
+    switch(id) {
+    case SPR_PERSONAJE:
+        v = nivel.character[fila];
+        // Fotograma 1: en las 3 filas de abajo los píxeles de los bordes
+        // pasan a la columna de al lado
+        if(param && fila >= 5) v = (v & 0x0E) | ((v & 0x10) >> 1) | ((v & 0x01) << 1);
+        return v;
+    case SPR_OBSTACULO:
+        return nivel.obstacle[fila];
+    case SPR_BARRA_ARRIBA:
+        // La barra se llena de abajo arriba: niveles 9..16 en la celda de arriba
+        return (param > (unsigned char)(15 - fila)) ? BARRA_FILA : 0;
+    case SPR_BARRA_ABAJO:
+        return (param > (unsigned char)(7 - fila)) ? BARRA_FILA : 0;
+    case SPR_PAJARO:
+        return spritesROM[param][fila];
+    default:
+        return spritesROM[id - SPR_ROCA + 2][fila];
+    }
+}
+
+// Parámetro con el que hay que dibujar ahora el sprite
+unsigned char sprite_param(unsigned char id) {
+    switch(id) {
+    case SPR_PERSONAJE: return animFotograma;
+    case SPR_PAJARO: return animFotograma ^ 1;
+    case SPR_BARRA_ARRIBA:
+    case SPR_BARRA_ABAJO: return barraNivel;
+    default: return 0;
+    }
+}
+
+// Código de carácter del sprite, subiéndolo si no está o está con otro
+// parámetro. En un fallo se ocupa un slot vacío o, si no hay, uno que no
+// se haya dibujado desde el último LCD_Limpiar (sustituir uno a la vista
+// cambiaría celdas ya pintadas). Sin slot posible se usa '*' de la ROM.
+// Al subirlo solo escribe las filas que difieren de lo que ya tenía el
+// slot (todas si el contenido es desconocido); las filas seguidas
+// aprovechan el autoincremento de la dirección CGRAM. La subida va aquí
+// dentro y no en una función aparte por la pila (ver la ISR).
+unsigned char sprite_usar(unsigned char id) {
+    unsigned char slot, param, fila, v, dir, viejo;
+    
+    for(slot = 0; slot < CGRAM_SLOTS; slot++)
+        if(slotSprite[slot] != SPR_NINGUNO && SLOT_SPRITE(slotSprite[slot]) == id) break;
+    
+    if(slot == CGRAM_SLOTS) {
+        for(slot = 0; slot < CGRAM_SLOTS; slot++)
+            if(slotSprite[slot] == SPR_NINGUNO) break;
+        if(slot == CGRAM_SLOTS)
+            for(slot = 0; slot < CGRAM_SLOTS; slot++)
+                if(!(cgramVisible & (1 << slot))) break;
+        if(slot == CGRAM_SLOTS) return '*';
+    }
+    
+    param = sprite_param(id);
+    viejo = slotSprite[slot];
+    if(viejo != SLOT_DE(id, param)) {
+        for(fila = 0; fila < 8; fila++) {
+            v = sprite_fila(id, param, fila);
+            if(viejo != SPR_NINGUNO && sprite_fila(SLOT_SPRITE(viejo), SLOT_PARAM(viejo), fila) == v) continue;
+            
+            dir = 0x40 | (slot << 3) | fila;
+            if(lcdCursor != dir) COMANDO(dir);
+            DIGITO(v);
+            // Tras 0x7F la CGRAM vuelve a 0x40, no a la DDRAM
+            lcdCursor = (dir == 0x7F) ? 0xFF : dir + 1;
+#if ESTADISTICAS
+            cgramEscrituras++;
+            cgramFilasFrame++;
+#endif
+        }
+        slotSprite[slot] = SLOT_DE(id, param);
+    }
+    cgramVisible |= 1 << slot;
+    return slot;
+}
+
+// Fotograma y barra del frame, y códigos de los sprites de juego. Con todo
+// residente solo cuestan las filas que cambian de fotograma o de nivel.
+void sprites_frame(void) {
+    unsigned int valor = (nivel.goalType == 1) ? telemetria.obstaclesEsquivados
+                                               : segundos_leer(0);
+    
+    animFotograma = (ticksPartida >> 1) & 1;
+    
+    // barraNivel = valor * 16 / goalValue sin dividir (goalValue < 1000)
+    while(barraNivel < BARRA_NIVELES && (valor << 4) >= barraUmbral) {
+        barraNivel++;
+        barraUmbral += nivel.goalValue;
+    }
+    
+    codPersonaje = sprite_usar(SPR_PERSONAJE);
+    codObstaculo = sprite_usar(SPR_OBSTACULO);
+    codBarra[0] = sprite_usar(SPR_BARRA_ARRIBA);
+    codBarra[1] = sprite_usar(SPR_BARRA_ABAJO);
+    // Las variantes solo se animan/suben si hay alguna en pantalla
+    if(mundoTipo[0]) codPajaro = sprite_usar(SPR_PAJARO);
+    if(mundoTipo[1]) codRoca = sprite_usar(SPR_ROCA);
+}
+
+// Al empezar partida: si la configuración trae otros sprites, los slots
+// que tenían los suyos pasan a tener contenido desconocido. Los sprites de
+// juego se suben en el renderizar_frame de inicializar_juego, antes del
+// primer tick (el pájaro y la roca, la primera vez que aparecen).
+void sprites_nueva_partida(void) {
+    unsigned char slot;
+    unsigned int hash = CRC16((const unsigned char *)&nivel, 16);
+    
+    if(hash != spritesHash) {
+        spritesHash = hash;
+        for(slot = 0; slot < CGRAM_SLOTS; slot++)
+            // SPR_PERSONAJE y SPR_OBSTACULO son los dos primeros
+            if(SLOT_SPRITE(slotSprite[slot]) <= SPR_OBSTACULO) slotSprite[slot] = SPR_NINGUNO;
+    }
+    barraNivel = 0;
+    barraUmbral = nivel.goalValue;
+}
+
 // ============ FUNCIONES UART - OPTIMIZADAS ============
 void UART_Init(void) {
-    TRISCbits.TRISC6 = 0;
-    TRISCbits.TRISC7 = 1;
+    HAL_UART_INIT(spbrgBaudios[0]);
+    HAL_INT_HABILITA();
+}
+
+// Cambia la velocidad después de terminar de enviar lo pendiente
+void UART_Baudios(unsigned char indice) {
+    while(txBufferRead != txBufferWrite || !HAL_UART_TX_LISTO()) HAL_ESPERA();
     
-    SPBRG = 25;
-    TXSTAbits.BRGH = 1;
-    TXSTAbits.SYNC = 0;
-    TXSTAbits.TXEN = 1;
-    RCSTAbits.SPEN = 1;
-    RCSTAbits.CREN = 1;
+    HAL_UART_BAUD(spbrgBaudios[indice]);
+    baudActual = indice;
+    baud_plazo(0);
+    baudVencido = 0;
+    uartErroresTrama = 0;
     
-    PIE1bits.RCIE = 1;
-    INTCONbits.PEIE = 1;
-    INTCONbits.GIE = 1;
+    // Lo recibido a medias a la velocidad anterior no sirve
+    tramaActiva = 0;
+    tramaLen = 0;
+    JSON_Reinicia();
 }
 
-void UART_Escr(unsigned char dato) {
-    while(!TXSTAbits.TRMT);
-    TXREG = dato;
+// baudPlazoMs es de 16 bits y la ISR lo decrementa: se escribe con las
+// interrupciones apagadas para que no mezcle un byte nuevo con uno viejo
+void baud_plazo(unsigned int ms) {
+    HAL_INT_GLOBAL(0);
+    baudPlazoMs = ms;
+    HAL_INT_GLOBAL(1);
 }
 
+// Vuelve a 9600 si el eco no llegó a tiempo o si la línea da errores de
+// trama (p. ej. el backend se reinició y habla de nuevo a 9600)
+void vigilar_baudios(void) {
+    if(baudActual == 0) return;
+    if(baudVencido || uartErroresTrama >= BAUD_MAX_ERRORES) UART_Baudios(0);
+}
+
+// Encola un byte sin bloquear; devuelve 0 si el buffer está lleno.
+// La ISR lo envía en cuanto TXREG queda libre.
+unsigned char UART_TxEncola(unsigned char dato) {
+    unsigned char ocupados = txBufferWrite - txBufferRead;
+    
+    if(ocupados >= TX_BUFFER_SIZE) return 0;
+    
+    uartTxBuffer[txBufferWrite & TX_BUFFER_MASK] = dato;
+    txBufferWrite++;
+#if ESTADISTICAS
+    if(++ocupados > txOcupacionMax) txOcupacionMax = ocupados;
+#endif
+    
+    HAL_UART_TX_IE(1);
+    return 1;
+}
+
+unsigned char UART_TxLibre(void) {
+    return TX_BUFFER_SIZE - (unsigned char)(txBufferWrite - txBufferRead);
+}
+
+// Solo espera si el buffer está lleno. Macro por la pila (ver la ISR);
+// dato se evalúa una vez
+#define UART_Escr(dato) do { \
+    unsigned char uartDato_ = (dato); \
+    while(!UART_TxEncola(uartDato_)) HAL_ESPERA(); \
+} while(0)
+
 void UART_Escr_String(const char *str) {
     while(*str) UART_Escr(*str++);
 }
 
 // ============ TIMER1 OPTIMIZADO ============
+// Timer1 corre libre a Fosc/4 (1 µs por cuenta) como base de CCP1 para el
+// audio; los segundos de juego se cuentan en el tick de 1 ms de Timer2.
 void Timer1_Init(void) {
-    T1CONbits.TMR1ON = 0;
-    T1CONbits.TMR1CS = 0;
-    T1CONbits.T1CKPS0 = 1;
-    T1CONbits.T1CKPS1 = 1;
-    
-    TMR1H = 0x0B;
-    TMR1L = 0xDC;
+    HAL_T1_INIT();
+    HAL_T1_IE(0);
+    HAL_CCP1_MODO(0);
+    HAL_CCP1_IF_CLR();
+    HAL_CCP1_IE(1);
+    HAL_T1_ON(1);
     
-    PIR1bits.TMR1IF = 0;
-    PIE1bits.TMR1IE = 1;
     timerTicks = 0;
-    segundosJuego = 0;
 }
 
+// ============ TIMER2: TICK DEL SISTEMA ============
+void Timer2_Init(void) {
+    HAL_T2_INIT(T2_PR2_1MS, T2_CON_1MS);
+}
+
+// Hasta la marca del próximo tick se atiende la UART, de modo que la
+// configuración fluye por el buffer de 16 bytes sin desbordarlo. Una
+// configuración completa no espera al tick para responderse.
+void esperar_tick(void) {
+    while(!tickListo && configResultado == JSON_EN_CURSO) {
+        vigilar_baudios();
+        if(botonColaLee != botonColaEscr) atender_botones();
+        if(UART_Disp()) {
+            PERF_INICIO();
+            atender_uart();
+            PERF_FASE(PERF_UART);
+        }
+        else HAL_ESPERA();
+    }
+    tickListo = 0;
+}
+
+void reiniciar_scheduler(void) {
+    msTick = 0;
+    tickListo = 0;
+#if PERFILADO || ESTADISTICAS
+    tickOverruns = 0;
+    tickUsoMaxMs = 0;
+#endif
+}
+
+// La pila hardware del PIC16F877A tiene 8 niveles y al desbordarse da la
+// vuelta sin avisar. La ISR se queda en 2 (la interrupción y una llamada
+// hoja o una lectura de tabla en ROM), así que el programa principal no
+// puede pasar de 6: por eso el vaciado del LCD y el secuenciador de música
+// van aquí dentro, y COMANDO, DIGITO y UART_Escr son macros.
 void __interrupt() ISR(void) {
-    if(PIR1bits.RCIF) {
-        if(RCSTAbits.OERR) {
-            RCSTAbits.CREN = 0;
-            RCSTAbits.CREN = 1;
+    unsigned char pos, nota, duracion, avanzar = 0;
+    
+    if(HAL_UART_RX_PENDIENTE()) {
+        if(HAL_UART_RX_OVERRUN()) {
+            HAL_UART_RX_REINICIA();
         }
-        uartBuffer[bufferWrite & BUFFER_MASK] = RCREG;
+        if(HAL_UART_RX_ERROR_TRAMA() && uartErroresTrama < 255) uartErroresTrama++;
+        uartBuffer[bufferWrite & BUFFER_MASK] = HAL_UART_RX();
         bufferWrite++;
+#if PERFILADO
+        if((unsigned char)(bufferWrite - bufferRead) > rxOcupacionMax)
+            rxOcupacionMax = bufferWrite - bufferRead;
+#endif
+    }
+    
+    if(HAL_UART_TX_IE_ACTIVA() && HAL_UART_TX_IF()) {
+        if(txBufferRead != txBufferWrite) {
+            HAL_UART_TX(uartTxBuffer[txBufferRead & TX_BUFFER_MASK]);
+            txBufferRead++;
+        }
+        if(txBufferRead == txBufferWrite) HAL_UART_TX_IE(0);
     }
     
-    if(PIR1bits.TMR1IF) {
-        PIR1bits.TMR1IF = 0;
+    if(HAL_CCP1_IF()) {
+        HAL_CCP1_IF_CLR();
+        
+        BOCINA = !BOCINA;
+        proximoFlanco += semiperiodoActual;
+        HAL_CCP1_COMPARA(proximoFlanco);
+        
+        if(--togglesRestantes == 0) avanzar = 1;
+    }
+    
+    if(HAL_T2_IF()) {
+        HAL_T2_IF_CLR();
+        
+#if ESTADISTICAS
+        msLibre++;
+#endif
+        botones_muestrear();
         
-        TMR1H = 0x0B;
-        TMR1L = 0xDC;
+        if(++msTick >= periodoTickMs) {
+            msTick = 0;
+#if PERFILADO || ESTADISTICAS
+            if(tickListo && IS_GAME_ACTIVE()) tickOverruns++;
+#endif
+            tickListo = 1;
+        }
         
         if(CHK_FLAG(telemetria.flags, 0x02)) {
-            timerTicks++;
-            if(timerTicks >= 2) {
-                timerTicks = 0;
-                segundosJuego++;
-                telemetria.tiempoTranscurrido = segundosJuego;
+            if(++msMedioSegundo >= 500) {
+                msMedioSegundo = 0;
+                timerTicks++;
+                if(timerTicks >= 2) {
+                    timerTicks = 0;
+                    telemetria.tiempoTranscurrido++;
+                    bcd_incrementar(&bcdSegundos);
+                }
+            }
+        }
+        
+        if(silencioMs && --silencioMs == 0) avanzar = 1;
+        
+        if(baudPlazoMs && --baudPlazoMs == 0) baudVencido = 1;
+        
+        // Una escritura de la cola por ms si el LCD ya terminó la anterior
+        // (un clear de 1.52 ms simplemente se salta un tick). Busy flag: DB7
+        // con RS=0, RW=1; a 4 MHz cada instrucción dura 1 µs, más que el
+        // ancho de pulso y el retardo de datos del HD44780.
+        if(lcdColaLee != lcdColaEscr) {
+            HAL_LCD_BUS_ENTRADA();
+            HAL_LCD_RS(0);
+            HAL_LCD_RW(1);
+            HAL_LCD_E(1);
+            pos = HAL_LCD_BUS_LEE() & 0x80;
+            HAL_LCD_E(0);
+            HAL_LCD_RW(0);
+            HAL_LCD_BUS_SALIDA();
+            
+            if(!pos) {
+                pos = lcdColaLee & LCD_COLA_MASK;
+                HAL_LCD_BUS(lcdColaDato[pos]);
+                HAL_LCD_RS((lcdColaRS[pos >> 3] >> (pos & 7)) & 1);
+                HAL_LCD_RW(0);
+                HAL_LCD_E(1);
+                HAL_LCD_E(0);
+                lcdColaLee++;
             }
         }
     }
+    
+    // Siguiente entrada de la canción: al acabar una nota o un silencio
+    if(avanzar) {
+        nota = cancionPtr[0];
+        duracion = cancionPtr[1];
+        
+        HAL_CCP1_MODO(0);
+        BOCINA = 0;
+        
+        if(nota == FIN_CANCION) {
+            cancionSonando = 0;
+        } else if(nota == NOTA_SILENCIO) {
+            cancionPtr += 2;
+            silencioMs = ((unsigned int)duracion << 3) + ((unsigned int)duracion << 1);
+            if(silencioMs == 0) silencioMs = 1;
+        } else {
+            cancionPtr += 2;
+            semiperiodoActual = semiperiodoNota[nota];
+            togglesRestantes = (unsigned int)duracion << 6;
+            HAL_T1_LEE(proximoFlanco);
+            proximoFlanco += semiperiodoActual;
+            HAL_CCP1_COMPARA(proximoFlanco);
+            HAL_CCP1_IF_CLR();
+            HAL_CCP1_MODO(CCP1_COMPARA_INT);
+        }
+    }
 }
 
 unsigned char UART_Disp(void) {
@@ -298,126 +1127,441 @@ unsigned char UART_Disp(void) {
 
 unsigned char UART_LeeBuffer(void) {
     unsigned char dato;
-    while(!UART_Disp());
+    while(!UART_Disp()) HAL_ESPERA();
     dato = uartBuffer[bufferRead & BUFFER_MASK];
     bufferRead++;
     return dato;
 }
 
-unsigned char buscaChar(unsigned char c) {
-    unsigned char temp = bufferRead;
-    while(temp != bufferWrite) {
-        if(uartBuffer[temp & BUFFER_MASK] == c) return 1;
-        temp++;
+// Entrega los bytes recibidos al parser de configuración. Durante una
+// partida se descartan, igual que antes.
+// Los bytes entre dos 0x00 forman una trama binaria; el resto va al
+// parser JSON.
+void atender_uart(void) {
+    unsigned char r, c = UART_LeeBuffer();
+    
+    if(c == 0x00) {
+        if(tramaActiva && tramaLen) {
+            procesar_trama();
+            tramaActiva = 0;
+        } else {
+            tramaActiva = 1;
+        }
+        tramaLen = 0;
+        JSON_Reinicia();
+        return;
+    }
+    
+    if(tramaActiva) {
+        // Una trama demasiado larga se descarta entera
+        if(tramaLen < TRAMA_MAX) trama[tramaLen++] = c;
+        else tramaActiva = 0;
+        return;
+    }
+    
+    if(IS_GAME_INIT()) {
+        JSON_Reinicia();
+        return;
+    }
+    r = JSON_Byte(c);
+    if(r != JSON_EN_CURSO) {
+        configResultado = r;
+        configBinaria = 0;
     }
-    return 0;
 }
 
-void UART_LimpiaBuffer(void) {
-    bufferRead = bufferWrite;
+// ============ PARSER JSON INCREMENTAL ============
+// Consume la configuración byte a byte sin bloquear: JSON_Byte no toca la
+// UART, así que puede llamarse desde el bucle principal o desde la ISR.
+// Las claves y el valor de goalType se comparan completos contra tablas;
+// cualquier byte inesperado termina con un código de error y el parser
+// vuelve a esperar el próximo '{'.
+const char * const clavesConfig[] = { "character", "obstacle", "goalType", "goalValue", "seed" };
+const char * const tiposMeta[] = { "time", "obstacles" };
+
+unsigned char JSON_Filtrar(const char * const *tabla, unsigned char n, unsigned char c) {
+    unsigned char i, bit = 1;
+    
+    // Un control (o un 0) nunca forma parte de una clave y evita leer más
+    // allá del terminador de las tablas
+    if(c < ' ') return jp.candidatos = 0;
+    
+    for(i = 0; i < n; i++, bit <<= 1) {
+        if((jp.candidatos & bit) && tabla[i][jp.pos] != c) jp.candidatos &= ~bit;
+    }
+    jp.pos++;
+    return jp.candidatos;
 }
 
-// ============ FUNCIONES DE CONVERSIÓN - OPTIMIZADAS ============
-unsigned int strToUInt(unsigned char len) {
-    unsigned int resultado = 0;
-    unsigned char i = 0;
+// Índice del candidato que termina justo en la posición actual (0xFF si ninguno)
+unsigned char JSON_Resolver(const char * const *tabla, unsigned char n) {
+    unsigned char i, bit = 1;
     
-    while(i < len && tempBuffer[i] >= '0' && tempBuffer[i] <= '9') {
-        resultado = (resultado << 3) + (resultado << 1) + (tempBuffer[i++] - '0');
+    for(i = 0; i < n; i++, bit <<= 1) {
+        if((jp.candidatos & bit) && tabla[i][jp.pos] == 0) return i;
     }
-    return resultado;
+    return 0xFF;
 }
 
-unsigned char leerDigitos(void) {
-    unsigned char c, idx = 0;
+void JSON_Reinicia(void) {
+    jp.estado = JP_ESPERA_INICIO;
+}
+
+// Guarda el número acumulado como elemento jp.pos del array actual
+unsigned char JSON_GuardaElemento(void) {
+    if(jp.digitos == 0) return JSON_ERR_SINTAXIS;
+    if(jp.pos >= 8) return JSON_ERR_ARRAY;
     
-    do { c = UART_LeeBuffer(); } while(c == ' ' || c == ',');
+    if(jp.clave == CLAVE_CHARACTER) nivel.character[jp.pos] = (unsigned char)jp.numero;
+    else nivel.obstacle[jp.pos] = (unsigned char)jp.numero;
+    jp.pos++;
+    jp.numero = 0;
+    jp.digitos = 0;
+    return JSON_EN_CURSO;
+}
+
+// Tras un valor: otra clave o el cierre del objeto
+unsigned char JSON_TrasValor(unsigned char c) {
+    if(c == ' ' || c == '\t' || c == '\r' || c == '\n') return JSON_EN_CURSO;
+    if(c == ',') {
+        jp.estado = JP_ANTES_CLAVE;
+        return JSON_EN_CURSO;
+    }
+    if(c != '}') return JSON_ERR_SINTAXIS;
+    if((jp.vistos & CLAVES_OBLIGATORIAS) != CLAVES_OBLIGATORIAS) return JSON_ERR_FALTAN;
+    SET_FLAG(nivel.flags, 0x04);
+    return JSON_COMPLETO;
+}
+
+unsigned char JSON_Paso(unsigned char c) {
+    unsigned char es_espacio = (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+    unsigned char es_digito = (c >= '0' && c <= '9');
+    unsigned char r;
     
-    while(c >= '0' && c <= '9' && idx < 3) {
-        tempBuffer[idx++] = c;
-        c = UART_LeeBuffer();
+    switch(jp.estado) {
+        case JP_ESPERA_INICIO:
+            if(c == '{') {
+                jp.vistos = 0;
+                nivel.flags = 0;
+                nivel.seed = 0;
+                jp.estado = JP_ANTES_CLAVE;
+            }
+            return JSON_EN_CURSO;
+        
+        case JP_ANTES_CLAVE:
+            if(es_espacio) return JSON_EN_CURSO;
+            if(c != '"') return JSON_ERR_SINTAXIS;
+            jp.candidatos = 0x1F;
+            jp.pos = 0;
+            jp.estado = JP_CLAVE;
+            return JSON_EN_CURSO;
+        
+        case JP_CLAVE:
+            if(c == '"') {
+                jp.clave = JSON_Resolver(clavesConfig, 5);
+                if(jp.clave == 0xFF || CHK_FLAG(jp.vistos, 1 << jp.clave)) return JSON_ERR_CLAVE;
+                jp.estado = JP_DOS_PUNTOS;
+            } else if(!JSON_Filtrar(clavesConfig, 5, c)) {
+                return JSON_ERR_CLAVE;
+            }
+            return JSON_EN_CURSO;
+        
+        case JP_DOS_PUNTOS:
+            if(es_espacio) return JSON_EN_CURSO;
+            if(c != ':') return JSON_ERR_SINTAXIS;
+            jp.estado = JP_VALOR;
+            return JSON_EN_CURSO;
+        
+        case JP_VALOR:
+            if(es_espacio) return JSON_EN_CURSO;
+            jp.pos = 0;
+            jp.numero = 0;
+            jp.digitos = 0;
+            if(jp.clave <= CLAVE_OBSTACLE) {
+                if(c != '[') return JSON_ERR_SINTAXIS;
+                jp.estado = JP_ARRAY;
+            } else if(jp.clave == CLAVE_GOALTYPE) {
+                if(c != '"') return JSON_ERR_SINTAXIS;
+                jp.candidatos = 0x03;
+                jp.estado = JP_CADENA;
+            } else {
+                if(!es_digito) return JSON_ERR_SINTAXIS;
+                jp.numero = c - '0';
+                jp.estado = JP_NUMERO;
+            }
+            return JSON_EN_CURSO;
+        
+        case JP_ARRAY:
+            if(es_digito) {
+                // Un número por posición: "[1 2" es un error de sintaxis
+                if(jp.digitos && jp.separado) return JSON_ERR_SINTAXIS;
+                jp.numero = (jp.numero << 3) + (jp.numero << 1) + (c - '0');
+                if(jp.numero > 255) return JSON_ERR_VALOR;
+                jp.digitos++;
+                jp.separado = 0;
+                return JSON_EN_CURSO;
+            }
+            if(es_espacio) {
+                jp.separado = 1;
+                return JSON_EN_CURSO;
+            }
+            jp.separado = 0;
+            if(c == ',') return JSON_GuardaElemento();
+            if(c == ']') {
+                if(jp.digitos == 0 && jp.pos == 0) return JSON_ERR_ARRAY;
+                r = JSON_GuardaElemento();
+                if(r != JSON_EN_CURSO) return r;
+                if(jp.pos != 8) return JSON_ERR_ARRAY;
+                SET_FLAG(nivel.flags, jp.clave == CLAVE_CHARACTER ? 0x01 : 0x02);
+                SET_FLAG(jp.vistos, 1 << jp.clave);
+                jp.estado = JP_TRAS_VALOR;
+                return JSON_EN_CURSO;
+            }
+            return JSON_ERR_SINTAXIS;
+        
+        case JP_CADENA:
+            if(c == '"') {
+                c = JSON_Resolver(tiposMeta, 2);
+                if(c == 0xFF) return JSON_ERR_VALOR;
+                nivel.goalType = c;
+                SET_FLAG(jp.vistos, 1 << CLAVE_GOALTYPE);
+                jp.estado = JP_TRAS_VALOR;
+            } else if(!JSON_Filtrar(tiposMeta, 2, c)) {
+                return JSON_ERR_VALOR;
+            }
+            return JSON_EN_CURSO;
+        
+        case JP_NUMERO:
+            if(es_digito) {
+                // seed llega hasta 65535 sin desbordar jp.numero
+                if(jp.numero > 6553 || (jp.numero == 6553 && c > '5')) return JSON_ERR_VALOR;
+                jp.numero = (jp.numero << 3) + (jp.numero << 1) + (c - '0');
+                if(jp.clave == CLAVE_GOALVALUE && jp.numero >= 1000) return JSON_ERR_VALOR;
+                return JSON_EN_CURSO;
+            }
+            if(jp.clave == CLAVE_SEED) {
+                nivel.seed = jp.numero;
+            } else {
+                if(jp.numero == 0) return JSON_ERR_VALOR;
+                nivel.goalValue = jp.numero;
+            }
+            SET_FLAG(jp.vistos, 1 << jp.clave);
+            jp.estado = JP_TRAS_VALOR;
+            return JSON_TrasValor(c);
+        
+        case JP_TRAS_VALOR:
+            return JSON_TrasValor(c);
     }
-    return idx;
+    return JSON_ERR_SINTAXIS;
 }
 
-// ============ PARSEO JSON - OPTIMIZADO ============
-void JSON_Parse(void) {
-    unsigned char c, i, len;
+// Devuelve JSON_EN_CURSO mientras el objeto no está completo; con cualquier
+// otro resultado el parser queda listo para el siguiente '{'.
+unsigned char JSON_Byte(unsigned char c) {
+    unsigned char r = JSON_Paso(c);
     
-    nivel.flags = 0;
+    if(r != JSON_EN_CURSO) {
+        jp.estado = JP_ESPERA_INICIO;
+        // Un '{' a destiempo descarta el objeto parcial y empieza otro
+        if(r != JSON_COMPLETO && c == '{') JSON_Paso(c);
+    }
+    return r;
+}
+
+// ============ TRAMAS BINARIAS ============
+unsigned int CRC16(const unsigned char *datos, unsigned char n) {
+    unsigned int crc = 0xFFFF;
+    unsigned char i;
     
-    while(!buscaChar('{'));
-    while(UART_LeeBuffer() != '{');
+    while(n--) {
+        crc ^= (unsigned int)(*datos++) << 8;
+        for(i = 0; i < 8; i++) {
+            if(crc & 0x8000) crc = (crc << 1) ^ 0x1021;
+            else crc <<= 1;
+        }
+    }
+    return crc & 0xFFFF;    // unsigned int es de 32 bits en el host
+}
+
+// Decodifica COBS sobre el mismo buffer; devuelve la longitud o 0 si la
+// codificación no es válida
+unsigned char COBS_Decodifica(unsigned char *b, unsigned char n) {
+    unsigned char lee = 0, escribe = 0, codigo, i;
     
-    // CHARACTER
-    while(1) {
-        c = UART_LeeBuffer();
-        if(c == '"' && UART_LeeBuffer() == 'c') break;
+    while(lee < n) {
+        codigo = b[lee++];
+        if(codigo == 0 || codigo - 1 > n - lee) return 0;
+        for(i = 1; i < codigo; i++) b[escribe++] = b[lee++];
+        if(codigo != 0xFF && lee < n) b[escribe++] = 0;
     }
-    while(UART_LeeBuffer() != '[');
+    return escribe;
+}
+
+// Añade el CRC en datos[n..n+1] (el buffer debe tener sitio) y envía la
+// trama codificada en COBS. Solo para tramas cortas (< 254 bytes).
+void UART_EnviaTrama(unsigned char *datos, unsigned char n) {
+    unsigned int crc = CRC16(datos, n);
+    unsigned char inicio = 0, fin;
     
-    for(i = 0; i < 8; i++) {
-        len = leerDigitos();
-        nivel.character[i] = (unsigned char)strToUInt(len);
+    datos[n++] = crc >> 8;
+    datos[n++] = crc & 0xFF;
+    
+    UART_Escr(0x00);
+    while(inicio <= n) {
+        fin = inicio;
+        while(fin < n && datos[fin] != 0) fin++;
+        UART_Escr(fin - inicio + 1);
+        while(inicio < fin) UART_Escr(datos[inicio++]);
+        inicio++;
     }
-    SET_FLAG(nivel.flags, 0x01);
+    UART_Escr(0x00);
+}
+
+void enviarAckTrama(unsigned char seq, unsigned char codigo) {
+    unsigned char respuesta[5];
     
-    // OBSTACLE
-    while(1) {
-        c = UART_LeeBuffer();
-        if(c == '"' && UART_LeeBuffer() == 'o') break;
+    respuesta[0] = TRAMA_ACK;
+    respuesta[1] = seq;
+    respuesta[2] = codigo;
+    UART_EnviaTrama(respuesta, 3);
+}
+
+// Las respuestas reutilizan trama[]: tipo y secuencia quedan en [0] y [1]
+void procesar_trama(void) {
+    unsigned char n = COBS_Decodifica(trama, tramaLen), i;
+    
+    if(n < 4 || CRC16(trama, n - 2) != (((unsigned int)trama[n - 2] << 8) | trama[n - 1])) {
+        enviarAckTrama(0, JSON_ERR_CRC);
+        return;
+    }
+    n -= 2;
+    uartErroresTrama = 0;
+    
+    if(trama[0] == TRAMA_PING && n == 2) {
+        trama[0] = TRAMA_PONG;
+        trama[2] = PROTOCOLO_VERSION;
+        trama[3] = BAUDIOS_VALIDOS;
+        UART_EnviaTrama(trama, 4);
+        return;
     }
-    while(UART_LeeBuffer() != '[');
     
-    for(i = 0; i < 8; i++) {
-        len = leerDigitos();
-        nivel.obstacle[i] = (unsigned char)strToUInt(len);
+    // El ACK sale a la velocidad actual; luego se cambia y se espera el eco
+    if(trama[0] == TRAMA_BAUD && n == 3) {
+        i = trama[2];
+        trama[0] = TRAMA_BAUD_ACK;
+        if(i >= BAUDIOS_N || !(BAUDIOS_VALIDOS & (1 << i))) {
+            trama[2] = 0xFF;
+            UART_EnviaTrama(trama, 3);
+            return;
+        }
+        UART_EnviaTrama(trama, 3);
+        UART_Baudios(i);
+        if(i != 0) baud_plazo(BAUD_PLAZO_MS);
+        return;
     }
-    SET_FLAG(nivel.flags, 0x02);
     
-    // GOALTYPE
-    while(1) {
-        c = UART_LeeBuffer();
-        if(c == '"') {
-            c = UART_LeeBuffer();
-            if(c == 'g') {
-                c = UART_LeeBuffer();
-                if(c == 'o' && UART_LeeBuffer() == 'a') {
-                    break;
-                }
-            }
+    // Recibir el eco confirma la velocidad en este sentido; el backend
+    // comprueba el otro con la respuesta
+    if(trama[0] == TRAMA_ECO) {
+        baud_plazo(0);
+        trama[0] = TRAMA_ECO_RESP;
+        UART_EnviaTrama(trama, n);
+        return;
+    }
+    
+    // El divisor se sube si la trama no cabe en la mitad del tiempo entre
+    // envíos a la velocidad actual
+    if(trama[0] == TRAMA_STREAM && n == 3) {
+        i = stream_divisor_minimo();
+        streamDivisor = (trama[2] && trama[2] < i) ? i : trama[2];
+        streamCuenta = 0;
+        trama[0] = TRAMA_STREAM_ACK;
+        trama[2] = streamDivisor;
+        UART_EnviaTrama(trama, 3);
+        return;
+    }
+    
+    if(trama[0] == TRAMA_GRABACION && n == 3) {
+        enviar_grabacion(trama[2]);
+        return;
+    }
+    
+    if(trama[0] == TRAMA_REPETIR && n >= 6) {
+        cargar_repeticion(n);
+        return;
+    }
+    
+    if(trama[0] == TRAMA_SLOTS && n == 2) {
+        enviar_slots();
+        return;
+    }
+    
+#if PERFILADO
+    if(trama[0] == TRAMA_PERFIL && n == 3) {
+        enviar_perfil(trama[2]);
+        return;
+    }
+#endif
+    
+    // La ranura se lee sobre trama[2..]: queda como una TRAMA_CONFIG con semilla
+    if(trama[0] == TRAMA_JUGAR_SLOT && n == 3) {
+        if(IS_GAME_INIT()) enviarAckTrama(trama[1], JSON_ERR_OCUPADO);
+        else if(trama[2] >= SLOTS_N) enviarAckTrama(trama[1], JSON_ERR_VALOR);
+        else if(!cargar_slot(trama[2])) enviarAckTrama(trama[1], JSON_ERR_SLOT);
+        else {
+            configSlot = SLOT_NINGUNA;
+            nivel_desde_trama();
         }
+        return;
     }
-    while(UART_LeeBuffer() != ':');
-    while(UART_LeeBuffer() != '"');
     
-    c = UART_LeeBuffer();
-    if(c == 't') {
-        nivel.goalType = 0;
-        UART_LeeBuffer();
-        UART_LeeBuffer();
-        UART_LeeBuffer();
-    } else {
-        nivel.goalType = 1;
-        for(i = 0; i < 8; i++) UART_LeeBuffer();
+    if(trama[0] != TRAMA_CONFIG ||
+       (n != TRAMA_LEN_CONFIG && n != TRAMA_LEN_CONFIG + 2 && n != TRAMA_LEN_CONFIG_SLOT)) {
+        enviarAckTrama(trama[1], JSON_ERR_TRAMA);
+        return;
     }
     
-    // GOALVALUE
-    while(1) {
-        c = UART_LeeBuffer();
-        if(c == '"') {
-            c = UART_LeeBuffer();
-            if(c == 'g') {
-                c = UART_LeeBuffer();
-                if(c == 'o' && UART_LeeBuffer() == 'a') {
-                    while(UART_LeeBuffer() != ':');
-                    break;
-                }
-            }
+    // Igual que con JSON, durante una partida no se acepta configuración
+    if(IS_GAME_INIT()) {
+        enviarAckTrama(trama[1], JSON_ERR_OCUPADO);
+        return;
+    }
+    
+    // Sin semilla: el CRC recibido ocupa su sitio y se sustituye por 0
+    if(n == TRAMA_LEN_CONFIG) {
+        trama[TRAMA_LEN_CONFIG] = 0;
+        trama[TRAMA_LEN_CONFIG + 1] = 0;
+    }
+    
+    // La ranura se escribe en el loop principal, si la configuración valida
+    configSlot = SLOT_NINGUNA;
+    if(n == TRAMA_LEN_CONFIG_SLOT) {
+        if(trama[2 + SLOT_DATOS] >= SLOTS_N) {
+            enviarAckTrama(trama[1], JSON_ERR_VALOR);
+            return;
         }
+        configSlot = trama[2 + SLOT_DATOS];
+        configHash = CRC16(trama + 2, SLOT_DATOS);
     }
-    nivel.goalValue = strToUInt(leerDigitos());
-    SET_FLAG(nivel.flags, 0x04);
+    nivel_desde_trama();
+}
+
+// trama[2..22] con el formato de una ranura (seed incluida)
+void nivel_desde_trama(void) {
+    unsigned char i;
+    
+    for(i = 0; i < 8; i++) {
+        nivel.character[i] = trama[2 + i];
+        nivel.obstacle[i] = trama[10 + i];
+    }
+    nivel.goalType = trama[18];
+    nivel.goalValue = ((unsigned int)trama[19] << 8) | trama[20];
+    nivel.seed = ((unsigned int)trama[21] << 8) | trama[22];
+    nivel.flags = (nivel.goalType <= 1) ? 0x07 : 0x03;
+    
+    configSeq = trama[1];
+    configResultado = JSON_COMPLETO;
+    configBinaria = 1;
 }
 
 void enviarConfirmacion(void) {
@@ -430,6 +1574,12 @@ void enviarConfirmacion(void) {
     UART_Escr_String("\"}\r\n");
 }
 
+void enviarErrorConfig(unsigned char codigo) {
+    UART_Escr_String("{\"status\":\"error\",\"code\":");
+    UART_Escr('0' + codigo);
+    UART_Escr_String("}\r\n");
+}
+
 unsigned char validarConfiguracion(void) {
     return (nivel.flags == 0x07 && nivel.goalValue > 0 && nivel.goalValue < 1000);
 }
@@ -442,104 +1592,218 @@ void inicializarNivel(void) {
     }
     nivel.goalType = 1;
     nivel.goalValue = 10;
+    nivel.seed = 0;
     nivel.flags = 0;
 }
 
+// ============ RANURAS EN EEPROM ============
+unsigned char eeprom_leer(unsigned char dir) {
+    while(HAL_EEPROM_OCUPADA()) HAL_ESPERA();
+    return HAL_EEPROM_LEE(dir);
+}
+
+// Un byte igual no se reescribe: ni 4 ms de espera ni desgaste
+void eeprom_escribir(unsigned char dir, unsigned char dato) {
+    if(eeprom_leer(dir) == dato) return;
+    HAL_EEPROM_ESCRIBE(dir, dato);
+}
+
+// Solo se leen los hashes guardados; el CRC se comprueba al jugar la ranura
+void enviar_slots(void) {
+    unsigned char i, n = 3, dir = SLOT_DATOS;
+    
+    trama[0] = TRAMA_SLOTS_RESP;
+    trama[2] = SLOTS_N;
+    for(i = 0; i < SLOTS_N; i++) {
+        trama[n++] = eeprom_leer(dir);
+        trama[n++] = eeprom_leer(dir + 1);
+        dir += SLOT_BYTES;
+    }
+    UART_EnviaTrama(trama, n);
+}
+
+// Copia la ranura a trama[2..24] y comprueba su hash
+unsigned char cargar_slot(unsigned char slot) {
+    unsigned char i, dir = slot << SLOT_DESPLAZA;
+    
+    for(i = 0; i < SLOT_DATOS + 2; i++) trama[2 + i] = eeprom_leer(dir + i);
+    return CRC16(trama + 2, SLOT_DATOS) ==
+           (((unsigned int)trama[2 + SLOT_DATOS] << 8) | trama[3 + SLOT_DATOS]);
+}
+
+// Desde el loop principal antes de empezar la partida: hasta 23 escrituras
+// de 4 ms (menos de un tick), solo las de los bytes que cambian. El hash va
+// al final; si se corta antes, el CRC no cuadra y la ranura no se juega.
+void guardar_slot(void) {
+    unsigned char i, dir = configSlot << SLOT_DESPLAZA;
+    
+    for(i = 0; i < 8; i++) {
+        eeprom_escribir(dir + i, nivel.character[i]);
+        eeprom_escribir(dir + 8 + i, nivel.obstacle[i]);
+    }
+    eeprom_escribir(dir + 16, nivel.goalType);
+    eeprom_escribir(dir + 17, nivel.goalValue >> 8);
+    eeprom_escribir(dir + 18, nivel.goalValue & 0xFF);
+    eeprom_escribir(dir + 19, nivel.seed >> 8);
+    eeprom_escribir(dir + 20, nivel.seed & 0xFF);
+    eeprom_escribir(dir + SLOT_DATOS, configHash >> 8);
+    eeprom_escribir(dir + SLOT_DATOS + 1, configHash & 0xFF);
+}
+
+// ============ FORMATO NUMÉRICO SIN DIVISIONES ============
+void bcd_cero(ContadorBCD *c) {
+    unsigned char i;
+    
+    for(i = 0; i < BCD_DIGITOS; i++) c->d[i] = 0;
+}
+
+// Casi siempre toca un solo dígito; el acarreo recorre los 9 que haya
+void bcd_incrementar(ContadorBCD *c) {
+    unsigned char i = 0;
+    
+    while(i < BCD_DIGITOS && ++c->d[i] > 9) c->d[i++] = 0;
+}
+
+// Binario a BCD restando potencias de 10: como mucho 9 restas por dígito.
+// Solo para valores que no se llevan en BCD (goalValue), fuera del juego.
+void bcd_desde(ContadorBCD *c, unsigned int valor) {
+    static const unsigned int potencias[BCD_DIGITOS - 1] = { 10000, 1000, 100, 10 };
+    unsigned char i;
+    
+    for(i = 0; i < BCD_DIGITOS - 1; i++) {
+        c->d[BCD_DIGITOS - 1 - i] = 0;
+        while(valor >= potencias[i]) {
+            valor -= potencias[i];
+            c->d[BCD_DIGITOS - 1 - i]++;
+        }
+    }
+    c->d[0] = (unsigned char)valor;
+}
+
+// Hasta 5 dígitos sin ceros a la izquierda; texto ocupa BCD_DIGITOS + 1.
+// Devuelve la longitud.
+unsigned char bcd_texto(const ContadorBCD *c, char *texto) {
+    unsigned char i = BCD_DIGITOS - 1, n = 0;
+    
+    while(i > 0 && c->d[i] == 0) i--;
+    do {
+        texto[n++] = '0' + c->d[i];
+    } while(i-- > 0);
+    texto[n] = '\0';
+    return n;
+}
+
 // ============ TELEMETRÍA - OPTIMIZADA ============
 void inicializar_telemetria(void) {
     telemetria.obstaclesEsquivados = 0;
     telemetria.tiempoTranscurrido = 0;
-    telemetria.flags = 0x02;
-    segundosJuego = 0;
+    bcd_cero(&bcdEsquivados);
+    bcd_cero(&bcdSegundos);
+    ticksPartida = 0;
+    streamCuenta = 0;
+    streamEventos = 0;
     timerTicks = 0;
+    msMedioSegundo = 0;
+    // El bit 0x02 arranca el reloj en la ISR: va después de poner todo a 0
+    telemetria.flags = 0x02;
+}
+
+// La ISR avanza los segundos en binario y en BCD mientras dura la partida.
+// Copiarlos con las interrupciones activas puede mezclar el valor de antes
+// y el de después de un acarreo (255 -> 256, 09 -> 10), así que se copian
+// juntos con GIE a 0. copia puede ser 0 si basta el binario.
+unsigned int segundos_leer(ContadorBCD *copia) {
+    unsigned int segundos;
     
-    TMR1H = 0x0B;
-    TMR1L = 0xDC;
-    PIR1bits.TMR1IF = 0;
-    
-    T1CONbits.TMR1ON = 1;
+    HAL_INT_GLOBAL(0);
+    segundos = telemetria.tiempoTranscurrido;
+    if(copia) *copia = bcdSegundos;
+    HAL_INT_GLOBAL(1);
+    return segundos;
 }
 
-void enviar_telemetria(void) {
-    unsigned char buffer[4], idx, temp;
-    unsigned int val;
-    unsigned int tiempo_corregido;
+// Milisegundos de línea por trama: 10 bits por byte a Fosc / (16 * (SPBRG + 1))
+unsigned char stream_divisor_minimo(void) {
+    unsigned int ms = (unsigned int)(TELE_BYTES * 160UL * (spbrgBaudios[baudActual] + 1) /
+                                     (_XTAL_FREQ / 1000)) + 1;
+    return (unsigned char)((2 * ms + periodoTickMs - 1) / periodoTickMs);
+}
+
+void enviar_telemetria_vivo(unsigned char estado) {
+    unsigned int segundos;
     
-    UART_Escr_String("{\"obstacles\":");
+    if(!streamDivisor) return;
+    if(!(estado & TELE_FIN) && ++streamCuenta < streamDivisor) return;
+    streamCuenta = 0;
     
-    val = telemetria.obstaclesEsquivados;
-    idx = 0;
-    if(val == 0) {
-        buffer[idx++] = '0';
-    } else {
-        while(val > 0) {
-            buffer[idx++] = (val % 10) + '0';
-            val /= 10;
-        }
-        temp = 0;
-        while(temp < idx/2) {
-            unsigned char t = buffer[temp];
-            buffer[temp] = buffer[idx-1-temp];
-            buffer[idx-1-temp] = t;
-            temp++;
-        }
+    if(UART_TxLibre() < TELE_BYTES || tramaActiva) {
+#if ESTADISTICAS
+        if(streamOmitidas < 255) streamOmitidas++;
+#endif
+        return;
     }
-    for(temp = 0; temp < idx; temp++) UART_Escr(buffer[temp]);
     
-    UART_Escr_String(",\"time\":");
+    trama[0] = TRAMA_TELEMETRIA;
+    trama[1] = ticksPartida >> 8;
+    trama[2] = ticksPartida & 0xFF;
+    trama[3] = estado | streamEventos | Fila_Personaje;
+    trama[4] = telemetria.obstaclesEsquivados >> 8;
+    trama[5] = telemetria.obstaclesEsquivados & 0xFF;
+    segundos = segundos_leer(0);
+    trama[6] = segundos >> 8;
+    trama[7] = segundos & 0xFF;
+    streamEventos &= TELE_FILA_GENERADO;
+    UART_EnviaTrama(trama, TELE_LEN);
+}
+
+void enviar_telemetria(void) {
+    char texto[BCD_DIGITOS + 1];
+    ContadorBCD semilla;
     
-    tiempo_corregido = telemetria.tiempoTranscurrido;
+    enviar_telemetria_vivo(TELE_FIN | (CHK_FLAG(telemetria.flags, 0x01) ? TELE_VICTORIA : 0));
     
-    val = tiempo_corregido;
-    idx = 0;
-    if(val == 0) {
-        buffer[idx++] = '0';
-    } else {
-        while(val > 0) {
-            buffer[idx++] = (val % 10) + '0';
-            val /= 10;
-        }
-        temp = 0;
-        while(temp < idx/2) {
-            unsigned char t = buffer[temp];
-            buffer[temp] = buffer[idx-1-temp];
-            buffer[idx-1-temp] = t;
-            temp++;
-        }
-    }
-    for(temp = 0; temp < idx; temp++) UART_Escr(buffer[temp]);
+    UART_Escr_String("{\"obstacles\":");
+    bcd_texto(&bcdEsquivados, texto);
+    UART_Escr_String(texto);
+    
+    UART_Escr_String(",\"time\":");
+    bcd_texto(&bcdSegundos, texto);
+    UART_Escr_String(texto);
     
     UART_Escr_String(",\"result\":\"");
     UART_Escr_String(CHK_FLAG(telemetria.flags, 0x01) ? "win" : "lose");
-    UART_Escr_String("\"}\r\n");
+    UART_Escr_String("\",\"seed\":");
+    bcd_desde(&semilla, grabacionSemilla);
+    bcd_texto(&semilla, texto);
+    UART_Escr_String(texto);
+    UART_Escr_String("}\r\n");
     
-    T1CONbits.TMR1ON = 0;
     CLR_FLAG(telemetria.flags, 0x02);
 }
 
 // ============ PANTALLAS CON MÚSICA - OPTIMIZADAS ============
 void mostrar_victoria(void) {
     unsigned char i;
+    char texto[BCD_DIGITOS + 1];
     
-    // DETENER el Timer1 para que no siga contando durante la pantalla
-    T1CONbits.TMR1ON = 0;
+    // DETENER el conteo de tiempo durante la pantalla
+    CLR_FLAG(telemetria.flags, 0x02);
     
-    COMANDO(0x01);
-    __delay_ms(2);
+    LCD_Limpiar();
     
     LCD_Posicion(4, 0);
     LCD_Escr_String("YOU WIN!");
+    LCD_Celda(2, 0, sprite_usar(SPR_TROFEO));
+    LCD_Celda(13, 0, sprite_usar(SPR_TROFEO));
     
     LCD_Posicion(0, 1);
     LCD_Escr_String("Obst:");
-    if(telemetria.obstaclesEsquivados >= 10)
-        DIGITO('0' + (telemetria.obstaclesEsquivados / 10));
-    DIGITO('0' + (telemetria.obstaclesEsquivados % 10));
+    bcd_texto(&bcdEsquivados, texto);
+    LCD_Escr_String(texto);
     
     LCD_Escr_String(" T:");
-    if(telemetria.tiempoTranscurrido >= 10)
-        DIGITO('0' + (telemetria.tiempoTranscurrido / 10));
-    DIGITO('0' + (telemetria.tiempoTranscurrido % 10));
+    bcd_texto(&bcdSegundos, texto);
+    LCD_Escr_String(texto);
     DIGITO('s');
     
     // Parpadeo del LED durante la pantalla de victoria
@@ -548,7 +1812,7 @@ void mostrar_victoria(void) {
     }
     
     // Reproducir canción de victoria
-    victoria();
+    reproducir_cancion(cancionVictoria);
 
     
     for(i = 0; i < 3; i++) {
@@ -562,39 +1826,39 @@ void mostrar_victoria(void) {
 
 void mostrar_derrota(void) {
     unsigned char i;
+    char texto[BCD_DIGITOS + 1];
+    ContadorBCD meta;
     
-    // DETENER el Timer1 para que no siga contando durante la pantalla
-    T1CONbits.TMR1ON = 0;
+    // DETENER el conteo de tiempo durante la pantalla
+    CLR_FLAG(telemetria.flags, 0x02);
     
-    COMANDO(0x01);
-    __delay_ms(2);
+    LCD_Limpiar();
     
     LCD_Posicion(3, 0);
     LCD_Escr_String("GAME OVER");
+    LCD_Celda(1, 0, sprite_usar(SPR_CALAVERA));
+    LCD_Celda(13, 0, sprite_usar(SPR_CALAVERA));
     
     LCD_Posicion(0, 1);
     
     LCD_Escr_String("O:");
-    if(telemetria.obstaclesEsquivados >= 10)
-        DIGITO('0' + (telemetria.obstaclesEsquivados / 10));
-    DIGITO('0' + (telemetria.obstaclesEsquivados % 10));
+    bcd_texto(&bcdEsquivados, texto);
+    LCD_Escr_String(texto);
     
     LCD_Escr_String(" T:");
-    
-    if(telemetria.tiempoTranscurrido >= 10)
-        DIGITO('0' + (telemetria.tiempoTranscurrido / 10));
-    DIGITO('0' + (telemetria.tiempoTranscurrido % 10));
+    bcd_texto(&bcdSegundos, texto);
+    LCD_Escr_String(texto);
     DIGITO('s');
     
     if(nivel.goalType == 1) {
         LCD_Escr_String(" /");
-        if(nivel.goalValue >= 10)
-            DIGITO('0' + (nivel.goalValue / 10));
-        DIGITO('0' + (nivel.goalValue % 10));
+        bcd_desde(&meta, nivel.goalValue);
+        bcd_texto(&meta, texto);
+        LCD_Escr_String(texto);
     }
     
     // Reproducir canción de muerte
-    death();
+    reproducir_cancion(cancionMuerte);
     
     // Parpadeo del LED durante la pantalla de derrota
     for(i = 0; i < 5; i++) {
@@ -612,125 +1876,342 @@ void mostrar_derrota(void) {
 
 // ============ FUNCIONES DEL JUEGO - ULTRA OPTIMIZADAS ============
 void inicializar_juego(void) {
-    unsigned char fil, col;
-    unsigned char i;
-    
-    COMANDO(0x01);
-    __delay_ms(2);
+    LCD_Limpiar();
+    sprites_nueva_partida();
     
-    LCD_CargarSprites();
-    
-    for(fil = 0; fil < FILAS; fil++)
-        for(col = 0; col < 13; col++)
-            displayBuffer[fil][col] = ' ';
+    mundo[0] = 0;
+    mundo[1] = 0;
+    mundoTipo[0] = 0;
+    mundoTipo[1] = 0;
     
     Fila_Personaje = 1;
-    Ult_Fila_Personaje = 1;
     Cont_Obstaculo = 0;
-    puntuacion = 0;
-    
-    semilla += TMR0;
+    accionTick = ACCION_NINGUNA;
+    
+    // Una repetición armada impone su semilla. Si no, sin seed en la
+    // configuración vale el Timer0 mezclado con el estado que dejó la
+    // partida anterior, y esta partida se graba.
+    repeticionActiva = repeticionArmada;
+    repeticionArmada = 0;
+    if(repeticionActiva) {
+        repeticionPos = 0;
+        repeticionEspera = 0;
+    } else {
+        grabacionSemilla = nivel.seed ? nivel.seed : (azar ^ HAL_TMR0());
+        if(grabacionSemilla == 0) grabacionSemilla = 1;
+        grabacionLen = 0;
+        grabacionEspera = 0;
+        grabacionLlena = 0;
+    }
+    azar = grabacionSemilla;
     calcular_proxima_separacion();
     
-    displayBuffer[1][0] = PERSONAJE;
-    
     SET_FLAG(gameFlags, GAME_ACTIVE | GAME_INIT);
     
-    // Reproducir canción de inicio con parpadeo ANTES de iniciar telemetría
-    iniciar();
+    // La canción de inicio suena en segundo plano: no retrasa la telemetría
+    // ni el primer frame
+    reproducir_cancion(cancionInicio);
     
-    // AHORA SÍ inicializar telemetría y arrancar el timer
     inicializar_telemetria();
+    reiniciar_scheduler();
     
     // Actualizar pantalla después de la música
-    actualizar_pantalla_rapido();
-    actualizar_score_rapido();
+    renderizar_frame();
 }
 
+// Acción del tick: la de la repetición o la que atender_botones ya aplicó
+// desde el tick anterior (o aplica ahora con lo que haya en la cola).
 void leer_botones_rapido(void) {
-    if(SALTA && Fila_Personaje) {
-        displayBuffer[Ult_Fila_Personaje][0] = ' ';
-        Fila_Personaje = 0;
-        Ult_Fila_Personaje = 0;
-        displayBuffer[0][0] = PERSONAJE;
-        __delay_ms(15);
+    unsigned char accion;
+    
+    if(repeticionActiva) {
+        accion = repeticion_accion();
+        if(accion == ACCION_SALTA) Fila_Personaje = 0;
+        else if(accion == ACCION_AGACHA) Fila_Personaje = 1;
+        return;
     }
-    else if(AGACHA && !Fila_Personaje) {
-        displayBuffer[0][0] = ' ';
-        Fila_Personaje = 1;
-        Ult_Fila_Personaje = 1;
-        displayBuffer[1][0] = PERSONAJE;
-        __delay_ms(15);
+    
+    atender_botones();
+    grabar_accion(accionTick);
+    accionTick = ACCION_NINGUNA;
+}
+
+// Solo desde la ISR de Timer2
+void botones_muestrear(void) {
+    unsigned char i, delta, pulsados, pos;
+    
+    // Una muestra igual al estado filtrado pone el contador a 0; cuatro
+    // distintas seguidas lo hacen dar la vuelta y el botón cambia
+    delta = ((SALTA ? 1 : 0) | (AGACHA ? 2 : 0)) ^ botonEstable;
+    botonVc1 = (botonVc1 ^ botonVc0) & delta;
+    botonVc0 = ~botonVc0 & delta;
+    delta &= ~(botonVc0 | botonVc1);
+    botonEstable ^= delta;
+    pulsados = delta & botonEstable;
+    
+    for(i = BOTON_SALTA; pulsados; i++, pulsados >>= 1) {
+        if(!(pulsados & 1)) continue;
+        if((unsigned char)(botonColaEscr - botonColaLee) < BOTON_COLA) {
+            pos = botonColaEscr & BOTON_COLA_MASK;
+            if(i == BOTON_AGACHA) botonCola |= 1 << pos;
+            else botonCola &= ~(1 << pos);
+#if ESTADISTICAS
+            botonColaMs[pos] = msLibre;
+#endif
+            botonColaEscr++;
+        }
+#if ESTADISTICAS
+        else if(botonPerdidos < 255) botonPerdidos++;
+#endif
     }
 }
 
-void generar_obstaculo(void) {
-    unsigned char fila_aleatoria;
+// Consume la cola. Fuera de partida o en una repetición los eventos se
+// descartan; en partida, una pulsación que mueve al personaje se aplica y
+// se pinta en el momento. Con una acción ya pendiente para el tick el resto
+// espera en la cola al siguiente.
+void atender_botones(void) {
+    unsigned char ev, pos;
+#if ESTADISTICAS
+    unsigned char latencia;
+#endif
     
-    if(displayBuffer[0][12] == ' ' && displayBuffer[1][12] == ' ') {
+    while(botonColaLee != botonColaEscr) {
+        if(accionTick != ACCION_NINGUNA && IS_GAME_ACTIVE() && !repeticionActiva) return;
         
-        fila_aleatoria = random_number(100);
+        pos = botonColaLee & BOTON_COLA_MASK;
+        ev = (botonCola >> pos) & 1 ? BOTON_AGACHA : BOTON_SALTA;
+#if ESTADISTICAS
+        latencia = (unsigned char)(msLibre - botonColaMs[pos]) + BOTON_FILTRO - 1;
+#endif
+        botonColaLee++;
         
-        if(fila_aleatoria < 50) {
-            displayBuffer[0][12] = OBSTACULO;
-        } else {
-            displayBuffer[1][12] = OBSTACULO;
+        if(!IS_GAME_ACTIVE() || repeticionActiva) continue;
+        
+        if(ev == BOTON_SALTA && Fila_Personaje) {
+            accionTick = ACCION_SALTA;
+            Fila_Personaje = 0;
+        } else if(ev == BOTON_AGACHA && !Fila_Personaje) {
+            accionTick = ACCION_AGACHA;
+            Fila_Personaje = 1;
+        } else continue;
+        
+        pintar_personaje();
+#if ESTADISTICAS
+        if(latencia > latenciaMaxMs) latenciaMaxMs = latencia;
+        latenciaSumaMs += latencia;
+        latenciaEventos++;
+#endif
+    }
+}
+
+// ============ GRABACIÓN DE ENTRADAS ============
+void grabar_accion(unsigned char accion) {
+    unsigned char b;
+    
+    if(grabacionLlena) return;
+    if(accion == ACCION_NINGUNA) {
+        if(++grabacionEspera < GRAB_ESPERA) return;
+        b = GRAB_ESPERA;
+    } else {
+        b = (accion == ACCION_SALTA ? GRAB_SALTA : 0) | grabacionEspera;
+    }
+    grabacionEspera = 0;
+    
+    // Sin sitio la grabación se corta aquí: la repetición diverge desde
+    // este tick y el volcado lo marca con GRAB_TRUNCADA
+    if(grabacionLen < GRABACION_MAX) grabacion[grabacionLen++] = b;
+    else grabacionLlena = 1;
+}
+
+// Acción de este tick según grabacion[]; agotada, ninguna
+unsigned char repeticion_accion(void) {
+    unsigned char b;
+    
+    while(repeticionPos < grabacionLen) {
+        b = grabacion[repeticionPos];
+        if(repeticionEspera < (b & GRAB_ESPERA)) {
+            repeticionEspera++;
+            return ACCION_NINGUNA;
         }
+        repeticionEspera = 0;
+        repeticionPos++;
+        if((b & GRAB_ESPERA) != GRAB_ESPERA) return (b & GRAB_SALTA) ? ACCION_SALTA : ACCION_AGACHA;
+        // Tras 127 ticks de relleno este tick es ya del byte siguiente
+    }
+    return ACCION_NINGUNA;
+}
+
+// Un trozo desde "desde"; el backend pide trozos hasta cubrir la longitud.
+// Reutiliza trama[]: tipo y secuencia quedan en [0] y [1].
+void enviar_grabacion(unsigned char desde) {
+    unsigned char i = 7;
+    
+    trama[0] = TRAMA_GRABACION_RESP;
+    trama[2] = (grabacionLlena ? GRAB_TRUNCADA : 0) |
+               ((IS_GAME_INIT() && !repeticionActiva) ? GRAB_EN_CURSO : 0);
+    trama[3] = grabacionLen;
+    trama[4] = grabacionSemilla >> 8;
+    trama[5] = grabacionSemilla & 0xFF;
+    trama[6] = desde;
+    while(i < 7 + GRAB_TROZO && desde < grabacionLen) trama[i++] = grabacion[desde++];
+    UART_EnviaTrama(trama, i);
+}
+
+// trama: tipo, seq, total, semilla(2), desde, entradas... El trozo que
+// llega al total arma la repetición para la próxima partida.
+void cargar_repeticion(unsigned char n) {
+    unsigned char total = trama[2], desde = trama[5], i;
+    
+    trama[0] = TRAMA_REPETIR_ACK;
+    if(IS_GAME_INIT()) {
+        trama[2] = JSON_ERR_OCUPADO;
+    } else if(total > GRABACION_MAX || n - 6 > total - desde || desde > total) {
+        trama[2] = JSON_ERR_VALOR;
+    } else {
+        grabacionLen = total;
+        grabacionLlena = 0;
+        grabacionSemilla = ((unsigned int)trama[3] << 8) | trama[4];
+        if(grabacionSemilla == 0) grabacionSemilla = 1;
+        for(i = 6; i < n; i++) grabacion[desde++] = trama[i];
+        repeticionArmada = (desde == total);
+        trama[2] = repeticionArmada ? JSON_COMPLETO : JSON_EN_CURSO;
+    }
+    UART_EnviaTrama(trama, 3);
+}
+
+void generar_obstaculo(void) {
+    unsigned int r;
+    unsigned char fila;
+    
+    if(!((mundo[0] | mundo[1]) & MUNDO_BIT(COL_GENERACION))) {
+        
+        // Fila al 50 %: basta un bit. Del mismo número salen dos bits más
+        // para la variante (25 %), así la secuencia de obstáculos no cambia.
+        r = azar_siguiente();
+        fila = (r & 0x8000) ? 1 : 0;
+        mundo[fila] |= MUNDO_BIT(COL_GENERACION);
+        if((r & 0x6000) == 0x6000) mundoTipo[fila] |= MUNDO_BIT(COL_GENERACION);
+        streamEventos = fila ? TELE_GENERADO | TELE_FILA_GENERADO : TELE_GENERADO;
         
         calcular_proxima_separacion();
     }
 }
 
 void desplazar_mundo_rapido(void) {
-    unsigned char fil, col;
-    for(fil = 0; fil < FILAS; fil++) {
-        for(col = 0; col < 12; col++)
-            displayBuffer[fil][col] = displayBuffer[fil][col + 1];
-        displayBuffer[fil][12] = ' ';
-    }
+    // La columna 0 sale por la derecha del shift y la 12 entra vacía
+    mundo[0] >>= 1;
+    mundo[1] >>= 1;
+    mundoTipo[0] >>= 1;
+    mundoTipo[1] >>= 1;
+}
+
+unsigned char glifo_mundo(unsigned char col, unsigned char fila) {
+    if(col == 0 && fila == Fila_Personaje) return codPersonaje;
+    if(!((mundo[fila] >> col) & 1)) return ' ';
+    if(!((mundoTipo[fila] >> col) & 1)) return codObstaculo;
+    return fila ? codRoca : codPajaro;
 }
 
 void actualizar_pantalla_rapido(void) {
-    unsigned char fil, col;
+    unsigned char fil, col, variante;
+    unsigned int fila_bits, tipo_bits;
+    
     for(fil = 0; fil < FILAS; fil++) {
-        LCD_Posicion(0, fil);
-        for(col = 0; col < 13; col++)
-            DIGITO(displayBuffer[fil][col]);
+        fila_bits = mundo[fil];
+        tipo_bits = mundoTipo[fil];
+        variante = fil ? codRoca : codPajaro;
+        for(col = 0; col < MUNDO_COLUMNAS; col++) {
+            if(col == 0 && fil == Fila_Personaje)
+                LCD_Celda(0, fil, codPersonaje);
+            else
+                LCD_Celda(col, fil, !(fila_bits & 1) ? ' ' :
+                                    (tipo_bits & 1) ? variante : codObstaculo);
+            fila_bits >>= 1;
+            tipo_bits >>= 1;
+        }
     }
 }
 
-void actualizar_score_rapido(void) {
-    if(nivel.goalType == 1) {
-        LCD_Posicion(SCORE_COL, 0);
-        DIGITO('0' + (puntuacion / 10));
-        DIGITO('0' + (puntuacion % 10));
-        
-        LCD_Posicion(SCORE_COL, 1);
-        DIGITO(' ');
-        DIGITO(' ');
-    } 
+// Las dos columnas del score en las dos filas: celdas[0..1] arriba y
+// celdas[2..3] abajo. Hasta 99 solo se usa la fila de arriba; desde 100
+// arriba van millares y centenas y abajo decenas y unidades. Más de 9999
+// se satura.
+void calcular_score(unsigned char *celdas) {
+    ContadorBCD segundos;
+    const ContadorBCD *c = &bcdEsquivados;
+    
+    if(nivel.goalType != 1) {
+        segundos_leer(&segundos);
+        c = &segundos;
+    }
+    
+    if(c->d[4]) {
+        celdas[0] = celdas[1] = celdas[2] = celdas[3] = '9';
+    }
+    else if(c->d[3] | c->d[2]) {
+        celdas[0] = c->d[3] ? '0' + c->d[3] : ' ';
+        celdas[1] = '0' + c->d[2];
+        celdas[2] = '0' + c->d[1];
+        celdas[3] = '0' + c->d[0];
+    }
     else {
-        LCD_Posicion(SCORE_COL, 0);
-        if(telemetria.tiempoTranscurrido >= 10)
-            DIGITO('0' + (telemetria.tiempoTranscurrido / 10));
-        else
-            DIGITO(' ');
-        DIGITO('0' + (telemetria.tiempoTranscurrido % 10));
-        
-        LCD_Posicion(SCORE_COL, 1);
-        DIGITO(' ');
-        DIGITO(' ');
+        // En modo obstáculos las decenas se ven aunque sean 0
+        celdas[0] = (c->d[1] || nivel.goalType == 1) ? '0' + c->d[1] : ' ';
+        celdas[1] = '0' + c->d[0];
+        celdas[2] = celdas[3] = ' ';
     }
 }
 
-unsigned char random_number(unsigned char max) {
-    semilla += TMR0;
-    semilla ^= (segundosJuego << 3);
-    semilla += timerTicks;
+void actualizar_score_rapido(void) {
+    unsigned char celdas[4];
+    
+    calcular_score(celdas);
+    LCD_Celda(BARRA_COL, 0, codBarra[0]);
+    LCD_Celda(BARRA_COL, 1, codBarra[1]);
+    LCD_Celda(SCORE_COL, 0, celdas[0]);
+    LCD_Celda(SCORE_COL + 1, 0, celdas[1]);
+    
+    LCD_Celda(SCORE_COL, 1, celdas[2]);
+    LCD_Celda(SCORE_COL + 1, 1, celdas[3]);
+}
+
+
+// Columna 0 de las dos filas tras mover al personaje entre ticks
+void pintar_personaje(void) {
+    unsigned char fil;
     
-    semilla = (semilla * 73 + 47) & 0xFF;
+    for(fil = 0; fil < FILAS; fil++)
+        LCD_Celda(0, fil, glifo_mundo(0, fil));
+}
+
+// Primer frame de la partida. tick_juego repite estos pasos con las marcas
+// de perfilado entre medias: aquí no se mide, la marca no es de este tick.
+void renderizar_frame(void) {
+    sprites_frame();
+    actualizar_pantalla_rapido();
+    actualizar_score_rapido();
+}
+
+unsigned int azar_siguiente(void) {
+    // Las máscaras no cuestan nada en XC8: unsigned int es de 32 bits en el host
+    azar = (azar ^ (azar << 7)) & 0xFFFF;
+    azar ^= azar >> 9;
+    azar = (azar ^ (azar << 8)) & 0xFFFF;
+    return azar;
+}
+
+// Entero en [0, max) sin dividir: el byte alto se enmascara a la potencia
+// de 2 que cubre max y se descarta lo que se pase (menos de 2 intentos de
+// media). max > 0.
+unsigned char random_number(unsigned char max) {
+    unsigned char mascara = 0, r;
     
-    return semilla % max;
+    while(mascara < (unsigned char)(max - 1)) mascara = (mascara << 1) | 1;
+    do {
+        r = (unsigned char)(azar_siguiente() >> 8) & mascara;
+    } while(r >= max);
+    return r;
 }
 
 void calcular_proxima_separacion(void) {
@@ -739,7 +2220,7 @@ void calcular_proxima_separacion(void) {
 }
 
 unsigned char detectar_colision(void) {
-    return (displayBuffer[Fila_Personaje][0] == OBSTACULO);
+    return (unsigned char)(mundo[Fila_Personaje] & 1);
 }
 
 void evaluar_metas(void) {
@@ -750,22 +2231,20 @@ void evaluar_metas(void) {
             mostrar_victoria();
             enviar_telemetria();
             CLR_GAME_INIT();
-            COMANDO(0x01);
-            __delay_ms(2);
+            LCD_Limpiar();
             LCD_Posicion(0, 0);
             LCD_Escr_String("Esperando");
             LCD_Posicion(0, 1);
             LCD_Escr_String("config...");
         }
     } else {
-        if(telemetria.tiempoTranscurrido >= nivel.goalValue) {
+        if(segundos_leer(0) >= nivel.goalValue) {
             CLR_GAME_ACTIVE();
             SET_FLAG(telemetria.flags, 0x01);
             mostrar_victoria();
             enviar_telemetria();
             CLR_GAME_INIT();
-            COMANDO(0x01);
-            __delay_ms(2);
+            LCD_Limpiar();
             LCD_Posicion(0, 0);
             LCD_Escr_String("Esperando");
             LCD_Posicion(0, 1);
@@ -774,401 +2253,182 @@ void evaluar_metas(void) {
     }
 }
 
-// ============ FUNCIONES DE MÚSICA ============
-void PARPADEO(void) {
-    LED = 1;
-    __delay_ms(500);
-    LED = 0;
-    __delay_ms(500);
-}
+// Un tick de juego: entrada, generación, scroll, colisión, metas y render.
+// Lo invoca el loop principal una vez por marca de Timer2.
+void tick_juego(void) {
+    unsigned char obstaculo_en_col1 = 
+        ((mundo[0] | mundo[1]) & MUNDO_BIT(1)) != 0;
 
-void iniciar(void)
-{
-       MI_OCT_5();
-            MI_OCT_5();
-            __delay_ms(100);
-            MI_OCT_5();
-            MI_OCT_5();
-            __delay_ms(200);
-            MI_OCT_5();
-            MI_OCT_5();
-            __delay_ms(200);
-            DO_OCT_5();
-            DO_OCT_5();
-            __delay_ms(100);
-            MI_OCT_5();
-            MI_OCT_5();
-            __delay_ms(200);
-            SOL_OCT_5();
-            SOL_OCT_5();
-            SOL_OCT_5();
-            SOL_OCT_5();
-            __delay_ms(400);
-            SOL_OCT_4();
-            SOL_OCT_4();
-            SOL_OCT_4();
-            SOL_OCT_4();
-            SOL_OCT_4();
-            SOL_OCT_4();
-            __delay_ms(100);
-}
-
-void death(void)
-{
-    SOL_OCT_3();
-            SOL_OCT_4();
-            SI_OCT_4();
-            __delay_ms(100);
-            RE_OCT_5();
-            FA_OCT_5();
-            __delay_ms(200);
-            SOL_OCT_3();
-            RE_OCT_5();
-            FA_OCT_5();
-            __delay_ms(100);
-            SOL_OCT_3();
-            RE_OCT_5();
-            FA_OCT_5();
-            __delay_ms(100);
-            LA_OCT_3();
-            DO_OCT_5();
-            MI_OCT_5();
-            __delay_ms(100);
-            SI_OCT_3();
-            SI_OCT_4();
-            RE_OCT_5();
-            __delay_ms(100);
-            DO_OCT_4();
-            SOL_OCT_4();
-            DO_OCT_5();
-            __delay_ms(100);
-            MI_OCT_4();
-            __delay_ms(100);
-            SOL_OCT_3();
-            __delay_ms(100);
-            MI_OCT_4();
-            __delay_ms(100);
-            DO_OCT_3();
-            DO_OCT_4();
-}
-
-void victoria(void)
-{
-    __delay_ms(1000);
-            FA_OCT_3();
-            __delay_ms(0.1);
-            LA_OCT_4();
-            __delay_ms(0.1);
-            DO_OCT_5();
-            __delay_ms(100);
-            SI_OCT_4();
-            RE_OCT_5();
-            __delay_ms(100);
-            DO_OCT_5();
-            MI_OCT_5();
-            __delay_ms(100);
-            FA_OCT_3();
-            __delay_ms(0.1);
-            RE_OCT_5();
-            __delay_ms(0.1);
-            FA_OCT_5();
-            FA_OCT_5();
-            FA_OCT_5();
-            FA_OCT_5();
-            FA_OCT_5();
-            FA_OCT_5();
-            FA_OCT_5();
-            __delay_ms(100);
-            FA_OCT_3();
-            __delay_ms(0.1);
-            MI_OCT_5();
-            __delay_ms(0.1);
-            SOL_OCT_5();
-            __delay_ms(100);
-            SOL_OCT_3();
-            __delay_ms(0.1);
-            FA_OCT_5();
-            __delay_ms(0.1);
-            LA_OCT_5();
-            __delay_ms(100);
-            SOL_OCT_3();
-            __delay_ms(0.1);
-            SOL_OCT_5();
-            __delay_ms(0.1);
-            SI_OCT_5();
-            __delay_ms(100);
-            DO_OCT_3();
-            __delay_ms(0.1);
-            LA_OCT_5();
-            __delay_ms(0.1);
-            DO_OCT_6();
-            __delay_ms(400);
-            DO_OCT_3();
-            __delay_ms(0.1);
-            MI_OCT_4();
-            __delay_ms(0.1);
-            DO_OCT_5();
-            __delay_ms(100);
-}
-
-// ============ NOTAS MUSICALES ============
-void MI_OCT_5(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(379.21);
-        BOCINA = 0;
-        __delay_us(379.21);
-    }
-}
+    HAL_INICIO_FRAME();
+    PERF_INICIO();
+#if ESTADISTICAS
+    lcdEscrituras = 0;
+    cgramFilasFrame = 0;
+#endif
+    ticksPartida++;
 
-void DO_OCT_5(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(477.78);
-        BOCINA = 0;
-        __delay_us(477.78);
-    }
-}
-
-void SOL_OCT_5(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(318.88);
-        BOCINA = 0;
-        __delay_us(318.88);
-    }
-}
-
-void SOL_OCT_4(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(637.76);
-        BOCINA = 0;
-        __delay_us(637.76);
-    }
-}
-
-void LA_OCT_4(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(568.18);
-        BOCINA = 0;
-        __delay_us(568.18);
-    }
-}
-
-void FA_OCT_5(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(357.93);
-        BOCINA = 0;
-        __delay_us(357.93);
-    }
-}
-
-void FA_OCT_2(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(2863.45);
-        BOCINA = 0;
-        __delay_us(2863.45);
-    }
-}
-
-void SOL_OCT_2(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(2551.05);
-        BOCINA = 0;
-        __delay_us(2551.05);
-    }
-}
-
-void LA_OCT_2(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(2272.72);
-        BOCINA = 0;
-        __delay_us(2272.72);
-    }
-}
-
-void LAS_OCT_2(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(2145.16);
-        BOCINA = 0;
-        __delay_us(2145.16);
-    }
-}
-
-void DO_OCT_3(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(1911.12);
-        BOCINA = 0;
-        __delay_us(1911.12);
-    }
-}
-
-void RE_OCT_3(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(1702.62);
-        BOCINA = 0;
-        __delay_us(1702.62);
-    }
-}
-
-void MI_OCT_3(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(1516.86);
-        BOCINA = 0;
-        __delay_us(1516.86);
-    }
-}
-
-void FA_OCT_3(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(1431.72);
-        BOCINA = 0;
-        __delay_us(1431.72);
-    }
-}
+    leer_botones_rapido();
 
-void SOL_OCT_3(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(1275.52);
-        BOCINA = 0;
-        __delay_us(1275.52);
+    Cont_Obstaculo++;
+    if(Cont_Obstaculo >= proxima_generacion) {
+        Cont_Obstaculo = 0;
+        generar_obstaculo();
     }
-}
 
-void SI_OCT_3(void)
-{
-    for(int i = 0; i < 32; i++)
-    {
-        BOCINA = 1;
-        __delay_us(1012.38);
-        BOCINA = 0;
-        __delay_us(1012.38);
-    }
-}
+    desplazar_mundo_rapido();
 
-void SI_OCT_4(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(506.19);
-        BOCINA = 0;
-        __delay_us(506.19);
-    }
-}
-
-void RE_OCT_5(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(425.65);
-        BOCINA = 0;
-        __delay_us(425.65);
-    }
-}
-
-void LA_OCT_3(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(1136.36);
-        BOCINA = 0;
-        __delay_us(1136.36);
+    if(obstaculo_en_col1) {
+        if(detectar_colision()) {
+            CLR_GAME_ACTIVE();
+            CLR_FLAG(telemetria.flags, 0x01);
+            mostrar_derrota();
+            enviar_telemetria();
+            CLR_GAME_INIT();
+            LCD_Limpiar();
+            LCD_Posicion(0, 0);
+            LCD_Escr_String("Esperando");
+            LCD_Posicion(0, 1);
+            LCD_Escr_String("config...");
+            return;
+        }
+        else {
+            telemetria.obstaclesEsquivados++;
+            bcd_incrementar(&bcdEsquivados);
+        }
     }
-}
 
-void DO_OCT_4(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(955.56);
-        BOCINA = 0;
-        __delay_us(955.56);
+    evaluar_metas();
+
+    // Fin de partida por colisión o por meta: sus pantallas no se miden
+    if(IS_GAME_ACTIVE()) {
+        PERF_FASE(PERF_LOGICA);
+        sprites_frame();
+        actualizar_pantalla_rapido();
+        PERF_FASE(PERF_RENDER);
+        actualizar_score_rapido();
+        PERF_FASE(PERF_SCORE);
+        enviar_telemetria_vivo(0);
+#if ESTADISTICAS
+        lcdEscriturasFrame = lcdEscrituras;
+        if(lcdEscriturasFrame > lcdEscriturasMax)
+            lcdEscriturasMax = lcdEscriturasFrame;
+        if(cgramFilasFrame > cgramFilasMax) cgramFilasMax = cgramFilasFrame;
+#endif
+#if PERFILADO || ESTADISTICAS
+        // Margen del tick: ms consumidos frente a periodoTickMs
+        if(msTick > tickUsoMaxMs) tickUsoMaxMs = msTick;
+#endif
+        HAL_FIN_FRAME();
     }
 }
 
-void MI_OCT_4(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(758.43);
-        BOCINA = 0;
-        __delay_us(758.43);
+#if PERFILADO
+// ============ PERFILADO ============
+// Cierra la fase f: lo transcurrido desde la marca anterior
+void perf_fase(unsigned char f) {
+    unsigned int ahora, d;
+    PerfFase *p = &perf[f];
+    
+    HAL_T1_LEE(ahora);
+    d = (ahora - perfMarca) & 0xFFFF;
+    perfMarca = ahora;
+    if(d > p->max) p->max = d;
+    while(p->n == 0xFF || p->suma > (unsigned int)(0xFFFF - d)) {
+        p->n >>= 1;
+        p->suma >>= 1;
     }
+    p->suma += d;
+    p->n++;
 }
 
-void LA_OCT_5(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(284.09);
-        BOCINA = 0;
-        __delay_us(284.09);
+void perf_reiniciar(void) {
+    unsigned char f;
+    
+    for(f = 0; f < PERF_FASES; f++) {
+        perf[f].max = 0;
+        perf[f].n = 0;
+        perf[f].suma = 0;
     }
-}
-
-void SI_OCT_5(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(253.09);
-        BOCINA = 0;
-        __delay_us(253.09);
+    rxOcupacionMax = 0;
+}
+
+// PERF_POR_TRAMA fases desde la pedida, más los contadores del scheduler.
+// Reutiliza trama[]: tipo y secuencia quedan en [0] y [1].
+void enviar_perfil(unsigned char fase) {
+    unsigned char i = 7, f, hasta;
+    PerfFase *p;
+    
+    f = fase & ~PERF_REINICIA;
+    if(f > PERF_FASES) f = PERF_FASES;
+    hasta = (f + PERF_POR_TRAMA < PERF_FASES) ? f + PERF_POR_TRAMA : PERF_FASES;
+    
+    trama[0] = TRAMA_PERFIL_RESP;
+    trama[2] = f;
+    trama[3] = PERF_FASES;
+    trama[4] = tickOverruns;
+    trama[5] = rxOcupacionMax;
+    trama[6] = tickUsoMaxMs;
+    for(; f < hasta; f++) {
+        p = &perf[f];
+        trama[i++] = p->max >> 8;
+        trama[i++] = p->max & 0xFF;
+        trama[i++] = p->n;
+        trama[i++] = (p->suma >> 8) & 0xFF;
+        trama[i++] = p->suma & 0xFF;
     }
+    UART_EnviaTrama(trama, i);
+    
+    if(fase & PERF_REINICIA) perf_reiniciar();
 }
+#endif
 
-void DO_OCT_6(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(238.89);
-        BOCINA = 0;
-        __delay_us(238.89);
-    }
+// ============ FUNCIONES DE MÚSICA ============
+void PARPADEO(void) {
+    LED = 1;
+    __delay_ms(500);
+    LED = 0;
+    __delay_ms(500);
 }
 
-void RE_OCT_6(void) {
-    for(int i = 0; i < 32; i++) {
-        BOCINA = 1;
-        __delay_us(212.48);
-        BOCINA = 0;
-        __delay_us(212.48);
-    }
+// Arranca una canción en segundo plano (sustituye a la que esté sonando).
+// El primer evento lo procesa la ISR de Timer2 en el siguiente ms.
+void reproducir_cancion(const unsigned char *cancion) {
+    HAL_INT_GLOBAL(0);
+    HAL_CCP1_MODO(0);
+    BOCINA = 0;
+    cancionPtr = cancion;
+    togglesRestantes = 0;
+    silencioMs = 1;
+    cancionSonando = 1;
+    HAL_INT_GLOBAL(1);
 }
 
 // ============ FUNCIÓN PRINCIPAL - OPTIMIZADA ============
 void main(void) {
+    unsigned char resultado;
+    
     // Configuración rápida
-    TRISB = 0x00;
-    TRISC = 0x00;
-    TRISD = 0x03;
-    TRISA = 0x00;  // RA0 como salida para LED
-    TRISEbits.TRISE2 = 0;  // RE2 como salida para BOCINA
-    PORTB = PORTC = PORTD = PORTA = PORTE = 0x00;
+    HAL_PUERTOS_INIT();  // RA0 salida para LED, RE2 salida para BOCINA
     
-    OPTION_REGbits.T0CS = 1;
-    OPTION_REGbits.PSA = 0;
-    OPTION_REGbits.PS = 0b111;
+    HAL_TMR0_INIT();
     
-    ADCON1 = 0x07;
-    CMCON = 0x07;
+    HAL_ANALOGICOS_OFF();
     
     UART_Init();
-    LCD_Init();
     Timer1_Init();
+    Timer2_Init();
+    LCD_Init();
     inicializarNivel();
+#if PERFILADO
+    perf_reiniciar();
+#endif
     
-    semilla = TMR0;
+    azar += HAL_TMR0();
     gameFlags = 0;
     
-    INTCONbits.PEIE = 1;
-    INTCONbits.GIE = 1;
+    HAL_INT_HABILITA();
     
-    COMANDO(0x01);
-    __delay_ms(2);
+    LCD_Limpiar();
     
     LCD_Posicion(0, 0);
     LCD_Escr_String("Esperando");
@@ -1176,65 +2436,29 @@ void main(void) {
     LCD_Escr_String("config...");
     
     while(1) {
-        // Esperar configuración
-        if(buscaChar('}') && !IS_GAME_INIT()) {
-            __delay_ms(50);
-            JSON_Parse();
+        esperar_tick();
+        
+        // Configuración recibida por el parser incremental
+        if(configResultado != JSON_EN_CURSO) {
+            resultado = configResultado;
+            configResultado = JSON_EN_CURSO;
             
-            if(validarConfiguracion()) {
-                LCD_CargarSprites();
-                enviarConfirmacion();
+            if(resultado == JSON_COMPLETO && !validarConfiguracion()) resultado = JSON_ERR_VALOR;
+            
+            if(configBinaria) enviarAckTrama(configSeq, resultado);
+            else if(resultado != JSON_COMPLETO) enviarErrorConfig(resultado);
+            
+            if(resultado == JSON_COMPLETO) {
+                if(!configBinaria) enviarConfirmacion();
+                else if(configSlot != SLOT_NINGUNA) guardar_slot();
                 inicializar_juego();
-                UART_LimpiaBuffer();
             }
+            configSlot = SLOT_NINGUNA;
         }
         
-        // Loop del juego optimizado
-        if(IS_GAME_INIT() && IS_GAME_ACTIVE()) {
-            unsigned char obstaculo_en_col1 = 
-                (displayBuffer[0][1] == OBSTACULO || displayBuffer[1][1] == OBSTACULO);
-
-            leer_botones_rapido();
-
-            Cont_Obstaculo++;
-            if(Cont_Obstaculo >= proxima_generacion) {
-                Cont_Obstaculo = 0;
-                generar_obstaculo();
-            }
-
-            desplazar_mundo_rapido();
-
-            if(obstaculo_en_col1) {
-                if(displayBuffer[Fila_Personaje][0] == OBSTACULO) {
-                    CLR_GAME_ACTIVE();
-                    CLR_FLAG(telemetria.flags, 0x01);
-                    mostrar_derrota();
-                    enviar_telemetria();
-                    CLR_GAME_INIT();
-                    COMANDO(0x01);
-                    __delay_ms(2);
-                    LCD_Posicion(0, 0);
-                    LCD_Escr_String("Esperando");
-                    LCD_Posicion(0, 1);
-                    LCD_Escr_String("config...");
-                    continue;
-                }
-                else {
-                    puntuacion++;
-                    telemetria.obstaclesEsquivados++;
-                }
-            }
-
-            evaluar_metas();
-
-            if(IS_GAME_ACTIVE()) {
-                displayBuffer[Fila_Personaje][0] = PERSONAJE;
-                actualizar_pantalla_rapido();
-                actualizar_score_rapido();
-                __delay_ms(100);
-            }
+        // Loop del juego optimizado (el primer frame espera al siguiente tick)
+        else if(IS_GAME_INIT() && IS_GAME_ACTIVE()) {
+            tick_juego();
         }
-        
-        __delay_ms(5);
     }
 }
\ No newline at end of file
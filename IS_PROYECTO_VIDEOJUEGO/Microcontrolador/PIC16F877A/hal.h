@@ -0,0 +1,162 @@
+// ============ CAPA DE ABSTRACCIÓN DE HARDWARE (HAL) ============
+// Videojuego.c solo toca el hardware a través de estas macros.
+// En el PIC cada macro se expande al mismo acceso a registro que antes,
+// por lo que el tamaño del firmware y los tiempos no cambian.
+// Con -DHOST_BUILD las macros apuntan al simulador de Microcontrolador/host.
+#ifndef HAL_H
+#define HAL_H
+
+#ifndef HOST_BUILD
+
+#include <xc.h>
+
+// ============ PINES ============
+#define SALTA PORTDbits.RD0
+#define AGACHA PORTDbits.RD1
+#define BOCINA PORTEbits.RE2
+#define LED PORTAbits.RA0
+
+// ============ PUERTOS ============
+#define HAL_PUERTOS_INIT() do { \
+    TRISB = 0x00; \
+    TRISC = 0x00; \
+    TRISD = 0x03; \
+    TRISA = 0x00; \
+    TRISEbits.TRISE2 = 0; \
+    PORTB = PORTC = PORTD = PORTA = PORTE = 0x00; \
+} while(0)
+
+#define HAL_ANALOGICOS_OFF() do { ADCON1 = 0x07; CMCON = 0x07; } while(0)
+
+#define HAL_INT_HABILITA() do { INTCONbits.PEIE = 1; INTCONbits.GIE = 1; } while(0)
+#define HAL_INT_GLOBAL(v) (INTCONbits.GIE = (v))
+
+// ============ LCD HD44780 (bus de 8 bits en PORTB, RS/RW/E en RC0..RC2) ============
+#define HAL_LCD_PINES() do { \
+    TRISB = 0x00; \
+    TRISCbits.TRISC0 = 0; \
+    TRISCbits.TRISC1 = 0; \
+    TRISCbits.TRISC2 = 0; \
+} while(0)
+
+#define HAL_LCD_BUS(v) (PORTB = (v))
+#define HAL_LCD_BUS_ENTRADA() (TRISB = 0xFF)
+#define HAL_LCD_BUS_SALIDA() (TRISB = 0x00)
+#define HAL_LCD_BUS_LEE() (PORTB)
+#define HAL_LCD_RS(v) (PORTCbits.RC0 = (v))
+#define HAL_LCD_RW(v) (PORTCbits.RC1 = (v))
+#define HAL_LCD_E(v) (PORTCbits.RC2 = (v))
+
+// ============ UART ============
+#define HAL_UART_INIT(spbrg) do { \
+    TRISCbits.TRISC6 = 0; \
+    TRISCbits.TRISC7 = 1; \
+    SPBRG = (spbrg); \
+    TXSTAbits.BRGH = 1; \
+    TXSTAbits.SYNC = 0; \
+    TXSTAbits.TXEN = 1; \
+    RCSTAbits.SPEN = 1; \
+    RCSTAbits.CREN = 1; \
+    PIE1bits.RCIE = 1; \
+} while(0)
+
+#define HAL_UART_BAUD(spbrg) (SPBRG = (spbrg))
+#define HAL_UART_TX_LISTO() (TXSTAbits.TRMT)
+#define HAL_UART_TX(d) (TXREG = (d))
+#define HAL_UART_TX_IE(v) (PIE1bits.TXIE = (v))
+#define HAL_UART_TX_IE_ACTIVA() (PIE1bits.TXIE)
+#define HAL_UART_TX_IF() (PIR1bits.TXIF)
+#define HAL_UART_RX_PENDIENTE() (PIR1bits.RCIF)
+#define HAL_UART_RX_OVERRUN() (RCSTAbits.OERR)
+#define HAL_UART_RX_ERROR_TRAMA() (RCSTAbits.FERR)
+#define HAL_UART_RX_REINICIA() do { RCSTAbits.CREN = 0; RCSTAbits.CREN = 1; } while(0)
+#define HAL_UART_RX() (RCREG)
+
+// ============ TIMER1 (Fosc/4, prescaler 1:1, base de tiempo de CCP1) ============
+#define HAL_T1_INIT() do { \
+    T1CONbits.TMR1ON = 0; \
+    T1CONbits.TMR1CS = 0; \
+    T1CONbits.T1CKPS0 = 0; \
+    T1CONbits.T1CKPS1 = 0; \
+} while(0)
+
+#define HAL_T1_CARGA(h, l) do { TMR1H = (h); TMR1L = (l); } while(0)
+// Lectura de 16 bits con Timer1 en marcha: si TMR1L desborda entre los dos
+// accesos, TMR1H cambia y se repite. Es una sentencia: deja la cuenta en v.
+#define HAL_T1_LEE(v) do { \
+    unsigned char t1h_; \
+    do { \
+        t1h_ = TMR1H; \
+        (v) = ((unsigned int)t1h_ << 8) | TMR1L; \
+    } while(t1h_ != TMR1H); \
+} while(0)
+#define HAL_T1_ON(v) (T1CONbits.TMR1ON = (v))
+#define HAL_T1_IE(v) (PIE1bits.TMR1IE = (v))
+#define HAL_T1_IF() (PIR1bits.TMR1IF)
+#define HAL_T1_IF_CLR() (PIR1bits.TMR1IF = 0)
+
+// ============ CCP1 (comparación contra Timer1, audio) ============
+#define HAL_CCP1_MODO(m) (CCP1CON = (m))
+#define HAL_CCP1_COMPARA(v) (CCPR1 = (v))
+#define HAL_CCP1_IE(v) (PIE1bits.CCP1IE = (v))
+#define HAL_CCP1_IF() (PIR1bits.CCP1IF)
+#define HAL_CCP1_IF_CLR() (PIR1bits.CCP1IF = 0)
+
+// ============ TIMER2 (tick del sistema) ============
+#define HAL_T2_INIT(pr2, t2con) do { \
+    TMR2 = 0; \
+    PR2 = (pr2); \
+    T2CON = (t2con); \
+    PIR1bits.TMR2IF = 0; \
+    PIE1bits.TMR2IE = 1; \
+} while(0)
+
+#define HAL_T2_IF() (PIR1bits.TMR2IF)
+#define HAL_T2_IF_CLR() (PIR1bits.TMR2IF = 0)
+
+// ============ TIMER0 (reloj externo en RA4, prescaler 1:256) ============
+#define HAL_TMR0_INIT() do { \
+    OPTION_REGbits.T0CS = 1; \
+    OPTION_REGbits.PSA = 0; \
+    OPTION_REGbits.PS = 0b111; \
+} while(0)
+
+#define HAL_TMR0() (TMR0)
+
+// ============ EEPROM DE DATOS (256 bytes) ============
+// La escritura dura unos 4 ms y corre sola tras la secuencia 0x55/0xAA,
+// que no admite interrupciones en medio. Leer o escribir con WR a 1 no
+// está permitido: antes se espera a HAL_EEPROM_OCUPADA() == 0.
+#define HAL_EEPROM_OCUPADA() (EECON1bits.WR)
+
+#define HAL_EEPROM_LEE(dir) (EEADR = (dir), EECON1bits.EEPGD = 0, EECON1bits.RD = 1, EEDATA)
+
+#define HAL_EEPROM_ESCRIBE(dir, v) do { \
+    EEADR = (dir); \
+    EEDATA = (v); \
+    EECON1bits.EEPGD = 0; \
+    EECON1bits.WREN = 1; \
+    INTCONbits.GIE = 0; \
+    EECON2 = 0x55; \
+    EECON2 = 0xAA; \
+    EECON1bits.WR = 1; \
+    INTCONbits.GIE = 1; \
+    EECON1bits.WREN = 0; \
+} while(0)
+
+// ============ GANCHOS DEL SIMULADOR (vacíos en el PIC) ============
+#define HAL_ESPERA()
+#define HAL_INICIO_FRAME()
+#define HAL_FIN_FRAME()
+
+#else
+
+#include "hal_host.h"
+
+// El simulador invoca ISR() y videojuego_main() directamente.
+#define __interrupt()
+#define main videojuego_main
+
+#endif
+
+#endif
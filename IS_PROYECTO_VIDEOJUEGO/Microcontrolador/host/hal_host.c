@@ -0,0 +1,570 @@
+// ============ SIMULADOR DEL PIC16F877A PARA LINUX ============
+// Modelo mínimo de los periféricos que usa Videojuego.c:
+//  - HD44780 con DDRAM de 2x40, CGRAM y desplazamiento de display.
+//  - UART con tiempos de byte derivados de SPBRG (BRGH = 1).
+//  - Timer1 libre a Fosc/4 = 1 MHz y CCP1 en modo comparación.
+//  - Timer2 periódico (PR2, prescaler y postscaler de T2CON).
+//  - EEPROM de datos de 256 bytes con 4 ms por escritura.
+// El reloj solo avanza en los retardos y en los bucles de espera.
+#include <setjmp.h>
+#include <string.h>
+#include "hal_host.h"
+
+#define FOSC_HZ 4000000ULL
+#define NS_POR_CICLO (1000000000ULL * 4 / FOSC_HZ)
+#define T1_PRESCALER 1
+
+#define LCD_DDRAM_FILA 0x40
+#define LCD_DDRAM_COLUMNAS 40
+#define LCD_T_COMANDO_NS 37000ULL
+#define LCD_T_CLEAR_NS 1520000ULL
+
+#define RX_COLA 4096
+
+#define EEPROM_BYTES 256
+#define EEPROM_T_ESCRITURA_NS 4000000ULL
+
+#define BOTON_REBOTE_NS 2000000ULL
+
+SimEstadisticas sim_stats;
+
+volatile unsigned char hal_salta = 0;
+volatile unsigned char hal_agacha = 0;
+volatile unsigned char hal_bocina = 0;
+volatile unsigned char hal_led = 0;
+
+static unsigned char boton_nivel[2] = { 0, 0 };
+static uint64_t boton_cambio_ns[2] = { 0, 0 };
+static uint32_t rebote_azar = 0x2545F491;
+
+unsigned char hal_int_habilitadas = 0;
+
+unsigned char hal_lcd_bus = 0;
+unsigned char hal_lcd_rs = 0;
+unsigned char hal_lcd_rw = 0;
+
+unsigned char hal_t1_ie = 0;
+unsigned char hal_t1_if = 0;
+unsigned char hal_ccp1_ie = 0;
+unsigned char hal_ccp1_if = 0;
+unsigned char hal_uart_txie = 0;
+unsigned char hal_t2_if = 0;
+
+// ============ ESTADO INTERNO ============
+static jmp_buf salida;
+static SimFrameCb frame_cb;
+static SimTxCb tx_cb;
+static uint64_t limite_ns;
+static unsigned char en_isr = 0;
+static unsigned char en_frame = 0;
+static uint64_t frame_espera_ns = 0;
+
+static uint64_t alarma_ns;
+static SimAlarmaCb alarma_cb;
+
+// LCD
+static unsigned char lcd_e = 0;
+static unsigned char lcd_ddram[2][LCD_DDRAM_COLUMNAS];
+static unsigned char lcd_cgram[64];
+static unsigned char lcd_ac = 0;
+static unsigned char lcd_en_cgram = 0;
+static unsigned char lcd_incrementa = 1;
+static unsigned char lcd_desplaza = 0;
+static unsigned char lcd_offset = 0;
+static uint64_t lcd_libre_ns = 0;
+
+// UART
+static uint64_t uart_byte_ns = 1040000ULL;
+static uint32_t uart_baud_pic = 9615;
+static uint32_t uart_baud_remoto = 0;  // 0 = el otro extremo sigue al PIC
+static uint64_t uart_tx_fin = 0;     // Fin del último byte escrito (TXREG + TSR)
+static unsigned char uart_rcie = 0;
+static unsigned char rx_datos[RX_COLA];
+static uint64_t rx_llegada[RX_COLA];
+static unsigned int rx_cabeza = 0;
+static unsigned int rx_cola = 0;
+
+// Timer1
+static unsigned char t1_activo = 0;
+static uint32_t t1_base_cuenta = 0;
+static uint64_t t1_base_ns = 0;
+static uint64_t t1_desborde_ns = 0;
+
+// CCP1
+static unsigned char ccp1_modo = 0;
+static uint16_t ccpr1 = 0;
+static uint64_t ccp1_ns = 0;
+
+// Timer2
+static unsigned char t2_activo = 0;
+static uint64_t t2_periodo_ns = 0;
+static uint64_t t2_proximo_ns = 0;
+
+// EEPROM
+static unsigned char eeprom[EEPROM_BYTES];
+static unsigned char eeprom_iniciada = 0;
+static uint64_t eeprom_libre_ns = 0;
+
+// ============ RELOJ E INTERRUPCIONES ============
+static void t1_recalcular(void) {
+    t1_desborde_ns = t1_base_ns +
+        (uint64_t)(65536UL - t1_base_cuenta) * T1_PRESCALER * NS_POR_CICLO;
+}
+
+// Instante de la próxima coincidencia TMR1 == CCPR1 posterior al reloj
+static void ccp1_recalcular(void) {
+    uint64_t periodo = T1_PRESCALER * NS_POR_CICLO;
+    uint64_t vuelta = 65536ULL * periodo;
+
+    ccp1_ns = t1_base_ns + (uint64_t)((ccpr1 - t1_base_cuenta) & 0xFFFF) * periodo;
+    if(ccp1_ns <= sim_stats.reloj_ns)
+        ccp1_ns += ((sim_stats.reloj_ns - ccp1_ns) / vuelta + 1) * vuelta;
+}
+
+static unsigned char ccp1_activo(void) {
+    return t1_activo && (ccp1_modo & 0x08);
+}
+
+static unsigned char rx_llego(void) {
+    return rx_cabeza != rx_cola && rx_llegada[rx_cabeza] <= sim_stats.reloj_ns;
+}
+
+static void despachar_interrupciones(void) {
+    unsigned char vueltas = 0;
+
+    if(!hal_int_habilitadas || en_isr) return;
+
+    while(vueltas++ < 8 &&
+          ((hal_t1_if && hal_t1_ie) || (hal_ccp1_if && hal_ccp1_ie) || hal_t2_if || (rx_llego() && uart_rcie) ||
+           (hal_uart_txie && hal_uart_txif()))) {
+        en_isr = 1;
+        ISR();
+        en_isr = 0;
+    }
+}
+
+static uint64_t proximo_evento(uint64_t objetivo) {
+    uint64_t evento = objetivo;
+
+    if(t1_activo && t1_desborde_ns < evento) evento = t1_desborde_ns;
+    if(ccp1_activo() && ccp1_ns < evento) evento = ccp1_ns;
+    if(hal_uart_txie && !hal_uart_txif() && uart_tx_fin - uart_byte_ns < evento)
+        evento = uart_tx_fin - uart_byte_ns;
+    if(t2_activo && t2_proximo_ns < evento) evento = t2_proximo_ns;
+    if(rx_cabeza != rx_cola && rx_llegada[rx_cabeza] > sim_stats.reloj_ns &&
+       rx_llegada[rx_cabeza] < evento)
+        evento = rx_llegada[rx_cabeza];
+    if(alarma_cb && alarma_ns < evento) evento = alarma_ns;
+    if(limite_ns && limite_ns < evento) evento = limite_ns;
+    return evento;
+}
+
+static void avanzar_hasta(uint64_t objetivo) {
+    do {
+        uint64_t evento = proximo_evento(objetivo);
+
+        if(evento > sim_stats.reloj_ns) sim_stats.reloj_ns = evento;
+
+        if(t1_activo && sim_stats.reloj_ns >= t1_desborde_ns) {
+            hal_t1_if = 1;
+            sim_stats.t1_desbordes++;
+            t1_base_cuenta = 0;
+            t1_base_ns = t1_desborde_ns;
+            t1_recalcular();
+        }
+
+        if(ccp1_activo() && sim_stats.reloj_ns >= ccp1_ns) {
+            hal_ccp1_if = 1;
+            sim_stats.ccp1_comparaciones++;
+            ccp1_recalcular();
+        }
+
+        if(t2_activo && sim_stats.reloj_ns >= t2_proximo_ns) {
+            hal_t2_if = 1;
+            sim_stats.t2_periodos++;
+            t2_proximo_ns += t2_periodo_ns;
+        }
+
+        if(alarma_cb && sim_stats.reloj_ns >= alarma_ns) {
+            SimAlarmaCb cb = alarma_cb;
+            alarma_cb = 0;
+            cb();
+        }
+
+        despachar_interrupciones();
+
+        if(limite_ns && sim_stats.reloj_ns >= limite_ns) sim_detener();
+    } while(sim_stats.reloj_ns < objetivo);
+}
+
+void hal_delay_us(double us) {
+    if(us <= 0) return;
+    // Retardo activo del programa principal dentro de un tick de juego
+    if(en_frame && !en_isr) frame_espera_ns += (uint64_t)(us * 1000.0 + 0.5);
+    avanzar_hasta(sim_stats.reloj_ns + (uint64_t)(us * 1000.0 + 0.5));
+}
+
+void hal_espera(void) {
+    // Bucle de sondeo: saltar directamente al siguiente evento (máx. 1 ms)
+    avanzar_hasta(proximo_evento(sim_stats.reloj_ns + 1000000ULL));
+}
+
+void hal_inicio_frame(void) {
+    en_frame = 1;
+    frame_espera_ns = 0;
+    if(frame_cb && !frame_cb()) sim_detener();
+}
+
+void hal_fin_frame(void) {
+    // Los ticks que acaban en una pantalla final no llegan aquí y no cuentan
+    en_frame = 0;
+    sim_stats.frames++;
+    sim_stats.espera_frame_ns += frame_espera_ns;
+}
+
+// ============ BOTONES ============
+// El cambio de nivel se detecta en la primera lectura después (la ISR lee
+// cada ms); hasta BOTON_REBOTE_NS más tarde el pin devuelve bits al azar.
+unsigned char hal_boton(unsigned char n) {
+    unsigned char v = n ? hal_agacha : hal_salta;
+
+    if(v != boton_nivel[n]) {
+        boton_nivel[n] = v;
+        boton_cambio_ns[n] = sim_stats.reloj_ns;
+    }
+    if(sim_stats.reloj_ns - boton_cambio_ns[n] < BOTON_REBOTE_NS) {
+        rebote_azar ^= rebote_azar << 13;
+        rebote_azar ^= rebote_azar >> 17;
+        rebote_azar ^= rebote_azar << 5;
+        return rebote_azar & 1;
+    }
+    return v;
+}
+
+// ============ LCD HD44780 ============
+static void lcd_avanzar_ac(void) {
+    if(lcd_en_cgram) {
+        lcd_ac = (lcd_ac + (lcd_incrementa ? 1 : -1)) & 0x3F;
+        return;
+    }
+    if(lcd_incrementa) {
+        lcd_ac++;
+        if(lcd_ac == LCD_DDRAM_COLUMNAS) lcd_ac = LCD_DDRAM_FILA;
+        else if(lcd_ac == LCD_DDRAM_FILA + LCD_DDRAM_COLUMNAS) lcd_ac = 0;
+    } else {
+        if(lcd_ac == 0) lcd_ac = LCD_DDRAM_FILA + LCD_DDRAM_COLUMNAS - 1;
+        else if(lcd_ac == LCD_DDRAM_FILA) lcd_ac = LCD_DDRAM_COLUMNAS - 1;
+        else lcd_ac--;
+    }
+}
+
+static void lcd_desplazar_display(unsigned char derecha) {
+    lcd_offset = derecha ? (lcd_offset + LCD_DDRAM_COLUMNAS - 1) % LCD_DDRAM_COLUMNAS
+                         : (lcd_offset + 1) % LCD_DDRAM_COLUMNAS;
+}
+
+static uint64_t lcd_comando(unsigned char v) {
+    if(v & 0x80) {
+        lcd_en_cgram = 0;
+        lcd_ac = v & 0x7F;
+    } else if(v & 0x40) {
+        lcd_en_cgram = 1;
+        lcd_ac = v & 0x3F;
+    } else if(v & 0x20) {
+        // Function set: el modelo solo admite 8 bits y 2 líneas
+    } else if(v & 0x10) {
+        if(v & 0x08) {
+            lcd_desplazar_display(v & 0x04);
+        } else {
+            unsigned char incrementa = lcd_incrementa;
+            lcd_incrementa = (v & 0x04) != 0;
+            lcd_avanzar_ac();
+            lcd_incrementa = incrementa;
+        }
+    } else if(v & 0x08) {
+        // Display on/off: no altera la memoria
+    } else if(v & 0x04) {
+        lcd_incrementa = (v & 0x02) != 0;
+        lcd_desplaza = (v & 0x01) != 0;
+    } else if(v & 0x02) {
+        lcd_en_cgram = 0;
+        lcd_ac = 0;
+        lcd_offset = 0;
+        return LCD_T_CLEAR_NS;
+    } else if(v & 0x01) {
+        memset(lcd_ddram, ' ', sizeof(lcd_ddram));
+        lcd_en_cgram = 0;
+        lcd_ac = 0;
+        lcd_offset = 0;
+        lcd_incrementa = 1;
+        return LCD_T_CLEAR_NS;
+    }
+    return LCD_T_COMANDO_NS;
+}
+
+static void lcd_dato(unsigned char v) {
+    if(lcd_en_cgram) {
+        lcd_cgram[lcd_ac & 0x3F] = v;
+    } else {
+        unsigned char fila = (lcd_ac >= LCD_DDRAM_FILA);
+        unsigned char col = lcd_ac - (fila ? LCD_DDRAM_FILA : 0);
+        if(col < LCD_DDRAM_COLUMNAS) lcd_ddram[fila][col] = v;
+    }
+    lcd_avanzar_ac();
+    if(lcd_desplaza && !lcd_en_cgram) lcd_desplazar_display(!lcd_incrementa);
+}
+
+void hal_lcd_e(unsigned char v) {
+    // El HD44780 captura el bus en el flanco de bajada de E
+    if(lcd_e && !v && !hal_lcd_rw) {
+        uint64_t ocupado;
+
+        if(sim_stats.reloj_ns < lcd_libre_ns) sim_stats.lcd_violaciones++;
+
+        if(hal_lcd_rs) {
+            sim_stats.lcd_datos++;
+            lcd_dato(hal_lcd_bus);
+            ocupado = LCD_T_COMANDO_NS;
+        } else {
+            sim_stats.lcd_comandos++;
+            ocupado = lcd_comando(hal_lcd_bus);
+        }
+        lcd_libre_ns = sim_stats.reloj_ns + ocupado;
+    }
+    lcd_e = v;
+}
+
+// Lectura con RS=0, RW=1: busy flag en DB7 y contador de direcciones
+unsigned char hal_lcd_lee(void) {
+    return (sim_stats.reloj_ns < lcd_libre_ns ? 0x80 : 0x00) | (lcd_ac & 0x7F);
+}
+
+unsigned char sim_lcd_celda(unsigned char col, unsigned char fila) {
+    return lcd_ddram[fila & 1][(col + lcd_offset) % LCD_DDRAM_COLUMNAS];
+}
+
+char sim_lcd_glifos[8] = { '0', '1', '2', '3', '4', '5', '6', '7' };
+
+void sim_lcd_volcar(FILE *archivo) {
+    unsigned char fila, col, c;
+
+    fputs("+----------------+\n", archivo);
+    for(fila = 0; fila < SIM_LCD_FILAS; fila++) {
+        fputc('|', archivo);
+        for(col = 0; col < SIM_LCD_COLUMNAS; col++) {
+            c = sim_lcd_celda(col, fila);
+            fputc(c < 8 ? sim_lcd_glifos[c] : (c >= 0x20 && c < 0x7F ? c : '?'), archivo);
+        }
+        fputs("|\n", archivo);
+    }
+    fputs("+----------------+\n", archivo);
+}
+
+// ============ UART ============
+void hal_uart_init(unsigned char spbrg) {
+    hal_uart_baud(spbrg);
+    uart_rcie = 1;
+}
+
+void hal_uart_baud(unsigned char spbrg) {
+    // BRGH = 1: baud = Fosc / (16 * (SPBRG + 1)), 10 bits por byte
+    uart_byte_ns = 10ULL * 16 * (spbrg + 1) * 1000000000ULL / FOSC_HZ;
+    uart_baud_pic = FOSC_HZ / (16UL * (spbrg + 1));
+}
+
+// Con más de un 3 % de diferencia entre los dos extremos el bit de stop
+// cae fuera de sitio: el receptor marca FERR y el byte llega corrupto
+static unsigned char uart_desajuste(void) {
+    uint32_t diferencia;
+
+    if(uart_baud_remoto == 0) return 0;
+    diferencia = uart_baud_pic > uart_baud_remoto ? uart_baud_pic - uart_baud_remoto
+                                                  : uart_baud_remoto - uart_baud_pic;
+    return diferencia * 100 > uart_baud_remoto * 3;
+}
+
+unsigned char hal_uart_tx_listo(void) {
+    if(sim_stats.reloj_ns < uart_tx_fin) avanzar_hasta(uart_tx_fin);
+    return 1;
+}
+
+// TXREG libre: como mucho queda un byte en el registro de desplazamiento
+unsigned char hal_uart_txif(void) {
+    return sim_stats.reloj_ns + uart_byte_ns >= uart_tx_fin;
+}
+
+void hal_uart_tx(unsigned char d) {
+    uint64_t inicio = uart_tx_fin > sim_stats.reloj_ns ? uart_tx_fin : sim_stats.reloj_ns;
+
+    uart_tx_fin = inicio + uart_byte_ns;
+    sim_stats.uart_tx_bytes++;
+    if(tx_cb) tx_cb(uart_desajuste() ? d ^ 0xA5 : d);
+}
+
+unsigned char hal_uart_rx_pendiente(void) {
+    return rx_llego();
+}
+
+unsigned char hal_uart_rx(void) {
+    unsigned char d;
+
+    if(rx_cabeza == rx_cola) return 0;
+    d = rx_datos[rx_cabeza];
+    rx_cabeza = (rx_cabeza + 1) % RX_COLA;
+    sim_stats.uart_rx_bytes++;
+    if(uart_desajuste()) {
+        sim_stats.uart_errores_trama++;
+        return d ^ 0xA5;
+    }
+    return d;
+}
+
+unsigned char hal_uart_rx_ferr(void) {
+    return rx_llego() && uart_desajuste();
+}
+
+void sim_uart_inyectar(const unsigned char *datos, unsigned int len) {
+    uint64_t t = sim_stats.reloj_ns;
+    unsigned int ultimo = (rx_cola + RX_COLA - 1) % RX_COLA;
+
+    if(rx_cabeza != rx_cola && rx_llegada[ultimo] > t) t = rx_llegada[ultimo];
+
+    while(len--) {
+        unsigned int siguiente = (rx_cola + 1) % RX_COLA;
+        if(siguiente == rx_cabeza) return;
+        t += uart_baud_remoto ? 10000000000ULL / uart_baud_remoto : uart_byte_ns;
+        rx_datos[rx_cola] = *datos++;
+        rx_llegada[rx_cola] = t;
+        rx_cola = siguiente;
+    }
+}
+
+void sim_uart_baudios(uint32_t baudios) {
+    uart_baud_remoto = baudios;
+}
+
+unsigned int sim_uart_rx_pendientes(void) {
+    return (rx_cola + RX_COLA - rx_cabeza) % RX_COLA;
+}
+
+// ============ TIMER1 ============
+void hal_t1_carga(unsigned char h, unsigned char l) {
+    t1_base_cuenta = ((uint32_t)h << 8) | l;
+    t1_base_ns = sim_stats.reloj_ns;
+    t1_recalcular();
+    ccp1_recalcular();
+}
+
+void hal_t1_on(unsigned char v) {
+    if(v && !t1_activo) {
+        t1_base_ns = sim_stats.reloj_ns;
+        t1_recalcular();
+    } else if(!v && t1_activo) {
+        t1_base_cuenta += (uint32_t)((sim_stats.reloj_ns - t1_base_ns) /
+                                     (T1_PRESCALER * NS_POR_CICLO));
+        t1_base_cuenta &= 0xFFFF;
+    }
+    t1_activo = v;
+    ccp1_recalcular();
+}
+
+unsigned int hal_t1_lee(void) {
+    if(!t1_activo) return t1_base_cuenta;
+    return (t1_base_cuenta + (uint32_t)((sim_stats.reloj_ns - t1_base_ns) /
+                                        (T1_PRESCALER * NS_POR_CICLO))) & 0xFFFF;
+}
+
+// ============ CCP1 ============
+void hal_ccp1_modo(unsigned char m) {
+    ccp1_modo = m;
+    ccp1_recalcular();
+}
+
+void hal_ccp1_compara(unsigned int v) {
+    ccpr1 = (uint16_t)v;
+    ccp1_recalcular();
+}
+
+// ============ TIMER2 ============
+void hal_t2_init(unsigned char pr2, unsigned char t2con) {
+    static const unsigned char prescaler[4] = { 1, 4, 16, 16 };
+    unsigned int postscaler = ((t2con >> 3) & 0x0F) + 1;
+
+    t2_periodo_ns = (uint64_t)(pr2 + 1) * prescaler[t2con & 0x03] * postscaler * NS_POR_CICLO;
+    t2_activo = (t2con & 0x04) != 0;
+    t2_proximo_ns = sim_stats.reloj_ns + t2_periodo_ns;
+    hal_t2_if = 0;
+}
+
+// ============ TIMER0 ============
+unsigned char hal_tmr0(void) {
+    // Sin reloj externo en RA4: se usa el reloj simulado con prescaler 1:256
+    return (unsigned char)(sim_stats.reloj_ns / (256 * NS_POR_CICLO));
+}
+
+// ============ EEPROM ============
+static void eeprom_iniciar(void) {
+    if(eeprom_iniciada) return;
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    eeprom_iniciada = 1;
+}
+
+unsigned char hal_eeprom_ocupada(void) {
+    return sim_stats.reloj_ns < eeprom_libre_ns;
+}
+
+unsigned char hal_eeprom_lee(unsigned char dir) {
+    eeprom_iniciar();
+    if(hal_eeprom_ocupada()) sim_stats.eeprom_violaciones++;
+    return eeprom[dir];
+}
+
+void hal_eeprom_escribe(unsigned char dir, unsigned char v) {
+    eeprom_iniciar();
+    if(hal_eeprom_ocupada()) sim_stats.eeprom_violaciones++;
+    eeprom[dir] = v;
+    eeprom_libre_ns = sim_stats.reloj_ns + EEPROM_T_ESCRITURA_NS;
+    sim_stats.eeprom_escrituras++;
+}
+
+void sim_eeprom_cargar(const char *ruta) {
+    FILE *f = fopen(ruta, "rb");
+
+    eeprom_iniciar();
+    if(!f) return;
+    if(fread(eeprom, 1, sizeof(eeprom), f) != sizeof(eeprom)) memset(eeprom, 0xFF, sizeof(eeprom));
+    fclose(f);
+}
+
+void sim_eeprom_guardar(const char *ruta) {
+    FILE *f = fopen(ruta, "wb");
+
+    eeprom_iniciar();
+    if(!f) {
+        perror(ruta);
+        return;
+    }
+    fwrite(eeprom, 1, sizeof(eeprom), f);
+    fclose(f);
+}
+
+// ============ CONTROL DE LA SIMULACIÓN ============
+void sim_alarma(uint64_t en_ns, SimAlarmaCb cb) {
+    alarma_ns = en_ns;
+    alarma_cb = cb;
+}
+
+void sim_detener(void) {
+    longjmp(salida, 1);
+}
+
+void sim_ejecutar(SimFrameCb frame, SimTxCb tx, uint64_t limite) {
+    memset(&sim_stats, 0, sizeof(sim_stats));
+    memset(lcd_ddram, ' ', sizeof(lcd_ddram));
+    frame_cb = frame;
+    tx_cb = tx;
+    limite_ns = limite;
+
+    if(setjmp(salida) == 0) videojuego_main();
+    en_isr = 0;
+}
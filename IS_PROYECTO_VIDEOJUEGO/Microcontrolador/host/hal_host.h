@@ -0,0 +1,188 @@
+// ============ HAL DEL SIMULADOR (compilación nativa en Linux) ============
+// Implementa las macros de hal.h sobre un reloj simulado en nanosegundos.
+// Las esperas (__delay_*) y los bucles de sondeo avanzan el reloj, y en
+// cada avance se disparan las interrupciones de los timers, CCP1 y UART.
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// ============ PINES ============
+// hal_salta/hal_agacha son el nivel que pone el bot; al leerlos con SALTA y
+// AGACHA el contacto rebota durante los primeros ms tras cada cambio.
+extern volatile unsigned char hal_salta;
+extern volatile unsigned char hal_agacha;
+extern volatile unsigned char hal_bocina;
+extern volatile unsigned char hal_led;
+unsigned char hal_boton(unsigned char n);
+
+#define SALTA hal_boton(0)
+#define AGACHA hal_boton(1)
+#define BOCINA hal_bocina
+#define LED hal_led
+
+// ============ RETARDOS ============
+void hal_delay_us(double us);
+
+#define __delay_us(x) hal_delay_us((double)(x))
+#define __delay_ms(x) hal_delay_us((double)(x) * 1000.0)
+
+// ============ PUERTOS ============
+extern unsigned char hal_int_habilitadas;
+
+#define HAL_PUERTOS_INIT() ((void)0)
+#define HAL_ANALOGICOS_OFF() ((void)0)
+#define HAL_INT_HABILITA() (hal_int_habilitadas = 1)
+#define HAL_INT_GLOBAL(v) (hal_int_habilitadas = (v))
+
+// ============ LCD HD44780 ============
+extern unsigned char hal_lcd_bus;
+extern unsigned char hal_lcd_rs;
+extern unsigned char hal_lcd_rw;
+void hal_lcd_e(unsigned char v);
+unsigned char hal_lcd_lee(void);
+
+#define HAL_LCD_PINES() ((void)0)
+#define HAL_LCD_BUS(v) (hal_lcd_bus = (v))
+#define HAL_LCD_BUS_ENTRADA() ((void)0)
+#define HAL_LCD_BUS_SALIDA() ((void)0)
+#define HAL_LCD_BUS_LEE() hal_lcd_lee()
+#define HAL_LCD_RS(v) (hal_lcd_rs = (v))
+#define HAL_LCD_RW(v) (hal_lcd_rw = (v))
+#define HAL_LCD_E(v) hal_lcd_e(v)
+
+// ============ UART ============
+void hal_uart_init(unsigned char spbrg);
+void hal_uart_baud(unsigned char spbrg);
+unsigned char hal_uart_rx_ferr(void);
+extern unsigned char hal_uart_txie;
+unsigned char hal_uart_tx_listo(void);
+unsigned char hal_uart_txif(void);
+void hal_uart_tx(unsigned char d);
+unsigned char hal_uart_rx_pendiente(void);
+unsigned char hal_uart_rx(void);
+
+#define HAL_UART_INIT(spbrg) hal_uart_init(spbrg)
+#define HAL_UART_BAUD(spbrg) hal_uart_baud(spbrg)
+#define HAL_UART_TX_LISTO() hal_uart_tx_listo()
+#define HAL_UART_TX(d) hal_uart_tx(d)
+#define HAL_UART_TX_IE(v) (hal_uart_txie = (v))
+#define HAL_UART_TX_IE_ACTIVA() hal_uart_txie
+#define HAL_UART_TX_IF() hal_uart_txif()
+#define HAL_UART_RX_PENDIENTE() hal_uart_rx_pendiente()
+#define HAL_UART_RX_OVERRUN() 0
+#define HAL_UART_RX_ERROR_TRAMA() hal_uart_rx_ferr()
+#define HAL_UART_RX_REINICIA() ((void)0)
+#define HAL_UART_RX() hal_uart_rx()
+
+// ============ TIMER1 ============
+extern unsigned char hal_t1_ie;
+extern unsigned char hal_t1_if;
+void hal_t1_carga(unsigned char h, unsigned char l);
+void hal_t1_on(unsigned char v);
+unsigned int hal_t1_lee(void);
+
+#define HAL_T1_INIT() hal_t1_on(0)
+#define HAL_T1_CARGA(h, l) hal_t1_carga(h, l)
+#define HAL_T1_LEE(v) ((v) = hal_t1_lee())
+#define HAL_T1_ON(v) hal_t1_on(v)
+#define HAL_T1_IE(v) (hal_t1_ie = (v))
+#define HAL_T1_IF() hal_t1_if
+#define HAL_T1_IF_CLR() (hal_t1_if = 0)
+
+// ============ CCP1 ============
+extern unsigned char hal_ccp1_ie;
+extern unsigned char hal_ccp1_if;
+void hal_ccp1_modo(unsigned char m);
+void hal_ccp1_compara(unsigned int v);
+
+#define HAL_CCP1_MODO(m) hal_ccp1_modo(m)
+#define HAL_CCP1_COMPARA(v) hal_ccp1_compara(v)
+#define HAL_CCP1_IE(v) (hal_ccp1_ie = (v))
+#define HAL_CCP1_IF() hal_ccp1_if
+#define HAL_CCP1_IF_CLR() (hal_ccp1_if = 0)
+
+// ============ TIMER2 ============
+extern unsigned char hal_t2_if;
+void hal_t2_init(unsigned char pr2, unsigned char t2con);
+
+#define HAL_T2_INIT(pr2, t2con) hal_t2_init(pr2, t2con)
+#define HAL_T2_IF() hal_t2_if
+#define HAL_T2_IF_CLR() (hal_t2_if = 0)
+
+// ============ TIMER0 ============
+unsigned char hal_tmr0(void);
+
+#define HAL_TMR0_INIT() ((void)0)
+#define HAL_TMR0() hal_tmr0()
+
+// ============ EEPROM DE DATOS ============
+unsigned char hal_eeprom_ocupada(void);
+unsigned char hal_eeprom_lee(unsigned char dir);
+void hal_eeprom_escribe(unsigned char dir, unsigned char v);
+
+#define HAL_EEPROM_OCUPADA() hal_eeprom_ocupada()
+#define HAL_EEPROM_LEE(dir) hal_eeprom_lee(dir)
+#define HAL_EEPROM_ESCRIBE(dir, v) hal_eeprom_escribe(dir, v)
+
+// ============ GANCHOS DEL SIMULADOR ============
+void hal_espera(void);
+void hal_inicio_frame(void);
+void hal_fin_frame(void);
+
+#define HAL_ESPERA() hal_espera()
+#define HAL_INICIO_FRAME() hal_inicio_frame()
+#define HAL_FIN_FRAME() hal_fin_frame()
+
+// ============ SÍMBOLOS DEL FIRMWARE ============
+void ISR(void);
+void videojuego_main(void);
+
+// ============ API DEL SIMULADOR (usada por main_host.c) ============
+#define SIM_LCD_COLUMNAS 16
+#define SIM_LCD_FILAS 2
+
+typedef struct {
+    uint64_t reloj_ns;           // Tiempo simulado
+    uint32_t frames;             // Llamadas a HAL_FIN_FRAME()
+    uint64_t espera_frame_ns;    // Retardos activos entre HAL_INICIO_FRAME() y HAL_FIN_FRAME()
+    uint32_t lcd_comandos;       // Escrituras con RS=0
+    uint32_t lcd_datos;          // Escrituras con RS=1
+    uint32_t lcd_violaciones;    // Escrituras con el HD44780 aún ocupado
+    uint32_t uart_tx_bytes;
+    uint32_t uart_rx_bytes;
+    uint32_t uart_errores_trama;   // Bytes recibidos con el otro extremo a otra velocidad
+    uint32_t t1_desbordes;
+    uint32_t ccp1_comparaciones;   // Flancos generados en la bocina
+    uint32_t t2_periodos;
+    uint32_t eeprom_escrituras;
+    uint32_t eeprom_violaciones;   // Accesos con una escritura aún en curso
+} SimEstadisticas;
+
+extern SimEstadisticas sim_stats;
+
+// frame_cb se llama en cada HAL_INICIO_FRAME(), con el LCD mostrando ya el
+// frame anterior, y detiene la simulación si devuelve 0; tx_cb recibe cada byte que el firmware transmite por la UART.
+typedef unsigned char (*SimFrameCb)(void);
+typedef void (*SimTxCb)(unsigned char dato);
+typedef void (*SimAlarmaCb)(void);
+
+// Ejecuta videojuego_main() hasta sim_detener() o hasta limite_ns (0 = sin
+// límite). Las variables globales del firmware no se reinician, así que
+// solo se admite una ejecución por proceso.
+void sim_ejecutar(SimFrameCb frame_cb, SimTxCb tx_cb, uint64_t limite_ns);
+void sim_detener(void);
+void sim_alarma(uint64_t en_ns, SimAlarmaCb cb);
+void sim_uart_inyectar(const unsigned char *datos, unsigned int len);
+// Velocidad del otro extremo de la línea (0 = la misma que el PIC)
+void sim_uart_baudios(uint32_t baudios);
+unsigned int sim_uart_rx_pendientes(void);
+// Imagen de la EEPROM: sin archivo (o si no existe) empieza borrada a 0xFF
+void sim_eeprom_cargar(const char *ruta);
+void sim_eeprom_guardar(const char *ruta);
+unsigned char sim_lcd_celda(unsigned char col, unsigned char fila);
+void sim_lcd_volcar(FILE *archivo);
+extern char sim_lcd_glifos[8];      // Carácter con el que se vuelca cada código CGRAM
+
+#endif
@@ -0,0 +1,1058 @@
+// ============ EJECUCIÓN NATIVA DE Videojuego.c ============
+// Hace de "backend": inyecta la configuración por la UART simulada,
+// reintenta como send_to_pic si el PIC no confirma, juega con un bot que
+// solo mira el LCD simulado y repite partidas para perfilado y regresión.
+//
+// Uso: videojuego_host [-c config.json] [-p partidas] [-t segundos]
+//                      [-m] [-v] [-q] [-b] [-B baudios [-x]] [-s divisor]
+//                      [-g grabacion] [-r grabacion] [-e eeprom [-k]]
+//                      [-P frames] [-j iteraciones] [-f iteraciones]
+// Con -b la configuración viaja en la trama binaria (COBS + CRC-16).
+// Con -B se negocia antes la velocidad más alta hasta "baudios" que el
+// PIC ofrezca; -x desvía el reloj del adaptador un 6 % para forzar que la
+// prueba de eco falle y comprobar la vuelta a 9600. Con -s se pide la
+// telemetría en vivo cada "divisor" ticks y se comprueba cada trama.
+// Con -g se vuelca tras cada partida la grabación de entradas del firmware
+// (semilla, entradas en hexadecimal y línea final); con -r cada partida se
+// juega con esa grabación, sin bot, y se compara la línea final.
+// Con -e la EEPROM de datos se lee de ese archivo y se guarda al salir, así
+// que las ranuras de configuración sobreviven entre ejecuciones como en el
+// PIC. Con -k (implica -b) la configuración va a una ranura como en
+// dispositivos.py: los hashes se piden una vez, una configuración ya
+// guardada se arranca con TRAMA_JUGAR_SLOT y una nueva se sube a su ranura.
+// Con -P se pide el informe de perfilado (TRAMA_PERFIL) cada "frames"
+// frames de juego; el firmware tiene que compilarse con PERFILADO=1.
+// Con -j no se simula el juego: se mide el parser JSON del firmware
+// (throughput y fuzzing con mutaciones de la configuración).
+// Con -f se compara el formato BCD del firmware con el de divisiones.
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hal_host.h"
+
+#define NS_POR_S 1000000000ULL
+#define REINTENTO_NS (8 * NS_POR_S)
+
+static const char config_defecto[] =
+    "{\"character\":[14,14,4,31,4,10,17,0],"
+    "\"obstacle\":[4,14,31,31,14,4,0,0],"
+    "\"goalType\":\"obstacles\",\"goalValue\":10}";
+
+static char config[512];
+static unsigned int config_len;
+
+static unsigned int partidas_objetivo = 1;
+static unsigned int partidas = 0;
+static unsigned int victorias = 0;
+static unsigned int reintentos = 0;
+static unsigned char bot = 1;
+static unsigned char verboso = 0;
+static unsigned char silencioso = 0;
+
+// Contadores del firmware (Videojuego.c)
+extern unsigned char lcdEscriturasFrame;
+extern unsigned char lcdEscriturasMax;
+extern unsigned char periodoTickMs;
+extern volatile unsigned char tickOverruns;
+extern unsigned char tickUsoMaxMs;
+extern unsigned char txOcupacionMax;
+// Caché de sprites (CACHÉ DE SPRITES EN CGRAM en Videojuego.c)
+#ifndef CGRAM_SLOTS
+#define CGRAM_SLOTS 8
+#endif
+#define SPR_TROFEO 6
+#define SPR_CALAVERA 7
+#define SPR_NINGUNO 0xFF
+extern unsigned char slotSprite[CGRAM_SLOTS];   // Sprite << 5 | parámetro
+extern unsigned int cgramEscrituras;
+extern unsigned char cgramFilasMax;
+extern unsigned char latenciaMaxMs;
+extern unsigned int latenciaSumaMs;
+extern unsigned int latenciaEventos;
+extern unsigned char botonPerdidos;
+static unsigned long lcd_escrituras_juego = 0;
+static unsigned int finales_sin_sprite = 0;
+
+// Parser del firmware (mismos códigos que JSON_* en Videojuego.c)
+#define JSON_EN_CURSO 0
+#define JSON_COMPLETO 1
+#define JSON_CODIGOS 7
+unsigned char JSON_Byte(unsigned char c);
+void JSON_Reinicia(void);
+unsigned char validarConfiguracion(void);
+
+// Contadores BCD (FORMATO NUMÉRICO SIN DIVISIONES en Videojuego.c)
+#define BCD_DIGITOS 5
+typedef struct {
+    unsigned char d[BCD_DIGITOS];
+} ContadorBCD;
+void bcd_cero(ContadorBCD *c);
+void bcd_incrementar(ContadorBCD *c);
+void bcd_desde(ContadorBCD *c, unsigned int valor);
+unsigned char bcd_texto(const ContadorBCD *c, char *texto);
+
+// Protocolo binario (PROTOCOLO BINARIO en Videojuego.c)
+#define TRAMA_CONFIG 0x01
+#define TRAMA_PING 0x02
+#define TRAMA_BAUD 0x03
+#define TRAMA_ECO 0x04
+#define TRAMA_STREAM 0x05
+#define TRAMA_ACK 0x81
+#define TRAMA_PONG 0x82
+#define TRAMA_BAUD_ACK 0x83
+#define TRAMA_ECO_RESP 0x84
+#define TRAMA_STREAM_ACK 0x85
+#define TRAMA_GRABACION 0x06
+#define TRAMA_REPETIR 0x07
+#define TRAMA_GRABACION_RESP 0x86
+#define TRAMA_REPETIR_ACK 0x87
+#define GRAB_TROZO 16
+#define TRAMA_SLOTS 0x08
+#define TRAMA_JUGAR_SLOT 0x09
+#define TRAMA_SLOTS_RESP 0x88
+#define SLOT_DATOS 21
+#define SLOT_VACIO 0xFFFF
+#define SLOTS_MAX 16
+#define TRAMA_PERFIL 0x0A
+#define TRAMA_PERFIL_RESP 0x89
+#define PERF_FASES 4
+#define TRAMA_TELEMETRIA 0x90
+#define TELE_FIN 0x08
+unsigned int CRC16(const unsigned char *datos, unsigned char n);
+unsigned char COBS_Decodifica(unsigned char *b, unsigned char n);
+
+static unsigned char binario = 0;
+static unsigned char trama_tx[32];
+static unsigned int trama_tx_len = 0;
+static unsigned char trama_rx[64];
+static unsigned int trama_rx_len = 0;
+static unsigned char trama_rx_activa = 0;
+static unsigned char seq_comando = 0;       // Última secuencia enviada (1..255)
+static unsigned char seq_config = 0;
+static unsigned int seq_erroneas = 0;       // Respuestas con una secuencia inesperada
+
+// Perfilado (firmware compilado con PERFILADO=1): informe cada perfil_cada frames
+static const char *const perf_nombres[PERF_FASES] = { "logica", "render", "score", "uart" };
+static unsigned int perfil_cada = 0;
+static unsigned int perfil_frames = 0;
+static unsigned char perfil_seq = 0;
+static unsigned char perfil_sin_soporte = 0;
+static unsigned int perfil_informes = 0;
+static unsigned int perf_max[PERF_FASES], perf_n[PERF_FASES], perf_suma[PERF_FASES];
+static unsigned char perf_overruns, perf_rx_max, perf_uso_ms;
+
+// Negociación de velocidad (mismo orden que spbrgBaudios en Videojuego.c)
+#define ECO_PLAZO_NS (200 * 1000000ULL)
+#define CAMBIO_NS (5 * 1000000ULL)      // tx_cb ve el ACK antes de que salga del todo
+#define PLAZO_PIC_NS (1100 * 1000000ULL)
+static const uint32_t baudios_tabla[] = { 9600, 19200, 38400, 57600, 115200 };
+static const unsigned char eco_patron[] = { 0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0x01, 0x80 };
+static uint32_t baud_objetivo = 0;
+static unsigned char baud_desvio = 0;
+static unsigned char baud_indice = 0;
+static uint32_t baud_final = 9600;
+static unsigned int baud_fallos = 0;
+
+// Telemetría en vivo
+extern unsigned char streamOmitidas;
+static unsigned char stream_pedido = 0;
+static unsigned char stream_divisor = 0;
+static unsigned int tele_tramas = 0;
+static unsigned int tele_huecos = 0;
+static unsigned int tele_finales = 0;
+static unsigned int tele_ultimo_tick = 0;
+static unsigned int tele_esquivados = 0;
+static unsigned int tele_discrepancias = 0;
+
+// Grabación (-g) y repetición (-r) de entradas
+static const char *ruta_grabacion = NULL;
+static const char *ruta_repeticion = NULL;
+static unsigned char grab[256];
+static unsigned int grab_len = 0;
+static unsigned int grab_semilla = 0;
+static unsigned int grab_enviados = 0;
+static char grab_linea[256];
+static unsigned int repeticiones = 0;
+static unsigned int repeticiones_distintas = 0;
+static unsigned int repeticiones_rechazadas = 0;
+
+// Ranuras de configuración en la EEPROM (-e, -k)
+static const char *ruta_eeprom = NULL;
+static unsigned char ranuras = 0;
+static unsigned char config_bin[SLOT_DATOS];    // Formato de la ranura: seed incluida
+static unsigned int config_hash = 0;
+static unsigned int ranura_hash[SLOTS_MAX];
+static unsigned char ranuras_n = 0;             // 0 = hashes aún sin pedir
+static unsigned char ranura_siguiente = 0;      // Sin ranuras vacías se reemplazan en orden
+static unsigned char ranura_pedida = 0xFF;      // TRAMA_JUGAR_SLOT pendiente de ACK
+static unsigned char ranura_subida = 0xFF;      // TRAMA_CONFIG con ranura pendiente de ACK
+static unsigned int ranura_arranques = 0;
+static unsigned int ranura_subidas = 0;
+static unsigned int ranura_rechazos = 0;
+
+static uint64_t carga_inicio_ns = 0;
+static uint64_t carga_total_ns = 0;
+static unsigned int cargas = 0;
+
+static char linea[256];
+static unsigned int linea_len = 0;
+
+// ============ BACKEND SIMULADO ============
+static void reintentar_config(void);
+static void enviar_config(void);
+static void siguiente_partida(void);
+
+// carga necesita 2 bytes libres al final para el CRC
+static unsigned int codificar_trama(unsigned char *carga, unsigned int n, unsigned char *dst) {
+    unsigned int crc = CRC16(carga, (unsigned char)n), inicio = 0, fin, len = 0;
+
+    carga[n++] = crc >> 8;
+    carga[n++] = crc & 0xFF;
+
+    dst[len++] = 0;
+    while(inicio <= n) {
+        fin = inicio;
+        while(fin < n && carga[fin] != 0) fin++;
+        dst[len++] = (unsigned char)(fin - inicio + 1);
+        while(inicio < fin) dst[len++] = carga[inicio++];
+        inicio++;
+    }
+    dst[len++] = 0;
+    return len;
+}
+
+static unsigned char siguiente_seq(void) {
+    if(++seq_comando == 0) seq_comando = 1;
+    return seq_comando;
+}
+
+// carga = tipo, datos...; la secuencia se inserta tras el tipo
+static void inyectar_trama(const unsigned char *carga, unsigned int n) {
+    unsigned char tmp[34], cod[42];
+
+    tmp[0] = carga[0];
+    tmp[1] = siguiente_seq();
+    memcpy(tmp + 2, carga + 1, n - 1);
+    sim_uart_inyectar(cod, codificar_trama(tmp, n + 1, cod));
+}
+
+// Tras negociar la velocidad: activar la telemetría en vivo y luego configurar
+static void preparar_partida(void) {
+    unsigned char stream[2];
+
+    if(!stream_pedido || stream_divisor) {
+        siguiente_partida();
+        return;
+    }
+    stream[0] = TRAMA_STREAM;
+    stream[1] = stream_pedido;
+    inyectar_trama(stream, sizeof(stream));
+    sim_alarma(sim_stats.reloj_ns + ECO_PLAZO_NS, siguiente_partida);
+}
+
+static void procesar_telemetria(const unsigned char *carga) {
+    unsigned int tick = (unsigned int)carga[1] << 8 | carga[2];
+
+    tele_tramas++;
+    tele_esquivados = (unsigned int)carga[4] << 8 | carga[5];
+    if(carga[3] & TELE_FIN) {
+        tele_finales++;
+        tele_ultimo_tick = 0;
+        return;
+    }
+    if(tick != tele_ultimo_tick + stream_divisor) tele_huecos++;
+    tele_ultimo_tick = tick;
+}
+
+static void enviar_ping(void) {
+    static const unsigned char ping[] = { TRAMA_PING };
+
+    inyectar_trama(ping, sizeof(ping));
+}
+
+// Como api.py: tras un eco fallido se pide 9600 a la velocidad nueva y se
+// espera a que venza el plazo del PIC por si esa petición tampoco llegó
+static void volver_a_9600(void) {
+    sim_uart_baudios(9600);
+    preparar_partida();
+}
+
+static void eco_fallido(void) {
+    unsigned char baud[] = { TRAMA_BAUD, 0 };
+
+    baud_fallos++;
+    if(!silencioso) printf("[%10.3f s] eco fallido a %u baudios\n", sim_stats.reloj_ns / 1e9, baudios_tabla[baud_indice]);
+    inyectar_trama(baud, sizeof(baud));
+    baud_indice = 0;
+    sim_alarma(sim_stats.reloj_ns + PLAZO_PIC_NS, volver_a_9600);
+}
+
+// El adaptador cambia de velocidad cuando el ACK ya salió entero del PIC
+static void enviar_eco(void) {
+    unsigned char eco[1 + sizeof(eco_patron)];
+
+    sim_uart_baudios(baudios_tabla[baud_indice] * (baud_desvio ? 106 : 100) / 100);
+    eco[0] = TRAMA_ECO;
+    memcpy(eco + 1, eco_patron, sizeof(eco_patron));
+    inyectar_trama(eco, sizeof(eco));
+    sim_alarma(sim_stats.reloj_ns + ECO_PLAZO_NS, eco_fallido);
+}
+
+// ============ PERFILADO ============
+static void pedir_perfil(unsigned char fase) {
+    unsigned char peticion[] = { TRAMA_PERFIL, fase };
+
+    inyectar_trama(peticion, sizeof(peticion));
+    perfil_seq = seq_comando;
+}
+
+// En el simulador la CPU no consume tiempo: las fases solo miden esperas
+// (cola del LCD llena, buffer TX lleno...), no ciclos de instrucción
+static void imprimir_perfil(FILE *f) {
+    unsigned char i;
+
+    fprintf(f, "perfil (%u informes): %u overruns, RX máx %u bytes, tick máx %u ms\n",
+            perfil_informes, perf_overruns, perf_rx_max, perf_uso_ms);
+    for(i = 0; i < PERF_FASES; i++) {
+        if(!perf_n[i]) fprintf(f, "  %-10s sin muestras\n", perf_nombres[i]);
+        else fprintf(f, "  %-10s n=%u máx %u us, media %.1f us\n", perf_nombres[i],
+                     perf_n[i], perf_max[i], (double)perf_suma[i] / perf_n[i]);
+    }
+}
+
+// carga: tipo, seq, fase, fases, overruns, RX máx, uso máx, n x (máx(2), n, suma(2))
+static void recibir_perfil(const unsigned char *carga, unsigned char n) {
+    unsigned char f = carga[2];
+    const unsigned char *p;
+
+    perfil_seq = 0;
+    perf_overruns = carga[4];
+    perf_rx_max = carga[5];
+    perf_uso_ms = carga[6];
+    for(p = carga + 7; p + 5 <= carga + n && f < PERF_FASES; p += 5, f++) {
+        perf_max[f] = (unsigned int)p[0] << 8 | p[1];
+        perf_n[f] = p[2];
+        perf_suma[f] = (unsigned int)p[3] << 8 | p[4];
+    }
+    if(f < carga[3] && f > carga[2]) {
+        pedir_perfil(f);
+        return;
+    }
+    perfil_informes++;
+    if(!silencioso) imprimir_perfil(stdout);
+}
+
+// ============ GRABACIÓN Y REPETICIÓN ============
+static void pedir_grabacion(unsigned char desde) {
+    unsigned char peticion[] = { TRAMA_GRABACION, desde };
+
+    inyectar_trama(peticion, sizeof(peticion));
+}
+
+// carga: tipo, seq, estado, longitud, semilla(2), offset, entradas...
+static void recibir_grabacion(const unsigned char *carga, unsigned char n) {
+    unsigned int i, desde = carga[6];
+    FILE *f;
+
+    grab_len = carga[3];
+    grab_semilla = (unsigned int)carga[4] << 8 | carga[5];
+    for(i = 7; i < n; i++) grab[desde++] = carga[i];
+    if(n > 7 && desde < grab_len) {
+        pedir_grabacion((unsigned char)desde);
+        return;
+    }
+
+    f = fopen(ruta_grabacion, "w");
+    if(!f) {
+        perror(ruta_grabacion);
+    } else {
+        fprintf(f, "seed %u%s\ninputs ", grab_semilla, (carga[2] & 0x01) ? " truncated" : "");
+        for(i = 0; i < grab_len; i++) fprintf(f, "%02x", grab[i]);
+        fprintf(f, "\nresult %s\n", grab_linea);
+        fclose(f);
+    }
+    if(partidas >= partidas_objetivo) sim_detener();
+    else enviar_config();
+}
+
+static void cargar_grabacion(const char *ruta) {
+    FILE *f = fopen(ruta, "r");
+    char texto[600], *p;
+    unsigned char leidos = 0;
+
+    while(f && fgets(texto, sizeof(texto), f)) {
+        texto[strcspn(texto, "\r\n")] = 0;
+        if(strncmp(texto, "seed ", 5) == 0) {
+            grab_semilla = (unsigned int)strtoul(texto + 5, NULL, 10);
+            leidos |= 1;
+        } else if(strncmp(texto, "inputs", 6) == 0) {
+            for(p = texto + 6; *p == ' '; p++);
+            for(grab_len = 0; p[0] && p[1] && grab_len < sizeof(grab); p += 2)
+                grab[grab_len++] = (unsigned char)strtoul((char[]){ p[0], p[1], 0 }, NULL, 16);
+            leidos |= 2;
+        } else if(strncmp(texto, "result ", 7) == 0) {
+            snprintf(grab_linea, sizeof(grab_linea), "%.255s", texto + 7);
+            leidos |= 4;
+        }
+    }
+    if(f) fclose(f);
+    if(leidos != 7) {
+        fprintf(stderr, "%s: grabación ilegible\n", ruta);
+        exit(1);
+    }
+}
+
+// Un trozo de la grabación; el ACK del último arma la repetición
+static void enviar_repeticion(void) {
+    unsigned char trozo[5 + GRAB_TROZO];
+    unsigned int n = 0;
+
+    trozo[n++] = TRAMA_REPETIR;
+    trozo[n++] = (unsigned char)grab_len;
+    trozo[n++] = grab_semilla >> 8;
+    trozo[n++] = grab_semilla & 0xFF;
+    trozo[n++] = (unsigned char)grab_enviados;
+    while(n < sizeof(trozo) && grab_enviados < grab_len) trozo[n++] = grab[grab_enviados++];
+    inyectar_trama(trozo, n);
+}
+
+// ============ RANURAS DE CONFIGURACIÓN ============
+static void pedir_ranuras(void) {
+    static const unsigned char peticion[] = { TRAMA_SLOTS };
+
+    inyectar_trama(peticion, sizeof(peticion));
+}
+
+static void subir_a_ranura(unsigned char r) {
+    unsigned char carga[2 + SLOT_DATOS];
+
+    carga[0] = TRAMA_CONFIG;
+    memcpy(carga + 1, config_bin, SLOT_DATOS);
+    carga[1 + SLOT_DATOS] = r;
+    inyectar_trama(carga, sizeof(carga));
+    seq_config = seq_comando;
+    ranura_pedida = 0xFF;
+    ranura_subida = r;
+    ranura_subidas++;
+}
+
+static void enviar_config_ranura(void) {
+    unsigned char r, peticion[2];
+
+    for(r = 0; r < ranuras_n; r++) {
+        if(ranura_hash[r] != config_hash) continue;
+        peticion[0] = TRAMA_JUGAR_SLOT;
+        peticion[1] = r;
+        inyectar_trama(peticion, sizeof(peticion));
+        seq_config = seq_comando;
+        ranura_pedida = r;
+        ranura_subida = 0xFF;
+        return;
+    }
+    for(r = 0; r < ranuras_n && ranura_hash[r] != SLOT_VACIO; r++);
+    if(r == ranuras_n) {
+        r = ranura_siguiente;
+        ranura_siguiente = (unsigned char)((ranura_siguiente + 1) % ranuras_n);
+    }
+    subir_a_ranura(r);
+}
+
+static void recibir_ranuras(const unsigned char *carga, unsigned char n) {
+    unsigned char r;
+
+    ranuras_n = carga[2] < SLOTS_MAX ? carga[2] : SLOTS_MAX;
+    if(n < 3 + 2 * ranuras_n) ranuras_n = 0;
+    for(r = 0; r < ranuras_n; r++) ranura_hash[r] = (unsigned int)carga[3 + 2 * r] << 8 | carga[4 + 2 * r];
+    if(ranuras_n) {
+        enviar_config_ranura();
+        return;
+    }
+    // Sin ranuras: configuración normal
+    ranuras = 0;
+    enviar_config();
+}
+
+static void siguiente_partida(void) {
+    if(!ruta_repeticion) {
+        enviar_config();
+        return;
+    }
+    grab_enviados = 0;
+    enviar_repeticion();
+}
+
+static void procesar_negociacion(const unsigned char *carga, unsigned char n) {
+    unsigned char i, baud[2];
+
+    if(carga[0] == TRAMA_PONG && n >= 4) {
+        for(i = sizeof(baudios_tabla) / sizeof(baudios_tabla[0]) - 1; i > 0; i--)
+            if((carga[3] & (1 << i)) && baudios_tabla[i] <= baud_objetivo) break;
+        if(i == 0) {
+            preparar_partida();
+            return;
+        }
+        baud_indice = i;
+        baud[0] = TRAMA_BAUD;
+        baud[1] = i;
+        inyectar_trama(baud, sizeof(baud));
+    } else if(carga[0] == TRAMA_BAUD_ACK && n >= 3 && carga[2] == baud_indice && baud_indice) {
+        sim_alarma(sim_stats.reloj_ns + CAMBIO_NS, enviar_eco);
+    } else if(carga[0] == TRAMA_ECO_RESP && n == 2 + sizeof(eco_patron) &&
+              memcmp(carga + 2, eco_patron, sizeof(eco_patron)) == 0) {
+        baud_final = baudios_tabla[baud_indice];
+        preparar_partida();
+    } else if(carga[0] == TRAMA_STREAM_ACK && n >= 3) {
+        stream_divisor = carga[2];
+        sim_alarma(0, 0);
+        siguiente_partida();
+    } else if(carga[0] == TRAMA_TELEMETRIA && n == 8) {
+        procesar_telemetria(carga);
+    } else if(carga[0] == TRAMA_GRABACION_RESP && n >= 7) {
+        recibir_grabacion(carga, n);
+    } else if(carga[0] == TRAMA_REPETIR_ACK && n >= 3) {
+        if(carga[2] == JSON_EN_CURSO) {
+            enviar_repeticion();
+            return;
+        }
+        if(carga[2] != JSON_COMPLETO) repeticiones_rechazadas++;
+        enviar_config();
+    } else if(carga[0] == TRAMA_PERFIL_RESP && n >= 7) {
+        recibir_perfil(carga, n);
+    } else if(carga[0] == TRAMA_SLOTS_RESP && n >= 3) {
+        recibir_ranuras(carga, n);
+    } else if(carga[0] == TRAMA_ACK && n >= 3 && ranura_pedida != 0xFF) {
+        // Ranura vacía o dañada: se sube la configuración a esa misma
+        ranura_rechazos++;
+        subir_a_ranura(ranura_pedida);
+    }
+}
+
+static void enviar_config(void) {
+    carga_inicio_ns = sim_stats.reloj_ns;
+    if(ranuras && !ranuras_n) pedir_ranuras();
+    else if(ranuras) enviar_config_ranura();
+    else if(binario) sim_uart_inyectar(trama_tx, trama_tx_len);
+    else sim_uart_inyectar((const unsigned char *)config, config_len);
+    sim_alarma(sim_stats.reloj_ns + REINTENTO_NS, reintentar_config);
+}
+
+static void reintentar_config(void) {
+    reintentos++;
+    enviar_config();
+}
+
+static void config_cargada(void) {
+    sim_alarma(0, 0);
+    carga_total_ns += sim_stats.reloj_ns - carga_inicio_ns;
+    cargas++;
+    if(ranura_pedida != 0xFF) ranura_arranques++;
+    else if(ranura_subida != 0xFF) ranura_hash[ranura_subida] = config_hash;
+    ranura_pedida = 0xFF;
+    ranura_subida = 0xFF;
+}
+
+// Sprite lógico del slot, o SPR_NINGUNO
+static unsigned char sprite_de_slot(unsigned char slot) {
+    return slotSprite[slot] == SPR_NINGUNO ? SPR_NINGUNO : slotSprite[slot] >> 5;
+}
+
+static unsigned char sprite_residente(unsigned char id) {
+    unsigned char slot;
+
+    for(slot = 0; slot < CGRAM_SLOTS; slot++)
+        if(sprite_de_slot(slot) == id) return 1;
+    return 0;
+}
+
+static void procesar_linea(void) {
+    if(!silencioso) printf("[%10.3f s] %s\n", sim_stats.reloj_ns / 1e9, linea);
+
+    if(strncmp(linea, "{\"status\":\"loaded\"", 18) == 0) {
+        config_cargada();
+    } else if(strncmp(linea, "{\"obstacles\"", 12) == 0) {
+        // La trama final de la telemetría en vivo sale justo antes
+        if(stream_divisor && (unsigned int)atoi(linea + 13) != tele_esquivados) tele_discrepancias++;
+        partidas++;
+        if(strstr(linea, "\"win\"")) victorias++;
+        // La pantalla final ha dibujado el trofeo o la calavera justo antes
+        // y desde entonces solo hay texto: el sprite tiene que ocupar un slot
+        if(!sprite_residente(strstr(linea, "\"win\"") ? SPR_TROFEO : SPR_CALAVERA)) finales_sin_sprite++;
+        if(ruta_repeticion) {
+            repeticiones++;
+            if(strcmp(linea, grab_linea)) repeticiones_distintas++;
+        } else if(ruta_grabacion) {
+            // La siguiente partida sale cuando el volcado termina
+            strcpy(grab_linea, linea);
+            pedir_grabacion(0);
+            return;
+        }
+        if(partidas >= partidas_objetivo) sim_detener();
+        siguiente_partida();
+    }
+}
+
+static void procesar_trama(void) {
+    unsigned char n = COBS_Decodifica(trama_rx, (unsigned char)trama_rx_len);
+
+    if(n < 4 || CRC16(trama_rx, n - 2) != ((unsigned int)trama_rx[n - 2] << 8 | trama_rx[n - 1])) {
+        if(!silencioso) printf("[%10.3f s] trama inválida\n", sim_stats.reloj_ns / 1e9);
+        return;
+    }
+    if(!silencioso && (verboso || trama_rx[0] != TRAMA_TELEMETRIA))
+        printf("[%10.3f s] trama 0x%02X, %u bytes\n", sim_stats.reloj_ns / 1e9, trama_rx[0], n - 2);
+    // Sin PERFILADO el firmware contesta TRAMA_PERFIL como trama desconocida
+    if(trama_rx[0] == TRAMA_ACK && perfil_seq && trama_rx[1] == perfil_seq) {
+        perfil_sin_soporte = 1;
+        perfil_seq = 0;
+        return;
+    }
+    // Toda respuesta repite la secuencia de su petición
+    if(trama_rx[0] != TRAMA_TELEMETRIA &&
+       trama_rx[1] != (trama_rx[0] == TRAMA_ACK ? seq_config : seq_comando)) {
+        seq_erroneas++;
+        return;
+    }
+    if(trama_rx[0] == TRAMA_ACK && trama_rx[2] == JSON_COMPLETO) config_cargada();
+    else procesar_negociacion(trama_rx, n - 2);
+}
+
+static void recibir_tx(unsigned char dato) {
+    if(dato == 0) {
+        if(trama_rx_activa && trama_rx_len) {
+            procesar_trama();
+            trama_rx_activa = 0;
+        } else {
+            trama_rx_activa = 1;
+        }
+        trama_rx_len = 0;
+        return;
+    }
+    if(trama_rx_activa) {
+        if(trama_rx_len < sizeof(trama_rx)) trama_rx[trama_rx_len++] = dato;
+        else trama_rx_activa = 0;
+        return;
+    }
+    if(dato == '\r') return;
+    if(dato == '\n') {
+        linea[linea_len] = 0;
+        procesar_linea();
+        linea_len = 0;
+        return;
+    }
+    if(linea_len < sizeof(linea) - 1) linea[linea_len++] = dato;
+}
+
+// ============ BOT DE ENTRADA ============
+// Un carácter por sprite lógico (SPR_* de Videojuego.c) para el volcado
+static const char SPRITES_VOLCADO[8] = { '@', '#', ':', '|', 'v', 'o', 'Y', 'X' };
+
+// ¿El código de carácter c es un slot CGRAM con uno de los sprites dados?
+static unsigned char es_sprite(unsigned char c, const char *sprites) {
+    return c < CGRAM_SLOTS && sprite_de_slot(c) < 8 && strchr(sprites, SPRITES_VOLCADO[sprite_de_slot(c)]) != NULL;
+}
+
+static unsigned char fin_frame(void) {
+    unsigned char fila, c;
+
+    lcd_escrituras_juego += lcdEscriturasFrame;
+    if(perfil_cada && !perfil_sin_soporte && !perfil_seq && ++perfil_frames % perfil_cada == 0)
+        pedir_perfil(0);
+
+    if(verboso) {
+        for(c = 0; c < CGRAM_SLOTS; c++)
+            sim_lcd_glifos[c] = sprite_de_slot(c) < 8 ? SPRITES_VOLCADO[sprite_de_slot(c)] : '?';
+        sim_lcd_volcar(stdout);
+    }
+    if(!bot) return 1;
+
+    hal_salta = 0;
+    hal_agacha = 0;
+
+    // Los códigos CGRAM cambian de sprite según la caché del firmware: el
+    // personaje es el código cuyo slot tiene SPR_PERSONAJE, en la columna 0.
+    // La pantalla es la del frame anterior y la pulsación tarda unos ms en
+    // pasar el antirrebote, así que se esquiva lo que haya en la columna 2
+    // (llega a la 0 dentro de dos ticks) con cualquier obstáculo.
+    if(es_sprite(sim_lcd_celda(0, 0), "@")) fila = 0;
+    else if(es_sprite(sim_lcd_celda(0, 1), "@")) fila = 1;
+    else return 1;
+
+    if(es_sprite(sim_lcd_celda(2, fila), "#vo")) {
+        if(fila) hal_salta = 1;
+        else hal_agacha = 1;
+    }
+    return 1;
+}
+
+// ============ PRINCIPAL ============
+static double segundos_pared(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Valores de "clave":[...] o "clave":n en la configuración JSON
+static void extraer_valores(const char *clave, unsigned char *dst, unsigned int n) {
+    const char *p = strstr(config, clave);
+    unsigned int i;
+
+    for(i = 0; i < n; i++) {
+        while(p && *p && (*p < '0' || *p > '9')) p++;
+        dst[i] = p && *p ? (unsigned char)strtoul(p, (char **)&p, 10) : 0;
+    }
+}
+
+// 0x00, COBS(TRAMA_CONFIG, seq, character, obstacle, goalType, goalValue, [seed,] CRC), 0x00.
+// config_bin y config_hash llevan siempre la semilla (0 si no hay), como una ranura.
+static void construir_trama_config(void) {
+    const char *goal_txt = strstr(config, "\"goalValue\"");
+    const char *seed_txt = strstr(config, "\"seed\"");
+    unsigned char carga[2 + SLOT_DATOS + 2];
+    unsigned int n = 0, goal, seed = 0;
+
+    if(goal_txt) goal_txt = strchr(goal_txt, ':');
+    goal = goal_txt ? (unsigned int)strtoul(goal_txt + 1, NULL, 10) : 0;
+    if(seed_txt) seed_txt = strchr(seed_txt, ':');
+    if(seed_txt) seed = (unsigned int)strtoul(seed_txt + 1, NULL, 10);
+
+    extraer_valores("\"character\"", config_bin, 8);
+    extraer_valores("\"obstacle\"", config_bin + 8, 8);
+    config_bin[16] = strstr(config, "\"time\"") ? 0 : 1;
+    config_bin[17] = goal >> 8;
+    config_bin[18] = goal & 0xFF;
+    config_bin[19] = seed >> 8;
+    config_bin[20] = seed & 0xFF;
+    config_hash = CRC16(config_bin, SLOT_DATOS);
+
+    carga[n++] = TRAMA_CONFIG;
+    carga[n++] = seq_config = siguiente_seq();
+    memcpy(carga + n, config_bin, seed_txt ? SLOT_DATOS : SLOT_DATOS - 2);
+    n += seed_txt ? SLOT_DATOS : SLOT_DATOS - 2;
+    trama_tx_len = codificar_trama(carga, n, trama_tx);
+}
+
+static void cargar_config(const char *ruta) {
+    FILE *f = fopen(ruta, "rb");
+
+    if(!f) {
+        perror(ruta);
+        exit(1);
+    }
+    config_len = fread(config, 1, sizeof(config) - 1, f);
+    fclose(f);
+    while(config_len && (config[config_len - 1] == '\n' || config[config_len - 1] == '\r'))
+        config_len--;
+    config[config_len] = 0;
+}
+
+// ============ BANCO DE PRUEBAS DEL PARSER JSON ============
+static uint32_t azar_estado = 0x2545F491;
+
+static uint32_t azar(void) {
+    azar_estado ^= azar_estado << 13;
+    azar_estado ^= azar_estado >> 17;
+    azar_estado ^= azar_estado << 5;
+    return azar_estado;
+}
+
+// Último resultado distinto de JSON_EN_CURSO (o JSON_EN_CURSO si no hubo)
+static unsigned char alimentar(const unsigned char *datos, unsigned int len) {
+    unsigned char r, ultimo = JSON_EN_CURSO;
+    unsigned int i;
+
+    for(i = 0; i < len; i++) {
+        r = JSON_Byte(datos[i]);
+        if(r != JSON_EN_CURSO) ultimo = r;
+    }
+    return ultimo;
+}
+
+static unsigned int mutar(unsigned char *dst, const unsigned char *src, unsigned int len) {
+    static const char vocabulario[] = "{}[]\",: 0123456789aeiotgcrVT\r\n";
+    unsigned int n = len, cambios = 1 + azar() % 4, pos;
+
+    memcpy(dst, src, len);
+    while(cambios--) {
+        pos = n ? azar() % n : 0;
+        switch(azar() % 5) {
+            case 0: if(n) dst[pos] = (unsigned char)azar(); break;
+            case 1: if(n) dst[pos] = vocabulario[azar() % (sizeof(vocabulario) - 1)]; break;
+            case 2:
+                if(n < 511) {
+                    memmove(dst + pos + 1, dst + pos, n - pos);
+                    dst[pos] = vocabulario[azar() % (sizeof(vocabulario) - 1)];
+                    n++;
+                }
+                break;
+            case 3: if(n) { memmove(dst + pos, dst + pos + 1, n - pos - 1); n--; } break;
+            case 4: n = pos; break;
+        }
+    }
+    return n;
+}
+
+static int banco_parser(unsigned int iteraciones) {
+    unsigned char mutado[512];
+    unsigned long codigos[JSON_CODIGOS] = { 0 }, fallos = 0, bytes = 0;
+    unsigned int i, n;
+    unsigned char r;
+    double t;
+
+    // Throughput con la configuración válida
+    JSON_Reinicia();
+    t = segundos_pared();
+    for(i = 0; i < iteraciones; i++) {
+        if(alimentar((const unsigned char *)config, config_len) != JSON_COMPLETO) fallos++;
+    }
+    t = segundos_pared() - t;
+    printf("throughput: %u configs de %u bytes en %.3f s: %.1f MB/s, %.1f ns/byte\n",
+           iteraciones, config_len, t, t > 0 ? (double)iteraciones * config_len / t / 1e6 : 0,
+           iteraciones ? t * 1e9 / ((double)iteraciones * config_len) : 0);
+
+    // Fuzzing: tras cualquier entrada el parser debe resincronizar y aceptar
+    // la configuración válida, y un JSON_COMPLETO siempre debe validar
+    for(i = 0; i < iteraciones; i++) {
+        n = mutar(mutado, (const unsigned char *)config, config_len);
+        bytes += n;
+        r = alimentar(mutado, n);
+        if(r >= JSON_CODIGOS) {
+            fallos++;
+            continue;
+        }
+        codigos[r]++;
+        if(r == JSON_COMPLETO && !validarConfiguracion()) fallos++;
+
+        // Una entrada truncada deja un objeto abierto: el '{' siguiente lo descarta
+        if(alimentar((const unsigned char *)config, config_len) != JSON_COMPLETO ||
+           !validarConfiguracion()) fallos++;
+    }
+    printf("fuzz: %u entradas (%lu bytes), en curso %lu, completas %lu, sintaxis %lu, "
+           "clave %lu, valor %lu, array %lu, faltan %lu\n",
+           iteraciones, bytes, codigos[0], codigos[1], codigos[2], codigos[3],
+           codigos[4], codigos[5], codigos[6]);
+    printf("fallos: %lu\n", fallos);
+    return fallos ? 1 : 0;
+}
+
+// ============ BANCO DEL FORMATO NUMÉRICO ============
+// El host divide por hardware, así que el formato con / 10 y % 10 se mide
+// sobre una réplica de la división por software del runtime de XC8
+// (__lwdiv y __lwmod: alinear el divisor y restar bit a bit). Se cuentan
+// las vueltas de bucle, que son lo que cuesta en el PIC16; en el formato
+// BCD, los dígitos que recorre cada función.
+static unsigned long pasos;
+
+static uint16_t lwdiv(uint16_t dividendo, uint16_t divisor) {
+    uint16_t cociente = 0;
+    unsigned char contador = 1;
+
+    while(!(divisor & 0x8000)) {
+        divisor <<= 1;
+        contador++;
+        pasos++;
+    }
+    do {
+        cociente <<= 1;
+        if(divisor <= dividendo) {
+            dividendo -= divisor;
+            cociente |= 1;
+        }
+        divisor >>= 1;
+        pasos++;
+    } while(--contador);
+    return cociente;
+}
+
+static uint16_t lwmod(uint16_t dividendo, uint16_t divisor) {
+    unsigned char contador = 1;
+
+    while(!(divisor & 0x8000)) {
+        divisor <<= 1;
+        contador++;
+        pasos++;
+    }
+    do {
+        if(divisor <= dividendo) dividendo -= divisor;
+        divisor >>= 1;
+        pasos++;
+    } while(--contador);
+    return dividendo;
+}
+
+// enviar_telemetria antes de los contadores BCD
+static unsigned char formato_division(uint16_t val, char *texto) {
+    unsigned char n = 0, i;
+    char t;
+
+    do {
+        texto[n++] = '0' + lwmod(val, 10);
+        val = lwdiv(val, 10);
+    } while(val);
+    for(i = 0; i < n / 2; i++) {
+        t = texto[i];
+        texto[i] = texto[n - 1 - i];
+        texto[n - 1 - i] = t;
+    }
+    texto[n] = '\0';
+    return n;
+}
+
+static int banco_formato(unsigned int iteraciones) {
+    char esperado[8], texto[BCD_DIGITOS + 1];
+    ContadorBCD contador, convertido;
+    unsigned long fallos = 0, pasos_div, pasos_bcd = 0;
+    unsigned int v, i;
+    volatile unsigned char sumidero = 0;
+    double t_div, t_bcd;
+
+    // Corrección: incremental desde 0 y bcd_desde en todo el rango de 16 bits
+    bcd_cero(&contador);
+    for(v = 0; v <= 0xFFFF; v++) {
+        snprintf(esperado, sizeof(esperado), "%u", v);
+        bcd_texto(&contador, texto);
+        if(strcmp(texto, esperado)) fallos++;
+        bcd_desde(&convertido, v);
+        bcd_texto(&convertido, texto);
+        if(strcmp(texto, esperado)) fallos++;
+        formato_division((uint16_t)v, texto);
+        if(strcmp(texto, esperado)) fallos++;
+        bcd_incrementar(&contador);
+    }
+    printf("formato: 65536 valores x 3 caminos verificados, fallos %lu\n", fallos);
+
+    // Coste: contar de 0 a iteraciones - 1 formateando cada valor, como el
+    // score o la línea de telemetría
+    pasos = 0;
+    t_div = segundos_pared();
+    for(v = 0; v < iteraciones; v++) sumidero += formato_division((uint16_t)v, texto);
+    t_div = segundos_pared() - t_div;
+    pasos_div = pasos;
+
+    bcd_cero(&contador);
+    t_bcd = segundos_pared();
+    for(v = 0; v < iteraciones; v++) {
+        sumidero += bcd_texto(&contador, texto);
+        bcd_incrementar(&contador);
+    }
+    t_bcd = segundos_pared() - t_bcd;
+
+    // Pasos del BCD: bcd_texto recorre los 5 dígitos (saltar ceros y
+    // escribir) y bcd_incrementar uno más por cada acarreo
+    for(v = 0; v < iteraciones; v++) {
+        pasos_bcd += BCD_DIGITOS + 1;
+        for(i = v; i % 10 == 9; i /= 10) pasos_bcd++;
+    }
+
+    printf("división por software: %.1f pasos/valor, %.1f ns/valor en el host\n",
+           iteraciones ? (double)pasos_div / iteraciones : 0,
+           iteraciones ? t_div * 1e9 / iteraciones : 0);
+    printf("BCD: %.1f pasos/valor, %.1f ns/valor en el host (%.1fx menos pasos)\n",
+           iteraciones ? (double)pasos_bcd / iteraciones : 0,
+           iteraciones ? t_bcd * 1e9 / iteraciones : 0,
+           pasos_bcd ? (double)pasos_div / pasos_bcd : 0);
+    return fallos ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    double limite_s = 600, inicio, pared;
+    unsigned int banco = 0, banco_fmt = 0;
+    int opt;
+
+    strcpy(config, config_defecto);
+    config_len = strlen(config);
+
+    while((opt = getopt(argc, argv, "c:p:t:mvqbB:xs:g:r:e:kP:j:f:")) != -1) {
+        switch(opt) {
+            case 'c': cargar_config(optarg); break;
+            case 'p': partidas_objetivo = (unsigned int)atoi(optarg); break;
+            case 't': limite_s = atof(optarg); break;
+            case 'm': bot = 0; break;
+            case 'v': verboso = 1; break;
+            case 'q': silencioso = 1; break;
+            case 'b': binario = 1; break;
+            case 'B': baud_objetivo = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'x': baud_desvio = 1; break;
+            case 's': stream_pedido = (unsigned char)atoi(optarg); break;
+            case 'g': ruta_grabacion = optarg; break;
+            case 'r': ruta_repeticion = optarg; break;
+            case 'e': ruta_eeprom = optarg; break;
+            case 'k': ranuras = binario = 1; break;
+            case 'P': perfil_cada = (unsigned int)atoi(optarg); break;
+            case 'j': banco = (unsigned int)atoi(optarg); break;
+            case 'f': banco_fmt = (unsigned int)atoi(optarg); break;
+            default:
+                fprintf(stderr, "Uso: %s [-c config.json] [-p partidas] [-t segundos] [-m] [-v] [-q] [-b] [-B baudios [-x]] [-s divisor] [-g grabacion] [-r grabacion] [-e eeprom [-k]] [-P frames] [-j iteraciones] [-f iteraciones]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if(banco) return banco_parser(banco);
+    if(banco_fmt) return banco_formato(banco_fmt);
+    if(binario) construir_trama_config();
+    if(ruta_repeticion) {
+        cargar_grabacion(ruta_repeticion);
+        bot = 0;
+    }
+    if(ruta_eeprom) sim_eeprom_cargar(ruta_eeprom);
+
+    // El backend envía la configuración tras abrir el puerto
+    sim_alarma(NS_POR_S, baud_objetivo ? enviar_ping : preparar_partida);
+
+    inicio = segundos_pared();
+    sim_ejecutar(fin_frame, recibir_tx, (uint64_t)(limite_s * NS_POR_S));
+    pared = segundos_pared() - inicio;
+    fflush(stdout);
+    if(ruta_eeprom) sim_eeprom_guardar(ruta_eeprom);
+
+    fprintf(stderr,
+            "partidas: %u (victorias %u, derrotas %u), reintentos de config: %u\n"
+            "carga de config (%s, %u bytes): %.1f ms de media\n"
+            "tiempo simulado: %.3f s, tiempo real: %.3f s (x%.0f)\n"
+            "frames: %u (%.0f frames/s reales)\n"
+            "LCD: %u comandos, %u datos, %u violaciones de tiempo\n"
+            "LCD en juego: %.1f escrituras/frame (máx %u), espera activa %.0f us/frame\n"
+            "CGRAM: %u filas escritas, máx %u en un frame de juego, %u pantallas finales sin su sprite\n"
+            "botones: %u pulsaciones aplicadas, latencia media %.1f ms (máx %u ms), %u eventos perdidos\n"
+            "tick: %u ms, uso máx %u ms, overruns en la última partida: %u\n"
+            "UART: %u baudios (%u ecos fallidos, %u errores de trama), %u bytes TX (buffer máx %u), %u bytes RX\n"
+            "respuestas con secuencia inesperada: %u\n"
+            "CCP1: %u flancos de audio\n",
+            partidas, victorias, partidas - victorias, reintentos,
+            ranuras ? "binaria en ranura" : binario ? "binaria" : "JSON", binario ? trama_tx_len : config_len,
+            cargas ? carga_total_ns / 1e6 / cargas : 0,
+            sim_stats.reloj_ns / 1e9, pared, pared > 0 ? sim_stats.reloj_ns / 1e9 / pared : 0,
+            sim_stats.frames, pared > 0 ? sim_stats.frames / pared : 0,
+            sim_stats.lcd_comandos, sim_stats.lcd_datos, sim_stats.lcd_violaciones,
+            sim_stats.frames ? (double)lcd_escrituras_juego / sim_stats.frames : 0, lcdEscriturasMax,
+            sim_stats.frames ? sim_stats.espera_frame_ns / 1e3 / sim_stats.frames : 0,
+            cgramEscrituras, cgramFilasMax, finales_sin_sprite,
+            latenciaEventos, latenciaEventos ? (double)latenciaSumaMs / latenciaEventos : 0,
+            latenciaMaxMs, botonPerdidos,
+            periodoTickMs, tickUsoMaxMs, tickOverruns,
+            baud_final, baud_fallos, sim_stats.uart_errores_trama,
+            sim_stats.uart_tx_bytes, txOcupacionMax, sim_stats.uart_rx_bytes, seq_erroneas,
+            sim_stats.ccp1_comparaciones);
+
+    if(stream_pedido)
+        fprintf(stderr,
+                "telemetría en vivo: divisor %u, %u tramas (%u finales), %u huecos, %u omitidas en el PIC, "
+                "%u discrepancias con la línea JSON\n",
+                stream_divisor, tele_tramas, tele_finales, tele_huecos, streamOmitidas, tele_discrepancias);
+    if(perfil_cada && perfil_sin_soporte)
+        fprintf(stderr, "perfilado: el firmware no lo trae (make DEFS=-DPERFILADO=1)\n");
+    else if(perfil_cada && !perfil_informes)
+        fprintf(stderr, "perfilado: ningún informe (%u frames, uno cada %u)\n", perfil_frames, perfil_cada);
+    else if(perfil_cada)
+        imprimir_perfil(stderr);
+    if(ranuras || ruta_eeprom)
+        fprintf(stderr, "ranuras: %u arranques desde la EEPROM, %u subidas, %u rechazadas; "
+                "EEPROM: %u escrituras, %u accesos con una escritura en curso\n",
+                ranura_arranques, ranura_subidas, ranura_rechazos,
+                sim_stats.eeprom_escrituras, sim_stats.eeprom_violaciones);
+    if(ruta_repeticion)
+        fprintf(stderr, "repeticiones: %u, distintas de la grabación: %u, rechazadas por el PIC: %u\n",
+                repeticiones, repeticiones_distintas, repeticiones_rechazadas);
+
+    return partidas >= partidas_objetivo && !finales_sin_sprite ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+"""Banco de pruebas de routes/api.py contra PICs virtuales (pic_virtual.py).
+
+Cada proceso monta la app Flask en modo test con una flota de -d PICs
+virtuales (Config.SERIAL_PORTS apunta a sus enlaces) y, para cada uno y
+a la vez, por las rutas /devices/<device>/..., mide:
+
+  config      ida y vuelta de POST /send_config (p50/p95/máx y fallos)
+  telemetria  TRAMA_TELEMETRIA emitidas, recibidas por el lector y por
+              segundo, con la latencia de despacho y los descartes
+  reconexion  tiempo desde que el PIC vuelve tras un corte hasta que el
+              watchdog reabre el puerto y una configuración se carga
+
+Con -p N se lanzan N procesos en paralelo, cada uno con su flota, y se
+suman. Uso: python bench_serial.py [-d 16] [-p 2] [--configs 50] [--escenarios config,telemetria]
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+CONFIG_PRUEBA = {'character': [4, 10, 4, 14, 21, 4, 10, 17],
+                 'obstacle': [0, 4, 14, 31, 14, 4, 0, 0],
+                 'goalType': 'time', 'goalValue': 1}
+
+
+def resumen(muestras):
+    muestras = sorted(muestras)
+    if not muestras:
+        return {'count': 0}
+    return {'count': len(muestras),
+            'p50_ms': round(muestras[len(muestras) // 2], 1),
+            'p95_ms': round(muestras[min(len(muestras) - 1, len(muestras) * 95 // 100)], 1),
+            'max_ms': round(muestras[-1], 1)}
+
+
+def esperar(condicion, timeout, paso=0.005):
+    limite = time.monotonic() + timeout
+    while time.monotonic() < limite:
+        if condicion():
+            return True
+        time.sleep(paso)
+    return False
+
+
+def enviar_config(cliente, dispositivo, goal_value=1):
+    inicio = time.monotonic()
+    respuesta = cliente.post(f'/api/devices/{dispositivo.id}/send_config',
+                             json=dict(CONFIG_PRUEBA, goalValue=goal_value))
+    return respuesta.status_code == 200, (time.monotonic() - inicio) * 1000
+
+
+# ============ ESCENARIOS ============
+def escenario_config(cliente, pic, dispositivo, args, api):
+    """Configuraciones seguidas; cada una espera a que acabe la partida anterior.
+    La primera abre el puerto y negocia, así que se da aparte."""
+    latencias, fallos = [], 0
+    for _ in range(args.configs):
+        esperar(lambda: not pic.en_partida, 5)
+        ok, ms = enviar_config(cliente, dispositivo)
+        if ok:
+            latencias.append(ms)
+        else:
+            fallos += 1
+    return dict(resumen(latencias[1:]), first_ms=round(latencias[0], 1) if latencias else None,
+                failures=fallos)
+
+
+def escenario_telemetria(cliente, pic, dispositivo, args, api):
+    """Una partida con el tick acelerado y la línea sin limitar"""
+    esperar(lambda: not pic.en_partida, 5)
+    pic.perfil.tick, pic.baudios = args.tick_rapido, 0
+    emitidas, recibidas = pic.stats['tramas_tele'], dispositivo.live_seq
+    inicio = time.monotonic()
+    ok, _ = enviar_config(cliente, dispositivo, goal_value=args.segundos_juego)
+    esperar(lambda: not pic.en_partida, 60, 0.05)
+    # Lo que quede en el pty o en la cola del despachador
+    esperar(lambda: dispositivo.live_seq - recibidas >= pic.stats['tramas_tele'] - emitidas, 1)
+    duracion = time.monotonic() - inicio
+    emitidas = pic.stats['tramas_tele'] - emitidas
+    recibidas = dispositivo.live_seq - recibidas
+    pic.perfil.tick, pic.baudios = 0.110, pic.perfil.baudios
+    return {'config_ok': ok, 'emitted': emitidas, 'received': recibidas,
+            'frames_per_s': round(recibidas / duracion, 1), 'lost': emitidas - recibidas,
+            'dispatch_latency': dispositivo.estadisticas_latencia()}
+
+
+def escenario_reconexion(cliente, pic, dispositivo, args, api):
+    """Corta el pty, lo reabre y espera a que el backend se recupere solo"""
+    api.start_watchdog()
+    esperar(lambda: not pic.en_partida, 5)
+    anterior = dispositivo.ser
+    pic.desconectar()
+    time.sleep(args.corte)
+    pic.reconectar()
+    vuelta = time.monotonic()
+
+    reconectado = esperar(lambda: dispositivo.ser is not anterior and dispositivo.conectado(),
+                          args.timeout_reconexion, 0.05)
+    t_puerto = (time.monotonic() - vuelta) * 1000
+    cargada = False
+    while not cargada and time.monotonic() - vuelta < args.timeout_reconexion:
+        esperar(lambda: not pic.en_partida, 5)
+        cargada, _ = enviar_config(cliente, dispositivo)
+    return {'reconnected': reconectado, 'port_reopened_ms': round(t_puerto, 1),
+            'config_loaded': cargada, 'config_loaded_ms': round((time.monotonic() - vuelta) * 1000, 1),
+            'disconnections': dispositivo.estado['disconnection_count']}
+
+
+ESCENARIOS = {'config': escenario_config, 'telemetria': escenario_telemetria,
+              'reconexion': escenario_reconexion}
+
+
+def ejecutar(args, indice):
+    """Una flota de PICs virtuales y una instancia del backend en este proceso"""
+    sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+    import pic_virtual
+    from config import Config
+
+    base = os.path.join(tempfile.gettempdir(), f'pic_bench_{os.getpid()}')
+    pics = [pic_virtual.PicVirtual(f'{base}_{i}', pic_virtual.Perfil(
+        latencia=args.latencia, jitter=args.jitter, prob_perdida=args.perdida,
+        prob_corrupcion=args.corrupcion, binario=not args.json), semilla=indice * 1000 + i)
+        for i in range(args.dispositivos)]
+    Config.SERIAL_PORTS = [pic.enlace for pic in pics]
+    Config.TELEMETRY_DB = f'{base}.db'
+    import app as aplicacion
+    from routes import api
+
+    resultados = [{'pic': f'{indice}.{i}'} for i in range(len(pics))]
+
+    def correr(pic, resultado):
+        cliente = aplicacion.app.test_client()
+        dispositivo = api.flota.obtener(pic.enlace)
+        for escenario in args.escenarios.split(','):
+            resultado[escenario] = ESCENARIOS[escenario](cliente, pic, dispositivo, args, api)
+        resultado['pic_stats'] = dict(pic.stats)
+
+    try:
+        hilos = [threading.Thread(target=correr, args=(pic, resultado))
+                 for pic, resultado in zip(pics, resultados)]
+        for hilo in hilos:
+            hilo.start()
+        for hilo in hilos:
+            hilo.join()
+    finally:
+        for pic in pics:
+            pic.cerrar()
+        for sufijo in ('', '-wal', '-shm'):
+            if os.path.exists(Config.TELEMETRY_DB + sufijo):
+                os.unlink(Config.TELEMETRY_DB + sufijo)
+    return {'proceso': indice, 'select_loops': api.flota.nucleo.vueltas, 'pics': resultados}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Banco de pruebas del backend con PICs virtuales')
+    parser.add_argument('-d', '--dispositivos', type=int, default=1, help='PICs por proceso')
+    parser.add_argument('-p', '--procesos', type=int, default=1)
+    parser.add_argument('--escenarios', default='config,telemetria,reconexion')
+    parser.add_argument('--configs', type=int, default=20)
+    parser.add_argument('--tick-rapido', type=float, default=0.001, help='tick del escenario de telemetría')
+    parser.add_argument('--segundos-juego', type=int, default=60, help='meta de la partida de telemetría')
+    parser.add_argument('--corte', type=float, default=0.5, help='segundos sin PIC en la reconexión')
+    parser.add_argument('--timeout-reconexion', type=float, default=30)
+    parser.add_argument('--latencia', type=float, default=0.002)
+    parser.add_argument('--jitter', type=float, default=0.0)
+    parser.add_argument('--perdida', type=float, default=0.0)
+    parser.add_argument('--corrupcion', type=float, default=0.0)
+    parser.add_argument('--json', action='store_true', help='PIC sin protocolo binario')
+    parser.add_argument('--hijo', type=int, help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.hijo is not None:
+        # Los logs del backend van a stderr; stdout solo lleva el resultado
+        salida, sys.stdout = sys.stdout, sys.stderr
+        resultado = ejecutar(args, args.hijo)
+        salida.write(json.dumps(resultado) + '\n')
+        return
+
+    hijos = [subprocess.Popen([sys.executable, os.path.abspath(__file__), *sys.argv[1:], '--hijo', str(i)],
+                              stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+             for i in range(args.procesos)]
+    resultados = []
+    for hijo in hijos:
+        salida, _ = hijo.communicate()
+        if hijo.returncode != 0 or not salida.strip():
+            print(f'[BENCH] ✗ Proceso {hijo.args[-1]} terminó con código {hijo.returncode}')
+            continue
+        resultados += json.loads(salida.strip().splitlines()[-1])['pics']
+
+    for resultado in resultados:
+        print(json.dumps(resultado, ensure_ascii=False))
+    if len(resultados) > 1 and all('config' in r for r in resultados):
+        p95 = sorted(r['config'].get('p95_ms', 0) for r in resultados)
+        print(f"[BENCH] config p95 entre {len(resultados)} PICs: mediana {p95[len(p95) // 2]} ms, "
+              f"máx {p95[-1]} ms, "
+              f"fallos: {sum(r['config']['failures'] for r in resultados)}")
+    if len(resultados) > 1 and all('telemetria' in r for r in resultados):
+        print(f"[BENCH] telemetría total: {sum(r['telemetria']['frames_per_s'] for r in resultados):.0f} tramas/s, "
+              f"perdidas: {sum(r['telemetria']['lost'] for r in resultados)}")
+
+
+if __name__ == '__main__':
+    main()
@@ -2,5 +2,37 @@ class Config:
     DEBUG = True
     SECRET_KEY = 'dev-secret-key'
     SERIAL_PORT = 'COM3'
+    # Flota: puertos de todos los PICs (vacío = solo SERIAL_PORT). El
+    # primero es el de las rutas sin /devices/<device>.
+    SERIAL_PORTS = []
     SERIAL_BAUDRATE = 9600
-    SERIAL_TIMEOUT = 5
\ No newline at end of file
+    SERIAL_TIMEOUT = 5
+    # Espera tras abrir el puerto (el FT232BL no está listo al instante)
+    SERIAL_SETTLE = 3
+    # Protocolo de configuración: 'auto' (negociado), 'binario' o 'json'
+    CONFIG_PROTOCOL = 'auto'
+    PROTOCOL_PING_TIMEOUT = 0.5
+    BINARY_ACK_TIMEOUT = 2
+    # Guardar las configuraciones en las ranuras de la EEPROM del PIC y
+    # arrancar las ya guardadas sin volver a subirlas (solo binario)
+    CONFIG_SLOTS = True
+    JSON_ACK_TIMEOUT = 2
+    # Velocidad máxima a negociar tras el ping (SERIAL_BAUDRATE = sin subir)
+    SERIAL_BAUDRATE_MAX = 115200
+    BAUD_ECO_TIMEOUT = 0.3
+    PIC_BAUD_PLAZO = 1.1
+    # Telemetría en vivo: una trama cada N ticks de 110 ms (0 = solo al final)
+    TELEMETRY_STREAM_DIVISOR = 1
+    LIVE_TELEMETRY_HISTORY = 600
+    # Mensajes pendientes por suscriptor del lector serial
+    SUBSCRIBER_QUEUE_SIZE = 256
+    # Mensajes sin petición de toda la flota pendientes de despachar
+    FLEET_QUEUE_SIZE = 4096
+    # Sondeo de los puertos sin fileno() (pyserial en Windows), en segundos
+    NUCLEO_SONDEO = 0.005
+    # /api/events (SSE): eventos que se pueden retomar, reintento y keepalive
+    SSE_HISTORY = 1000
+    SSE_RETRY_MS = 2000
+    SSE_KEEPALIVE = 15
+    # Historial de partidas (SQLite); relativo a la carpeta del backend
+    TELEMETRY_DB = 'telemetry.db'
\ No newline at end of file
@@ -0,0 +1,803 @@
+"""Flota de PICs: un Dispositivo por puerto serie y un único núcleo de E/S.
+
+NucleoSerial es un solo thread que espera con selectors sobre todos los
+puertos abiertos: lee lo que haya en cada uno, lo decodifica y entrega las
+respuestas a los comandos que las esperan, y vacía la cola de salida de
+cada puerto cuando admite escritura. Cada dispositivo cuesta un
+descriptor más en el select, no un thread bloqueado y un lock. Si el
+puerto no tiene fileno() (pyserial en Windows) el mismo thread lo sondea
+cada NUCLEO_SONDEO segundos.
+
+Los threads de Flask nunca leen ni escriben el puerto: encolan la trama
+con escribir() y esperan la respuesta por su secuencia. Los mensajes sin
+petición (telemetría, líneas JSON) van a un despachador común, que
+actualiza el estado del dispositivo fuera del núcleo.
+"""
+
+import json
+import os
+import queue
+import selectors
+import socket
+import threading
+import time
+from collections import deque
+
+import serial
+
+try:
+    from .config import Config
+    from . import protocol
+except ImportError:
+    from config import Config
+    import protocol
+
+
+def percentiles_ms(muestras):
+    muestras = sorted(muestras)
+    if not muestras:
+        return {'count': 0}
+    return {
+        'count': len(muestras),
+        'mean_ms': round(sum(muestras) / len(muestras), 3),
+        'p50_ms': round(muestras[len(muestras) // 2], 3),
+        'p95_ms': round(muestras[min(len(muestras) - 1, len(muestras) * 95 // 100)], 3),
+        'max_ms': round(muestras[-1], 3)
+    }
+
+
+class Dispositivo:
+    """Un PIC en un puerto: conexión, protocolo negociado, comandos en vuelo y telemetría"""
+
+    def __init__(self, flota, puerto):
+        self.flota = flota
+        self.puerto = puerto
+        self.id = os.path.basename(puerto.rstrip('/\\')) or puerto
+        self.ser = None
+        self.estado = {
+            'is_connected': False,
+            'last_check': None,
+            'disconnection_count': 0,
+            'reconnection_attempts': 0
+        }
+        self.abriendo = threading.Lock()
+
+        # Telemetría: la última partida y las muestras de la partida en curso
+        self.latest_telemetry = None
+        self.live_telemetry = deque(maxlen=Config.LIVE_TELEMETRY_HISTORY)
+        self.live_seq = 0
+
+        # Protocolo negociado (None = sin negociar) y divisor de telemetría
+        # aceptado; se repiten al reabrir el puerto
+        self.pic_protocolo = None
+        self.pic_stream = None
+        self.config_actual_hash = None
+        self.config_lock = threading.Lock()
+
+        # Hashes de las ranuras de la EEPROM del PIC (None = sin pedir, [] =
+        # firmware sin ranuras) y último uso de cada una para reemplazarlas
+        self.pic_slots = None
+        self.uso_slots = {}
+
+        # Comandos en vuelo por secuencia: {'tipo' (de respuesta), 'evento',
+        # 'carga', 'enviado'}; el núcleo los resuelve al llegar la respuesta
+        self.comandos_pendientes = {}
+        self.comandos_lock = threading.Lock()
+        self.ultimo_seq = 0
+        self.latencias_comando = {}
+        self.comandos_sin_respuesta = {}
+        self.espera_json = None
+
+        # Lado del núcleo: cola de salida, resto de una escritura parcial y decodificador
+        self.salida = deque()
+        self.resto_tx = b''
+        self.decodificador = protocol.DecodificadorMensajes()
+
+        # Suscriptores a los mensajes sin petición de este PIC
+        self.suscriptores = []
+        self.suscriptores_lock = threading.Lock()
+        self.mensajes_descartados = 0
+        self.latencias_despacho = deque(maxlen=1000)
+
+    def log(self, texto):
+        print(f"[{self.id}] {texto}")
+
+    # ============ CONEXIÓN ============
+    def conectado(self):
+        try:
+            return self.ser is not None and self.ser.is_open
+        except Exception:
+            return False
+
+    def marcar_conexion(self, conectado):
+        """Actualiza estado y publica el cambio si lo hay"""
+        if self.estado['is_connected'] != conectado:
+            self.estado['is_connected'] = conectado
+            self.flota.publicar(self, 'connection', {'connected': conectado, 'port': self.puerto})
+
+    def abrir(self):
+        """Abre el puerto y lo entrega al núcleo. False si no se pudo."""
+        with self.abriendo:
+            self.cerrar(marcar=False)
+            self.pic_protocolo = None
+            self.pic_stream = None
+            self.pic_slots = None
+            try:
+                # timeout = 0: el núcleo solo lee lo que el select dice que hay
+                puerto = serial.Serial(
+                    port=self.puerto,
+                    baudrate=Config.SERIAL_BAUDRATE,
+                    timeout=0,
+                    write_timeout=0,
+                    bytesize=serial.EIGHTBITS,
+                    parity=serial.PARITY_NONE,
+                    stopbits=serial.STOPBITS_ONE,
+                    xonxoff=False,
+                    rtscts=False,
+                    dsrdtr=False
+                )
+                # El FT232BL necesita un momento tras abrir
+                time.sleep(Config.SERIAL_SETTLE)
+                puerto.reset_input_buffer()
+                puerto.reset_output_buffer()
+            except serial.SerialException as e:
+                self.marcar_conexion(False)
+                self.log(f"✗ Error al abrir puerto serial: {e}")
+                return False
+
+            self.ser = puerto
+            self.salida.clear()
+            self.resto_tx = b''
+            self.decodificador = protocol.DecodificadorMensajes()
+            self.flota.nucleo.registrar(self)
+            self.marcar_conexion(True)
+            self.log(f"✓ Puerto serial {self.puerto} conectado")
+            return True
+
+    def cerrar(self, marcar=True):
+        puerto, self.ser = self.ser, None
+        if puerto is not None:
+            self.flota.nucleo.quitar(puerto)
+            try:
+                puerto.close()
+            except (serial.SerialException, OSError):
+                pass
+        if marcar:
+            self.marcar_conexion(False)
+
+    def perdido(self, puerto, error):
+        """Llamado por el núcleo: el dispositivo dejó de responder (cable fuera, EIO)"""
+        if puerto is not self.ser:
+            return
+        self.estado['disconnection_count'] += 1
+        self.log(f"✗ Error: {error} (desconexión #{self.estado['disconnection_count']})")
+        self.cerrar()
+
+    # ============ SALIDA ============
+    def escribir(self, datos):
+        """Encola datos para el núcleo; no bloquea"""
+        if not self.conectado():
+            raise serial.SerialException(f'{self.puerto} no está abierto')
+        self.salida.append(bytes(datos))
+        self.flota.nucleo.avisar_escritura(self)
+
+    def vaciar_salida(self, timeout=1.0):
+        """Espera a que el núcleo escriba lo encolado y a que salga por la línea"""
+        limite = time.monotonic() + timeout
+        while (self.salida or self.resto_tx) and time.monotonic() < limite:
+            time.sleep(0.001)
+        if self.conectado():
+            self.ser.flush()
+
+    # ============ COMANDOS ============
+    def siguiente_seq(self):
+        """Secuencia para una petición nueva: 1..255 (0 la usa el PIC para tramas ilegibles)"""
+        with self.comandos_lock:
+            self.ultimo_seq = self.ultimo_seq % 255 + 1
+            return self.ultimo_seq
+
+    def enviar_comando(self, construir, tipo_respuesta, timeout):
+        """Encola construir(seq) y espera la respuesta con esa secuencia.
+        Devuelve la carga o None si vence el timeout."""
+        seq = self.siguiente_seq()
+        pendiente = {'tipo': tipo_respuesta, 'evento': threading.Event(), 'carga': None,
+                     'enviado': time.monotonic()}
+        with self.comandos_lock:
+            self.comandos_pendientes[seq] = pendiente
+        try:
+            self.escribir(construir(seq))
+            if not pendiente['evento'].wait(timeout):
+                self.comandos_sin_respuesta[tipo_respuesta] = self.comandos_sin_respuesta.get(tipo_respuesta, 0) + 1
+                return None
+            return pendiente['carga']
+        finally:
+            with self.comandos_lock:
+                self.comandos_pendientes.pop(seq, None)
+
+    def resolver_comando(self, carga, recibido):
+        """Entrega una respuesta del PIC al comando que la espera. False si nadie la espera."""
+        with self.comandos_lock:
+            pendiente = self.comandos_pendientes.get(carga[1])
+            if carga[1] == 0 and carga[0] == protocol.TRAMA_ACK:
+                # Trama ilegible para el PIC: falla la config más antigua en vuelo
+                pendiente = next((p for _, p in sorted(self.comandos_pendientes.items())
+                                  if p['tipo'] == protocol.TRAMA_ACK), None)
+            if pendiente is None or pendiente['tipo'] != carga[0]:
+                return False
+            pendiente['carga'] = carga
+        self.latencias_comando.setdefault(carga[0], deque(maxlen=200)).append(
+            (recibido - pendiente['enviado']) * 1000)
+        pendiente['evento'].set()
+        return True
+
+    def resolver_linea_estado(self, linea):
+        """Entrega una respuesta JSON ({"status":...}) a quien envió la config en JSON"""
+        espera = self.espera_json
+        if espera is None or espera['evento'].is_set():
+            return False
+        espera['linea'] = linea
+        espera['evento'].set()
+        return True
+
+    # ============ ENTRADA (desde el núcleo) ============
+    def recibir(self, datos, recibido):
+        for tipo, contenido in self.decodificador.alimentar(datos):
+            if tipo == 'trama' and protocol.es_respuesta(contenido) and self.resolver_comando(contenido, recibido):
+                continue
+            if tipo == 'linea' and contenido.startswith('{"status":') and self.resolver_linea_estado(contenido):
+                continue
+            self.flota.despachar(self, {'tipo': tipo, 'datos': contenido, 'recibido': recibido})
+
+    def suscribir(self):
+        """Cola que recibirá cada mensaje sin petición de este PIC a partir de ahora"""
+        cola = queue.Queue(maxsize=Config.SUBSCRIBER_QUEUE_SIZE)
+        with self.suscriptores_lock:
+            self.suscriptores.append(cola)
+        return cola
+
+    def cancelar_suscripcion(self, cola):
+        with self.suscriptores_lock:
+            if cola in self.suscriptores:
+                self.suscriptores.remove(cola)
+
+    def entregar_suscriptores(self, mensaje):
+        """Entrega el mensaje a todas las colas; si una está llena pierde el más viejo"""
+        with self.suscriptores_lock:
+            colas = list(self.suscriptores)
+        for cola in colas:
+            try:
+                cola.put_nowait(mensaje)
+            except queue.Full:
+                try:
+                    cola.get_nowait()
+                    self.mensajes_descartados += 1
+                except queue.Empty:
+                    pass
+                cola.put_nowait(mensaje)
+
+    # ============ TELEMETRÍA (desde el despachador) ============
+    def procesar_mensaje(self, mensaje):
+        self.latencias_despacho.append((time.monotonic() - mensaje['recibido']) * 1000)
+        if mensaje['tipo'] == 'trama':
+            self.registrar_muestra_vivo(mensaje['datos'])
+            return
+
+        linea = mensaje['datos']
+        if not linea.startswith('{"obstacles"'):
+            return
+        try:
+            datos = json.loads(linea)
+            if 'obstacles' in datos and 'time' in datos and 'result' in datos:
+                result = datos['result'].lower()
+                telemetria = {
+                    'obstacles_avoided': int(datos['obstacles']),
+                    'survival_time': int(datos['time']),
+                    'result': 'victory' if result in ['win', 'victory'] else 'defeat',
+                    'timestamp': time.strftime('%Y-%m-%d %H:%M:%S')
+                }
+                # Semilla de la partida (firmware con PRNG reproducible)
+                if 'seed' in datos:
+                    telemetria['seed'] = int(datos['seed'])
+                self.registrar_partida(telemetria, 'serial')
+                self.log(f"✓ Telemetría recibida: {self.latest_telemetry}")
+            else:
+                self.log(f"⚠️ JSON incompleto: {linea}")
+        except (json.JSONDecodeError, ValueError) as e:
+            self.log(f"✗ Error: {e}")
+
+    def registrar_partida(self, telemetria, source):
+        """Fin de partida (por la UART o por HTTP): evento y historial en disco"""
+        self.latest_telemetry = telemetria
+        self.flota.publicar(self, 'telemetry', telemetria)
+        self.flota.guardar(self, telemetria, source)
+
+    def registrar_muestra_vivo(self, carga):
+        """Añade una TRAMA_TELEMETRIA a live_telemetry; otras tramas se ignoran"""
+        muestra = protocol.decodificar_telemetria(carga)
+        if muestra is None:
+            return
+        # Una partida nueva empieza en el tick 1 (o en el primer múltiplo del divisor)
+        vivo = self.live_telemetry
+        if vivo and vivo[-1]['tick'] >= muestra['tick'] and not muestra['finished']:
+            vivo.clear()
+        self.live_seq += 1
+        muestra['seq'] = self.live_seq
+        vivo.append(muestra)
+        self.flota.publicar(self, 'live', muestra)
+
+    # ============ NEGOCIACIÓN ============
+    def negociar_baudios(self, mascara):
+        """Sube a la velocidad más alta que supere la prueba de eco"""
+        for indice in protocol.baudios_ofrecidos(mascara, Config.SERIAL_BAUDRATE_MAX):
+            if protocol.BAUDIOS[indice] <= self.ser.baudrate:
+                break
+            if self.probar_baudios(indice):
+                return True
+        return False
+
+    def probar_baudios(self, indice):
+        """Pide al PIC la velocidad indice y la comprueba con un eco"""
+        baudios = protocol.BAUDIOS[indice]
+        anterior = self.ser.baudrate
+
+        carga = self.enviar_comando(lambda seq: protocol.trama_baud(seq, indice),
+                                    protocol.TRAMA_BAUD_ACK, Config.PROTOCOL_PING_TIMEOUT)
+        if carga is None or len(carga) < 3 or carga[2] != indice:
+            self.log(f"[PROTOCOLO] El PIC no aceptó {baudios} baudios")
+            return False
+
+        # El ACK ya llegó entero: el PIC cambia en cuanto vacía su TX
+        time.sleep(0.01)
+        self.ser.baudrate = baudios
+        carga = self.enviar_comando(protocol.trama_eco, protocol.TRAMA_ECO_RESP, Config.BAUD_ECO_TIMEOUT)
+        if carga is not None and carga[2:] == protocol.ECO_PATRON:
+            self.log(f"[PROTOCOLO] ✓ Enlace a {baudios} baudios")
+            return True
+
+        # Si el PIC recibió el eco ya confirmó la velocidad y hay que pedirle
+        # la anterior; si no, vuelve solo al vencer su plazo
+        self.log(f"[PROTOCOLO] ✗ Eco fallido a {baudios} baudios, se vuelve a {anterior}")
+        self.escribir(protocol.trama_baud(self.siguiente_seq(), protocol.BAUDIOS.index(anterior)))
+        self.vaciar_salida()
+        time.sleep(0.05)
+        self.ser.baudrate = anterior
+        time.sleep(Config.PIC_BAUD_PLAZO)
+        return False
+
+    def negociar_protocolo(self):
+        """Pregunta al PIC si entiende tramas binarias"""
+        if Config.CONFIG_PROTOCOL != 'auto':
+            return Config.CONFIG_PROTOCOL
+        if self.pic_protocolo is not None:
+            return self.pic_protocolo
+
+        carga = self.enviar_comando(protocol.trama_ping, protocol.TRAMA_PONG, Config.PROTOCOL_PING_TIMEOUT)
+        if carga is not None and len(carga) >= 4:
+            self.pic_protocolo = 'binario'
+            self.log(f"[PROTOCOLO] ✓ PIC con protocolo binario v{carga[2]}")
+            self.negociar_baudios(carga[3])
+            return self.pic_protocolo
+
+        # Sin respuesta: JSON para este envío. No se guarda, porque el PIC
+        # puede estar ocupado en una pantalla final.
+        self.log("[PROTOCOLO] PIC sin respuesta al ping, se usa JSON")
+        return 'json'
+
+    def activar_stream(self):
+        """Pide la telemetría en vivo si aún no está activa"""
+        if self.pic_stream == Config.TELEMETRY_STREAM_DIVISOR:
+            return
+        carga = self.enviar_comando(lambda seq: protocol.trama_stream(seq, Config.TELEMETRY_STREAM_DIVISOR),
+                                    protocol.TRAMA_STREAM_ACK, Config.PROTOCOL_PING_TIMEOUT)
+        if carga is None or len(carga) < 3:
+            self.log("[PROTOCOLO] ✗ El PIC no confirmó la telemetría en vivo")
+            return
+        # Se guarda lo pedido para no repetirlo; el PIC puede haber subido el
+        # divisor si la trama no cabe a esta velocidad
+        self.pic_stream = Config.TELEMETRY_STREAM_DIVISOR
+        self.log(f"[PROTOCOLO] ✓ Telemetría en vivo cada {carga[2]} ticks")
+
+    # ============ CONFIGURACIÓN ============
+    def esperar_ack_config(self, construir, ranura=None, guardada=False):
+        """Envía construir(seq) y espera su TRAMA_ACK. Devuelve (ok, mensaje,
+        respuesta, código); código es None si vence el timeout."""
+        inicio = time.monotonic()
+        carga = self.enviar_comando(construir, protocol.TRAMA_ACK, Config.BINARY_ACK_TIMEOUT)
+        ida_vuelta = round((time.monotonic() - inicio) * 1000, 1)
+
+        if carga is None:
+            # El PIC pudo reiniciarse y volver a 9600: renegociar en el próximo envío
+            self.pic_protocolo = None
+            self.pic_stream = None
+            self.pic_slots = None
+            if self.conectado():
+                self.ser.baudrate = Config.SERIAL_BAUDRATE
+            return False, "El PIC no respondió (timeout)", None, None
+
+        codigo = carga[2] if len(carga) >= 3 else 0
+        if codigo == protocol.ACK_OK:
+            detalle = {'status': 'loaded', 'protocol': 'binary', 'round_trip_ms': ida_vuelta}
+            if ranura is not None:
+                detalle.update(slot=ranura, from_slot=guardada)
+                self.uso_slots[ranura] = time.monotonic()
+            origen = f"desde la ranura {ranura}" if guardada else "binario"
+            self.log(f"[SEND_CONFIG] ✓ ACK {origen} en {ida_vuelta} ms")
+            return True, "Configuración cargada exitosamente", json.dumps(detalle), codigo
+        error = protocol.ACK_ERRORES.get(codigo, f'código {codigo}')
+        respuesta = json.dumps({'status': 'error', 'code': codigo, 'round_trip_ms': ida_vuelta})
+        self.log(f"[SEND_CONFIG] ✗ El PIC rechazó la trama: {error}")
+        return False, f"El PIC rechazó la configuración: {error}", respuesta, codigo
+
+    def leer_slots(self, forzar=False):
+        """Hashes de las ranuras del PIC; se piden una vez por conexión"""
+        if self.pic_slots is not None and not forzar:
+            return self.pic_slots
+        carga = self.enviar_comando(protocol.trama_slots, protocol.TRAMA_SLOTS_RESP,
+                                    Config.PROTOCOL_PING_TIMEOUT)
+        # Un firmware sin ranuras responde TRAMA_ACK 8, que nadie espera: vence el timeout
+        self.pic_slots = protocol.hashes_slots(carga) if carga is not None else []
+        if not self.pic_slots:
+            self.log("[SLOTS] El PIC no tiene ranuras de configuración")
+        return self.pic_slots
+
+    def elegir_slot(self):
+        """Una ranura vacía o, si no queda ninguna, la usada hace más tiempo"""
+        if protocol.SLOT_VACIO in self.pic_slots:
+            return self.pic_slots.index(protocol.SLOT_VACIO)
+        return min(range(len(self.pic_slots)), key=lambda r: self.uso_slots.get(r, 0))
+
+    def enviar_config_binaria(self, data):
+        """Envía la configuración y espera su ACK. Si el PIC ya la tiene en una
+        ranura solo se le pide que la arranque; si no, se sube a una ranura."""
+        if not Config.CONFIG_SLOTS or not self.leer_slots():
+            return self.esperar_ack_config(lambda seq: protocol.trama_config(seq, data))[:3]
+
+        hash_nivel = protocol.hash_nivel(data)
+        if hash_nivel in self.pic_slots:
+            ranura = self.pic_slots.index(hash_nivel)
+            *resultado, codigo = self.esperar_ack_config(
+                lambda seq: protocol.trama_jugar_slot(seq, ranura), ranura, guardada=True)
+            if codigo != protocol.ACK_SLOT_INVALIDA:
+                return tuple(resultado)
+            # La EEPROM no tiene lo que se creía (escritura cortada): se sube a esa ranura
+            self.log(f"[SLOTS] La ranura {ranura} no valida, se vuelve a subir")
+        else:
+            ranura = self.elegir_slot()
+
+        *resultado, codigo = self.esperar_ack_config(
+            lambda seq: protocol.trama_config(seq, data, ranura), ranura)
+        if codigo == protocol.ACK_OK and self.pic_slots:
+            self.pic_slots[ranura] = hash_nivel
+        return tuple(resultado)
+
+    def enviar_config_json(self, data):
+        """Envía la configuración como una línea JSON y espera {"status":...}"""
+        json_str = json.dumps(data, separators=(',', ':'))
+        espera = {'evento': threading.Event(), 'linea': None}
+        inicio = time.monotonic()
+        self.espera_json = espera
+        try:
+            self.log(f"[SEND_CONFIG] → Enviando: {json_str}")
+            self.escribir(json_str.encode('ascii'))
+            espera['evento'].wait(Config.JSON_ACK_TIMEOUT)
+        finally:
+            self.espera_json = None
+
+        linea = espera['linea']
+        if linea is None:
+            return False, "El PIC no respondió (timeout)", None
+        self.log(f"[SEND_CONFIG] ← {linea} ({(time.monotonic() - inicio) * 1000:.1f} ms)")
+        if linea.startswith('{"status":"loaded"'):
+            return True, "Configuración cargada exitosamente", linea
+        return False, f"El PIC rechazó la configuración: {linea}", linea
+
+    def enviar_config(self, data):
+        """Envía la configuración al PIC y espera confirmación.
+        config_lock solo impide dos envíos a la vez al mismo PIC."""
+        if not self.conectado() and not self.abrir():
+            return False, "Puerto serial no disponible", None
+        try:
+            with self.config_lock:
+                if self.negociar_protocolo() == 'binario':
+                    self.activar_stream()
+                    return self.enviar_config_binaria(data)
+                return self.enviar_config_json(data)
+        except serial.SerialTimeoutException:
+            return False, "Timeout al enviar datos", None
+        except (serial.SerialException, OSError) as e:
+            return False, f"Error en comunicación serial: {str(e)}", None
+
+    def consultar_slots(self):
+        """Hashes de las ranuras leídos del PIC en este momento"""
+        def consultar():
+            slots = self.leer_slots(forzar=True)
+            if not slots:
+                return False, "El PIC no tiene ranuras de configuración", None
+            return True, "Ranuras leídas", [
+                {'slot': i, 'hash': f'{h:04x}', 'empty': h == protocol.SLOT_VACIO} for i, h in enumerate(slots)]
+        return self.con_protocolo_binario(consultar)
+
+    def leer_perfil(self, reiniciar=False):
+        """Informe de perfilado del firmware (PERFILADO=1); se puede pedir en plena partida.
+        Con reiniciar, la última trama pone los contadores a cero."""
+        def volcar():
+            fases, informe, total = {}, {}, None
+            while total is None or len(fases) < total:
+                desde = len(fases)
+                ultima = total is not None and desde + protocol.PERF_POR_TRAMA >= total
+                carga = self.enviar_comando(
+                    lambda seq: protocol.trama_perfil(seq, desde, reiniciar and ultima),
+                    protocol.TRAMA_PERFIL_RESP, Config.PROTOCOL_PING_TIMEOUT)
+                if carga is None or len(carga) < 7:
+                    return False, "El PIC no respondió (¿firmware sin PERFILADO?)", None
+                total, informe, trozo = protocol.fases_perfil(carga)
+                if not trozo:
+                    break
+                fases.update(trozo)
+            return True, "Perfil leído", dict(informe, phases=fases)
+        return self.con_protocolo_binario(volcar)
+
+    # ============ GRABACIÓN DE ENTRADAS ============
+    def con_protocolo_binario(self, operacion):
+        """operacion() con el puerto abierto y el PIC en binario, bajo config_lock"""
+        if not self.conectado() and not self.abrir():
+            return False, "Puerto serial no disponible", None
+        try:
+            with self.config_lock:
+                if self.negociar_protocolo() != 'binario':
+                    return False, "El PIC no usa el protocolo binario", None
+                return operacion()
+        except serial.SerialTimeoutException:
+            return False, "Timeout al enviar datos", None
+        except (serial.SerialException, OSError) as e:
+            return False, f"Error en comunicación serial: {str(e)}", None
+
+    def leer_grabacion(self):
+        """Vuelca la grabación de la última partida (o de la que está en curso)"""
+        def volcar():
+            entradas, desde = bytearray(), 0
+            while True:
+                carga = self.enviar_comando(lambda seq: protocol.trama_grabacion(seq, desde),
+                                            protocol.TRAMA_GRABACION_RESP, Config.PROTOCOL_PING_TIMEOUT)
+                if carga is None or len(carga) < 7:
+                    return False, "El PIC no respondió (timeout)", None
+                estado, total, trozo = carga[2], carga[3], carga[7:]
+                entradas[carga[6]:carga[6] + len(trozo)] = trozo
+                desde = carga[6] + len(trozo)
+                if trozo and desde < total:
+                    continue
+                entradas = bytes(entradas[:total])
+                return True, "Grabación leída", {
+                    'seed': carga[4] << 8 | carga[5],
+                    'inputs': entradas.hex(),
+                    'truncated': bool(estado & protocol.GRAB_TRUNCADA),
+                    'in_progress': bool(estado & protocol.GRAB_EN_CURSO),
+                    'actions': protocol.acciones_grabacion(entradas)
+                }
+        return self.con_protocolo_binario(volcar)
+
+    def cargar_repeticion(self, seed, entradas):
+        """Sube una grabación; la siguiente partida del PIC la juega en lugar de los botones"""
+        def subir():
+            desde = 0
+            while True:
+                trozo = entradas[desde:desde + protocol.GRAB_TROZO]
+                carga = self.enviar_comando(
+                    lambda seq: protocol.trama_repetir(seq, len(entradas), seed, desde, trozo),
+                    protocol.TRAMA_REPETIR_ACK, Config.BINARY_ACK_TIMEOUT)
+                if carga is None or len(carga) < 3:
+                    return False, "El PIC no respondió (timeout)", None
+                desde += len(trozo)
+                if carga[2] == protocol.ACK_OK:
+                    self.log(f"[REPETICIÓN] ✓ {len(entradas)} bytes de entradas, semilla {seed}")
+                    return True, "Repetición armada para la próxima partida", None
+                if carga[2] != protocol.ACK_EN_CURSO or desde >= len(entradas):
+                    error = protocol.ACK_ERRORES.get(carga[2], f'código {carga[2]}')
+                    return False, f"El PIC rechazó la repetición: {error}", None
+        return self.con_protocolo_binario(subir)
+
+    # ============ ESTADÍSTICAS ============
+    def estadisticas_latencia(self):
+        """Latencia de recepción a despacho en ms sobre las últimas muestras"""
+        return dict(percentiles_ms(list(self.latencias_despacho)), dropped=self.mensajes_descartados)
+
+    def estadisticas_comandos(self):
+        """Tiempo de ida y vuelta por tipo de respuesta, en ms"""
+        resultado = {}
+        for tipo, muestras in list(self.latencias_comando.items()):
+            resultado[f'0x{tipo:02X}'] = dict(percentiles_ms(list(muestras)),
+                                              timeouts=self.comandos_sin_respuesta.get(tipo, 0))
+        return resultado
+
+    def resumen(self):
+        conectado = self.conectado()
+        return {
+            'id': self.id,
+            'port': self.puerto,
+            'connected': conectado,
+            'baudrate': self.ser.baudrate if conectado else None,
+            'protocol': self.pic_protocolo,
+            'config_hash': self.config_actual_hash,
+            'disconnections': self.estado['disconnection_count']
+        }
+
+
+class NucleoSerial:
+    """Un thread para todos los puertos: select sobre sus descriptores"""
+
+    def __init__(self):
+        self.selector = selectors.DefaultSelector()
+        # Despierta al select cuando otro thread encola escritura o cambia puertos
+        self.aviso_r, self.aviso_w = socket.socketpair()
+        self.aviso_r.setblocking(False)
+        self.aviso_w.setblocking(False)
+        self.selector.register(self.aviso_r, selectors.EVENT_READ, None)
+        self.cambios = deque()
+        self.sondeo = {}            # Puertos sin fileno(): puerto -> dispositivo
+        self.thread = None
+        self.vueltas = 0
+
+    def iniciar(self):
+        if self.thread is None:
+            self.thread = threading.Thread(target=self._bucle, daemon=True)
+            self.thread.start()
+
+    def activo(self):
+        return self.thread is not None and self.thread.is_alive()
+
+    def _avisar(self):
+        try:
+            self.aviso_w.send(b'\x00')
+        except (BlockingIOError, OSError):
+            pass    # Ya hay un aviso pendiente
+
+    def registrar(self, dispositivo):
+        self.cambios.append(('registrar', dispositivo.ser, dispositivo))
+        self._avisar()
+
+    def quitar(self, puerto):
+        self.cambios.append(('quitar', puerto, None))
+        self._avisar()
+
+    def avisar_escritura(self, dispositivo):
+        self.cambios.append(('escribir', dispositivo.ser, dispositivo))
+        self._avisar()
+
+    # ============ THREAD ============
+    def _aplicar_cambios(self):
+        while self.cambios:
+            operacion, puerto, dispositivo = self.cambios.popleft()
+            if puerto is None:
+                continue
+            if operacion == 'quitar':
+                self.sondeo.pop(puerto, None)
+                try:
+                    self.selector.unregister(puerto)
+                except (KeyError, ValueError, OSError):
+                    pass
+            elif operacion == 'registrar':
+                try:
+                    puerto.fileno()
+                    self.selector.register(puerto, selectors.EVENT_READ, dispositivo)
+                except (AttributeError, ValueError, KeyError, OSError):
+                    self.sondeo[puerto] = dispositivo
+            elif operacion == 'escribir' and puerto not in self.sondeo:
+                try:
+                    self.selector.modify(puerto, selectors.EVENT_READ | selectors.EVENT_WRITE, dispositivo)
+                except (KeyError, ValueError, OSError):
+                    pass
+
+    def _bucle(self):
+        while True:
+            self.vueltas += 1
+            eventos = self.selector.select(Config.NUCLEO_SONDEO if self.sondeo else None)
+            recibido = time.monotonic()
+            for clave, mascara in eventos:
+                dispositivo = clave.data
+                if dispositivo is None:
+                    try:
+                        while self.aviso_r.recv(4096):
+                            pass
+                    except (BlockingIOError, OSError):
+                        pass
+                    continue
+                puerto = clave.fileobj
+                if mascara & selectors.EVENT_READ:
+                    self._leer(dispositivo, puerto, recibido)
+                if mascara & selectors.EVENT_WRITE and puerto is dispositivo.ser:
+                    self._escribir(dispositivo, puerto)
+            self._aplicar_cambios()
+            for puerto, dispositivo in list(self.sondeo.items()):
+                self._leer(dispositivo, puerto, recibido)
+                self._escribir(dispositivo, puerto)
+
+    def _leer(self, dispositivo, puerto, recibido):
+        try:
+            datos = puerto.read(puerto.in_waiting or 1)
+        except (serial.SerialException, OSError, TypeError) as e:
+            self.quitar(puerto)
+            self._aplicar_cambios()
+            dispositivo.perdido(puerto, e)
+            return
+        if datos:
+            dispositivo.recibir(datos, recibido)
+
+    def _escribir(self, dispositivo, puerto):
+        """Escribe lo que admita el puerto sin bloquear; el resto espera al próximo select"""
+        try:
+            while dispositivo.resto_tx or dispositivo.salida:
+                if not dispositivo.resto_tx:
+                    dispositivo.resto_tx = dispositivo.salida.popleft()
+                n = puerto.write(dispositivo.resto_tx) or 0
+                dispositivo.resto_tx = dispositivo.resto_tx[n:]
+                if dispositivo.resto_tx:
+                    return
+            if puerto not in self.sondeo:
+                self.selector.modify(puerto, selectors.EVENT_READ, dispositivo)
+        except serial.SerialTimeoutException:
+            return
+        except (serial.SerialException, OSError, KeyError, ValueError) as e:
+            self.quitar(puerto)
+            self._aplicar_cambios()
+            dispositivo.perdido(puerto, e)
+
+
+class Flota:
+    """Registro de dispositivos por puerto, con un núcleo y un despachador comunes"""
+
+    def __init__(self, publicar, guardar):
+        self.publicar_evento = publicar
+        self.guardar_partida = guardar
+        self.dispositivos = {}
+        self.lock = threading.Lock()
+        self.nucleo = NucleoSerial()
+        self.nucleo.iniciar()
+        self.cola = queue.Queue(maxsize=Config.FLEET_QUEUE_SIZE)
+        self.descartados = 0
+        threading.Thread(target=self._despachador, daemon=True).start()
+
+    # ============ REGISTRO ============
+    def agregar(self, puerto):
+        with self.lock:
+            if puerto not in self.dispositivos:
+                self.dispositivos[puerto] = Dispositivo(self, puerto)
+            return self.dispositivos[puerto]
+
+    def quitar(self, dispositivo):
+        with self.lock:
+            self.dispositivos.pop(dispositivo.puerto, None)
+        dispositivo.cerrar()
+
+    def obtener(self, clave):
+        """Por puerto ('COM3', '/dev/ttyUSB0') o por id ('ttyUSB0'); None si no está"""
+        with self.lock:
+            if clave in self.dispositivos:
+                return self.dispositivos[clave]
+            return next((d for d in self.dispositivos.values() if d.id == clave), None)
+
+    def todos(self):
+        with self.lock:
+            return list(self.dispositivos.values())
+
+    # ============ MENSAJES ============
+    def publicar(self, dispositivo, tipo, datos):
+        self.publicar_evento(tipo, datos, dispositivo.id)
+
+    def guardar(self, dispositivo, telemetria, source):
+        self.guardar_partida(telemetria, source, dispositivo.config_actual_hash, dispositivo.id)
+
+    def despachar(self, dispositivo, mensaje):
+        """Desde el núcleo: a los suscriptores del PIC y al despachador común"""
+        dispositivo.entregar_suscriptores(mensaje)
+        try:
+            self.cola.put_nowait((dispositivo, mensaje))
+        except queue.Full:
+            self.descartados += 1
+
+    def _despachador(self):
+        while True:
+            dispositivo, mensaje = self.cola.get()
+            try:
+                dispositivo.procesar_mensaje(mensaje)
+            except Exception as e:
+                dispositivo.log(f"✗ Error al procesar {mensaje['tipo']}: {e}")
@@ -0,0 +1,409 @@
+"""PIC virtual sobre un pseudoterminal para probar el backend sin hardware.
+
+Abre un par pty y habla el protocolo del firmware por el extremo maestro:
+configuración JSON ({"status":"loaded"...} o {"status":"error"...}),
+tramas binarias v3 (PING, BAUD, ECO, STREAM, CONFIG) y, tras cada
+configuración, una partida que emite TRAMA_TELEMETRIA cada divisor ticks
+y la línea {"obstacles":...} final.
+
+El backend abre `enlace`, un symlink al esclavo actual: desconectar()
+cierra el pty como si se desenchufara el cable y reconectar() abre otro y
+mueve el enlace. Perfil ajusta tiempos, jitter y fallos.
+
+Uso: python pic_virtual.py [-n 4] [--enlace /tmp/pic] [--tick 0.11] ...
+"""
+
+import argparse
+import json
+import os
+import random
+import select
+import threading
+import time
+import tty
+
+try:
+    from . import protocol
+except ImportError:
+    import protocol
+
+
+class Perfil:
+    """Tiempos y fallos del PIC virtual (segundos y probabilidades 0..1)"""
+
+    def __init__(self, **valores):
+        self.latencia = 0.002           # Proceso de cada petición en el PIC
+        self.jitter = 0.0               # Se suma uniforme en [0, jitter] a cada espera
+        self.baudios = 9600             # Ritmo de salida (0 = sin limitar)
+        self.tick = 0.110               # Periodo del tick de juego
+        self.ticks_por_obstaculo = 8    # Cada cuántos ticks se esquiva uno
+        self.prob_victoria = 0.5
+        self.prob_perdida = 0.0         # Respuesta o trama que no sale
+        self.prob_corrupcion = 0.0      # Byte alterado en una trama o línea
+        self.binario = True             # Responde al PING (False = firmware solo JSON)
+        self.mascara_baudios = 0x03     # 9600 y 19200, como el PIC a 4 MHz
+        self.perfilado = False          # Contesta TRAMA_PERFIL (firmware con PERFILADO=1)
+        for clave, valor in valores.items():
+            if not hasattr(self, clave):
+                raise TypeError(f'Perfil sin campo {clave}')
+            setattr(self, clave, valor)
+
+
+class LectorPic(protocol.LectorTramas):
+    """Separa tramas y objetos JSON (de '{' a su '}') en lo que escribe el backend"""
+
+    JSON_MAX = 256
+
+    def __init__(self):
+        super().__init__()
+        self.profundidad = 0
+        self.objetos = []
+
+    def byte_texto(self, byte):
+        if byte == ord('{'):
+            if self.profundidad == 0:
+                self.texto = bytearray()
+            self.profundidad += 1
+        if self.profundidad == 0:
+            return
+        if len(self.texto) < self.JSON_MAX:
+            self.texto.append(byte)
+        if byte == ord('}'):
+            self.profundidad -= 1
+            if self.profundidad == 0:
+                self.objetos.append(self.tomar_texto())
+
+
+class PicVirtual:
+    def __init__(self, enlace=None, perfil=None, semilla=None):
+        self.enlace = enlace
+        self.perfil = perfil or Perfil()
+        self.azar = random.Random(semilla)
+        self.escritura_lock = threading.Lock()
+        self.estado_lock = threading.Lock()
+        self.maestro = None
+        self.esclavo = None
+        self.puerto = None
+        self.conectado = False
+        self.conexion = 0               # Cambia con cada pty para que el lector viejo salga
+        self.en_partida = False
+        self.stream_divisor = 0
+        self.grabacion = b''            # El jugador virtual no pulsa: la grabación solo llega por TRAMA_REPETIR
+        self.grabacion_semilla = 0
+        self.repeticion_armada = False
+        self.slots = [None] * 8         # EEPROM: 21 bytes por ranura, sobreviven a reconectar
+        # [máx, n, suma] en µs por fase de FASES_PERFIL. Solo se mide de
+        # verdad la de UART; las del tick cuentan muestras con coste 0
+        self.perf = [[0, 0, 0] for _ in protocol.FASES_PERFIL]
+        self.baudios = self.perfil.baudios    # Cambia con TRAMA_BAUD
+        self.partida = 0                # Cambia con cada partida para cortar la anterior
+        self.stats = {'configs': 0, 'partidas': 0, 'tramas_tele': 0, 'respuestas': 0,
+                      'perdidas': 0, 'corruptas': 0, 'desconexiones': 0, 'bytes_tx': 0}
+        self.reconectar()
+
+    # ============ CONEXIÓN ============
+    def reconectar(self):
+        """Abre un pty nuevo y apunta el enlace a su esclavo"""
+        self.desconectar(contar=False)
+        self.maestro, self.esclavo = os.openpty()
+        tty.setraw(self.maestro)
+        tty.setraw(self.esclavo)
+        self.puerto = os.ttyname(self.esclavo)
+        if self.enlace:
+            temporal = f'{self.enlace}.{os.getpid()}.tmp'
+            if os.path.lexists(temporal):
+                os.unlink(temporal)
+            os.symlink(self.puerto, temporal)
+            os.replace(temporal, self.enlace)
+        self.conectado = True
+        self.conexion += 1
+        self.en_partida = False
+        self.baudios = self.perfil.baudios
+        threading.Thread(target=self._lector, args=(self.maestro, self.conexion), daemon=True).start()
+
+    def desconectar(self, contar=True):
+        """Cierra el pty: el backend ve EIO como con el cable fuera"""
+        if not self.conectado:
+            return
+        self.conectado = False
+        self.partida += 1
+        for fd in (self.maestro, self.esclavo):
+            try:
+                os.close(fd)
+            except OSError:
+                pass
+        if contar:
+            self.stats['desconexiones'] += 1
+
+    def cerrar(self):
+        self.desconectar(contar=False)
+        if self.enlace and os.path.islink(self.enlace):
+            os.unlink(self.enlace)
+
+    # ============ SALIDA ============
+    def _esperar(self, base):
+        time.sleep(base + self.azar.uniform(0, self.perfil.jitter))
+
+    def _escribir(self, datos, texto=False):
+        """Escribe al ritmo de la línea serie, con los fallos del perfil"""
+        if self.azar.random() < self.perfil.prob_perdida:
+            self.stats['perdidas'] += 1
+            return
+        if self.azar.random() < self.perfil.prob_corrupcion:
+            datos = bytearray(datos)
+            # En una trama se respetan los delimitadores 0x00
+            i = self.azar.randrange(len(datos)) if texto else self.azar.randrange(1, len(datos) - 1)
+            datos[i] = (datos[i] ^ (1 << self.azar.randrange(8))) or 0x01
+            self.stats['corruptas'] += 1
+        with self.escritura_lock:
+            if not self.conectado:
+                return
+            if self.baudios:
+                time.sleep(len(datos) * 10 / self.baudios)
+            try:
+                os.write(self.maestro, bytes(datos))
+                self.stats['bytes_tx'] += len(datos)
+            except OSError:
+                pass
+
+    def _trama(self, carga):
+        self._escribir(protocol.construir_trama(bytes(carga)))
+
+    def _linea(self, texto):
+        self._escribir((texto + '\r\n').encode('ascii'), texto=True)
+
+    # ============ ENTRADA ============
+    def _lector(self, maestro, conexion):
+        lector = LectorPic()
+        while self.conectado and conexion == self.conexion:
+            # Sin read() bloqueante: mientras un thread lo espera, close()
+            # no libera el pty y el backend no ve el corte
+            try:
+                if not select.select([maestro], [], [], 0.1)[0]:
+                    continue
+                datos = os.read(maestro, 256)
+            except OSError:
+                # EIO mientras el backend no tiene abierto el esclavo
+                time.sleep(0.01)
+                continue
+            if not datos:
+                continue
+            for carga in lector.alimentar(datos):
+                self._procesar_trama(carga)
+            objetos, lector.objetos = lector.objetos, []
+            for objeto in objetos:
+                self._procesar_json(objeto)
+
+    def _procesar_trama(self, carga):
+        self._esperar(self.perfil.latencia)
+        inicio = time.perf_counter()
+        try:
+            self._responder_trama(carga)
+        finally:
+            self._perf_fase(len(protocol.FASES_PERFIL) - 1, (time.perf_counter() - inicio) * 1e6)
+
+    def _perf_fase(self, fase, us):
+        p = self.perf[fase]
+        us = min(int(us), 0xFFFF)
+        p[0] = max(p[0], us)
+        # n de 8 bits y suma de 16, como en el firmware
+        while p[1] == 0xFF or p[2] + us > 0xFFFF:
+            p[1], p[2] = p[1] >> 1, p[2] >> 1
+        p[1], p[2] = p[1] + 1, p[2] + us
+
+    def _responder_trama(self, carga):
+        if len(carga) < 2:
+            self._trama([protocol.TRAMA_ACK, 0, 7])
+            return
+        tipo, seq, datos = carga[0], carga[1], carga[2:]
+        self.stats['respuestas'] += 1
+        if tipo == protocol.TRAMA_PING and self.perfil.binario:
+            self._trama([protocol.TRAMA_PONG, seq, protocol.PROTOCOLO_VERSION, self.perfil.mascara_baudios])
+        elif tipo == protocol.TRAMA_BAUD and len(datos) == 1:
+            aceptado = datos[0] < len(protocol.BAUDIOS) and self.perfil.mascara_baudios & (1 << datos[0])
+            self._trama([protocol.TRAMA_BAUD_ACK, seq, datos[0] if aceptado else protocol.BAUD_RECHAZADO])
+            if aceptado and self.perfil.baudios:
+                self.baudios = protocol.BAUDIOS[datos[0]]
+        elif tipo == protocol.TRAMA_ECO:
+            self._trama(bytes([protocol.TRAMA_ECO_RESP, seq]) + datos)
+        elif tipo == protocol.TRAMA_STREAM and len(datos) == 1:
+            self.stream_divisor = datos[0]
+            self._trama([protocol.TRAMA_STREAM_ACK, seq, datos[0]])
+        elif tipo == protocol.TRAMA_GRABACION and len(datos) == 1:
+            trozo = self.grabacion[datos[0]:datos[0] + protocol.GRAB_TROZO]
+            estado = protocol.GRAB_EN_CURSO if self.en_partida else 0
+            self._trama(bytes([protocol.TRAMA_GRABACION_RESP, seq, estado, len(self.grabacion),
+                               self.grabacion_semilla >> 8, self.grabacion_semilla & 0xFF, datos[0]]) + trozo)
+        elif tipo == protocol.TRAMA_REPETIR and len(datos) >= 4:
+            total, desde, entradas = datos[0], datos[3], datos[4:]
+            if self.en_partida:
+                codigo = 9
+            elif total > protocol.GRABACION_MAX or desde + len(entradas) > total:
+                codigo = 4
+            else:
+                grabacion = bytearray(self.grabacion[:total].ljust(total, b'\0'))
+                grabacion[desde:desde + len(entradas)] = entradas
+                self.grabacion = bytes(grabacion)
+                self.grabacion_semilla = datos[1] << 8 | datos[2] or 1
+                self.repeticion_armada = desde + len(entradas) == total
+                codigo = protocol.ACK_OK if self.repeticion_armada else protocol.ACK_EN_CURSO
+            self._trama([protocol.TRAMA_REPETIR_ACK, seq, codigo])
+        elif tipo == protocol.TRAMA_SLOTS:
+            hashes = [protocol.crc16(d) if d else protocol.SLOT_VACIO for d in self.slots]
+            self._trama(bytes([protocol.TRAMA_SLOTS_RESP, seq, len(hashes)]) +
+                        b''.join(bytes([h >> 8, h & 0xFF]) for h in hashes))
+        elif tipo == protocol.TRAMA_PERFIL and len(datos) == 1 and self.perfil.perfilado:
+            fase = min(datos[0] & ~protocol.PERF_REINICIA, len(self.perf))
+            respuesta = bytearray([protocol.TRAMA_PERFIL_RESP, seq, fase, len(self.perf), 0, 0, 0])
+            for maximo, n, suma in self.perf[fase:fase + protocol.PERF_POR_TRAMA]:
+                respuesta += bytes([maximo >> 8, maximo & 0xFF, n, suma >> 8, suma & 0xFF])
+            self._trama(bytes(respuesta))
+            if datos[0] & protocol.PERF_REINICIA:
+                self.perf = [[0, 0, 0] for _ in protocol.FASES_PERFIL]
+        elif tipo == protocol.TRAMA_JUGAR_SLOT and len(datos) == 1:
+            if self.en_partida or datos[0] >= len(self.slots):
+                self._trama([protocol.TRAMA_ACK, seq, 9 if self.en_partida else 4])
+            elif self.slots[datos[0]] is None:
+                self._trama([protocol.TRAMA_ACK, seq, protocol.ACK_SLOT_INVALIDA])
+            else:
+                self._config_binaria(seq, self.slots[datos[0]])
+        elif tipo == protocol.TRAMA_CONFIG and len(datos) in (19, 21, 22):
+            if len(datos) == 22 and datos[21] >= len(self.slots):
+                self._trama([protocol.TRAMA_ACK, seq, 4])
+            elif self._config_binaria(seq, datos[:21]) and len(datos) == 22:
+                self.slots[datos[21]] = bytes(datos[:21])
+        elif self.perfil.binario:
+            self._trama([protocol.TRAMA_ACK, seq, 8])
+
+    def _config_binaria(self, seq, datos):
+        """character, obstacle, goalType, goalValue y seed opcional. True si empieza la partida."""
+        if self.en_partida:
+            self._trama([protocol.TRAMA_ACK, seq, 9])
+            return False
+        goal_type, goal_value = datos[16], datos[17] << 8 | datos[18]
+        seed = datos[19] << 8 | datos[20] if len(datos) == 21 else 0
+        if not (goal_type <= 1 and 0 < goal_value < 1000):
+            self._trama([protocol.TRAMA_ACK, seq, 4])
+            return False
+        self._empezar_partida(goal_type, goal_value, seed,
+                              lambda: self._trama([protocol.TRAMA_ACK, seq, protocol.ACK_OK]))
+        return True
+
+    def _procesar_json(self, texto):
+        self._esperar(self.perfil.latencia)
+        if self.en_partida:
+            return
+        try:
+            config = json.loads(texto)
+        except ValueError:
+            self._linea('{"status":"error","code":2}')
+            return
+        if not isinstance(config, dict) or not {'character', 'obstacle', 'goalType', 'goalValue'} <= set(config) or \
+                not set(config) <= {'character', 'obstacle', 'goalType', 'goalValue', 'seed'}:
+            self._linea('{"status":"error","code":6}')
+            return
+        goal_type = protocol.GOAL_TYPES.get(config['goalType'])
+        goal_value = config['goalValue']
+        seed = config.get('seed', 0)
+        if goal_type is None or not isinstance(goal_value, int) or not 0 < goal_value < 1000 or \
+                not isinstance(seed, int) or not 0 <= seed <= 0xFFFF:
+            self._linea('{"status":"error","code":4}')
+            return
+        self._empezar_partida(goal_type, goal_value, seed, lambda: self._linea(
+            '{"status":"loaded","character":"ok","obstacle":"ok","goal":"ok"}'))
+
+    # ============ PARTIDA ============
+    def _empezar_partida(self, goal_type, goal_value, seed, confirmar):
+        """La partida ya está en curso cuando sale la confirmación, como en el firmware"""
+        self.stats['configs'] += 1
+        if self.repeticion_armada:
+            seed, self.repeticion_armada = self.grabacion_semilla, False
+        else:
+            seed = seed or self.azar.randint(1, 0xFFFF)
+            self.grabacion, self.grabacion_semilla = b'', seed
+        with self.estado_lock:
+            self.partida += 1
+            self.en_partida = True
+            partida = self.partida
+        confirmar()
+        threading.Thread(target=self._jugar, args=(partida, goal_type, goal_value, seed), daemon=True).start()
+
+    def _jugar(self, partida, goal_type, goal_value, seed):
+        """Una partida: gana al llegar a la meta o pierde en un tick al azar.
+        Con seed el resultado se repite, como la secuencia de obstáculos en el firmware."""
+        p = self.perfil
+        azar = random.Random(seed)
+        ticks_meta = goal_value * 1000 // 110 if goal_type == 0 else goal_value * p.ticks_por_obstaculo
+        victoria = azar.random() < p.prob_victoria
+        ticks = ticks_meta if victoria else azar.randint(1, max(1, ticks_meta))
+        inicio = time.monotonic()
+        tick = esquivados = 0
+
+        while tick < ticks and partida == self.partida:
+            tick += 1
+            for fase in range(len(protocol.FASES_PERFIL) - 1):
+                self._perf_fase(fase, 0)
+            if tick % p.ticks_por_obstaculo == 0:
+                esquivados += 1
+            divisor = self.stream_divisor
+            if divisor and tick % divisor == 0 and tick < ticks:
+                self._telemetria(tick, 0, esquivados, tick * 110 // 1000)
+            # Ritmo fijo como el Timer2: los ticks no acumulan el retraso
+            espera = inicio + tick * p.tick - time.monotonic()
+            if espera > 0:
+                time.sleep(espera + self.azar.uniform(0, p.jitter))
+
+        if partida != self.partida:
+            return
+        segundos = tick * 110 // 1000
+        if self.stream_divisor:
+            estado = protocol.TELE_FIN | (protocol.TELE_VICTORIA if victoria else 0)
+            self._telemetria(tick, estado, esquivados, segundos)
+        self._linea(f'{{"obstacles":{esquivados},"time":{segundos},"result":"{"win" if victoria else "lose"}",'
+                    f'"seed":{seed}}}')
+        self.stats['partidas'] += 1
+        self.en_partida = False
+
+    def _telemetria(self, tick, estado, esquivados, segundos):
+        self.stats['tramas_tele'] += 1
+        self._trama([protocol.TRAMA_TELEMETRIA, tick >> 8 & 0xFF, tick & 0xFF, estado,
+                     esquivados >> 8, esquivados & 0xFF, segundos >> 8, segundos & 0xFF])
+
+
+def main():
+    parser = argparse.ArgumentParser(description='PICs virtuales en pseudoterminales')
+    parser.add_argument('-n', type=int, default=1, help='número de PICs')
+    parser.add_argument('--enlace', default='/tmp/pic_virtual',
+                        help='prefijo de los symlinks (se añade el índice si n > 1)')
+    parser.add_argument('--json', action='store_true', help='firmware sin protocolo binario')
+    parser.add_argument('--semilla', type=int)
+    perfil = Perfil()
+    for campo in ('latencia', 'jitter', 'tick', 'prob_victoria', 'prob_perdida', 'prob_corrupcion'):
+        parser.add_argument('--' + campo.replace('_', '-'), type=float, default=getattr(perfil, campo))
+    parser.add_argument('--baudios', type=int, default=perfil.baudios)
+    args = parser.parse_args()
+
+    pics = []
+    for i in range(args.n):
+        enlace = args.enlace if args.n == 1 else f'{args.enlace}{i}'
+        pic = PicVirtual(enlace, Perfil(latencia=args.latencia, jitter=args.jitter, tick=args.tick,
+                                        prob_victoria=args.prob_victoria, prob_perdida=args.prob_perdida,
+                                        prob_corrupcion=args.prob_corrupcion, baudios=args.baudios,
+                                        binario=not args.json),
+                         None if args.semilla is None else args.semilla + i)
+        pics.append(pic)
+        print(f'[PIC_VIRTUAL] {enlace} -> {pic.puerto}')
+    try:
+        while True:
+            time.sleep(10)
+            for i, pic in enumerate(pics):
+                print(f'[PIC_VIRTUAL] #{i}: {pic.stats}')
+    except KeyboardInterrupt:
+        pass
+    finally:
+        for pic in pics:
+            pic.cerrar()
+
+
+if __name__ == '__main__':
+    main()
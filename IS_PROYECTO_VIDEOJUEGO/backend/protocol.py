@@ -0,0 +1,370 @@
+"""Protocolo binario de configuración con el PIC.
+
+Trama: 0x00, COBS(tipo, datos..., CRC-16 big endian), 0x00.
+CRC-16/CCITT-FALSE (polinomio 0x1021, valor inicial 0xFFFF). Debe
+coincidir con la sección PROTOCOLO BINARIO de Videojuego.c.
+
+Cambio de velocidad: el PONG lleva una máscara de BAUDIOS que el PIC
+genera con error < 2 %. TRAMA_BAUD se confirma a la velocidad vieja y
+la nueva se prueba con TRAMA_ECO; si el eco no llega en 1 s el PIC
+vuelve solo a 9600.
+
+Desde la v3 cada petición lleva tras el tipo un número de secuencia
+(1..255) que la respuesta repite; el PIC responde con 0 a las tramas que
+no puede leer. TRAMA_TELEMETRIA llega sin petición y no lo lleva.
+
+Grabación de entradas: el PIC guarda lo que hizo el jugador en cada tick
+de la última partida (un byte por cambio de fila, con los ticks sin
+acción delante). TRAMA_GRABACION la vuelca en trozos y TRAMA_REPETIR la
+sube para que la siguiente partida la juegue con su semilla.
+
+Ranuras de configuración: el PIC guarda en su EEPROM SLOTS configuraciones
+con el formato de TRAMA_CONFIG con semilla y su CRC-16 como hash
+(hash_nivel). Una TRAMA_CONFIG con un byte de ranura al final se guarda en
+ella; TRAMA_SLOTS devuelve los hashes y TRAMA_JUGAR_SLOT arranca una
+ranura sin volver a subirla (responde TRAMA_ACK, 10 si la ranura no valida).
+
+Perfilado: con el firmware compilado con PERFILADO=1, TRAMA_PERFIL devuelve
+los contadores del scheduler y, de FASES_PERFIL desde la fase pedida y hasta
+dos por trama, máx(2), n(1) y suma(2) en µs, big-endian. n y suma se dividen
+a la vez entre 2 para no desbordar: suma / n es la media, pero n no cuenta
+ticks. Sin PERFILADO responde TRAMA_ACK 8.
+"""
+
+TRAMA_CONFIG = 0x01
+TRAMA_PING = 0x02
+TRAMA_BAUD = 0x03
+TRAMA_ECO = 0x04
+TRAMA_STREAM = 0x05
+TRAMA_GRABACION = 0x06
+TRAMA_REPETIR = 0x07
+TRAMA_SLOTS = 0x08
+TRAMA_JUGAR_SLOT = 0x09
+TRAMA_PERFIL = 0x0A
+TRAMA_ACK = 0x81
+TRAMA_PONG = 0x82
+TRAMA_BAUD_ACK = 0x83
+TRAMA_ECO_RESP = 0x84
+TRAMA_STREAM_ACK = 0x85
+TRAMA_GRABACION_RESP = 0x86
+TRAMA_REPETIR_ACK = 0x87
+TRAMA_SLOTS_RESP = 0x88
+TRAMA_PERFIL_RESP = 0x89
+TRAMA_TELEMETRIA = 0x90
+
+# Bits del campo estado de TRAMA_TELEMETRIA
+TELE_FILA = 0x01
+TELE_GENERADO = 0x02
+TELE_FILA_GENERADO = 0x04
+TELE_FIN = 0x08
+TELE_VICTORIA = 0x10
+
+# Grabación de entradas (GRABACIÓN Y REPETICIÓN DE ENTRADAS en el firmware)
+GRABACION_MAX = 32
+GRAB_TROZO = 16
+GRAB_SALTA = 0x80
+GRAB_ESPERA = 0x7F
+GRAB_TRUNCADA = 0x01
+GRAB_EN_CURSO = 0x02
+
+# Ranuras de configuración (RANURAS DE CONFIGURACIÓN EN EEPROM en el firmware)
+SLOT_VACIO = 0xFFFF
+
+# Perfilado (PERF_* en el firmware, mismo orden)
+FASES_PERFIL = ['logic', 'render', 'score', 'uart']    # logic: entrada, generación, desplazamiento y colisión
+PERF_POR_TRAMA = 2
+PERF_REINICIA = 0x80
+
+PROTOCOLO_VERSION = 3
+
+# Mismo orden que spbrgBaudios en el firmware
+BAUDIOS = [9600, 19200, 38400, 57600, 115200]
+BAUD_RECHAZADO = 0xFF
+# Incluye 0x00 y patrones alternos, que son los que fallan con desajuste
+ECO_PATRON = bytes([0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0x01, 0x80])
+
+# Códigos de TRAMA_ACK y TRAMA_REPETIR_ACK (JSON_* en el firmware)
+ACK_EN_CURSO = 0
+ACK_OK = 1
+ACK_SLOT_INVALIDA = 10
+ACK_ERRORES = {
+    2: 'error de sintaxis',
+    3: 'clave desconocida',
+    4: 'valor fuera de rango',
+    5: 'array de longitud incorrecta',
+    6: 'faltan campos',
+    7: 'CRC o COBS inválido',
+    8: 'trama desconocida',
+    9: 'el PIC está en una partida',
+    10: 'ranura vacía o dañada',
+}
+
+GOAL_TYPES = {'time': 0, 'obstacles': 1}
+
+
+def crc16(datos, crc=0xFFFF):
+    """CRC-16/CCITT-FALSE"""
+    for byte in datos:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_encode(datos):
+    salida = bytearray()
+    bloque = bytearray()
+    for byte in datos:
+        if byte == 0:
+            salida.append(len(bloque) + 1)
+            salida += bloque
+            bloque = bytearray()
+        else:
+            bloque.append(byte)
+            if len(bloque) == 254:
+                salida.append(255)
+                salida += bloque
+                bloque = bytearray()
+    salida.append(len(bloque) + 1)
+    salida += bloque
+    return bytes(salida)
+
+
+def cobs_decode(datos):
+    """Devuelve los datos decodificados o None si la codificación no es válida"""
+    salida = bytearray()
+    i = 0
+    while i < len(datos):
+        codigo = datos[i]
+        i += 1
+        if codigo == 0 or i + codigo - 1 > len(datos):
+            return None
+        salida += datos[i:i + codigo - 1]
+        i += codigo - 1
+        if codigo != 0xFF and i < len(datos):
+            salida.append(0)
+    return bytes(salida)
+
+
+def construir_trama(carga):
+    crc = crc16(carga)
+    return b'\x00' + cobs_encode(bytes(carga) + bytes([crc >> 8, crc & 0xFF])) + b'\x00'
+
+
+def decodificar_trama(cuerpo):
+    """cuerpo: bytes entre dos 0x00. Devuelve la carga sin CRC o None"""
+    datos = cobs_decode(cuerpo)
+    if datos is None or len(datos) < 3:
+        return None
+    if crc16(datos[:-2]) != (datos[-2] << 8 | datos[-1]):
+        return None
+    return datos[:-2]
+
+
+def es_respuesta(carga):
+    """Las respuestas a peticiones tienen el bit alto y llevan secuencia"""
+    return len(carga) >= 2 and carga[0] & 0x80 != 0 and carga[0] != TRAMA_TELEMETRIA
+
+
+def datos_nivel(data):
+    """Los 19 bytes de una configuración sin seed: character, obstacle, goalType, goalValue"""
+    goal_value = int(data['goalValue'])
+    return bytes(int(v) & 0xFF for v in data['character']) + \
+        bytes(int(v) & 0xFF for v in data['obstacle']) + \
+        bytes([GOAL_TYPES[data['goalType']], (goal_value >> 8) & 0xFF, goal_value & 0xFF])
+
+
+def datos_slot(data):
+    """Los 21 bytes que guarda una ranura (seed 0 = al azar)"""
+    seed = data.get('seed', 0)
+    return datos_nivel(data) + bytes([seed >> 8, seed & 0xFF])
+
+
+def hash_nivel(data):
+    """Hash con el que el PIC identifica la configuración de una ranura"""
+    return crc16(datos_slot(data))
+
+
+def trama_config(seq, data, ranura=None):
+    """Trama TRAMA_CONFIG (21 bytes de carga, 23 con seed, 24 con ranura, + CRC)
+    a partir del dict validado. Con ranura el PIC además la guarda en la EEPROM."""
+    if ranura is not None:
+        return construir_trama(bytes([TRAMA_CONFIG, seq]) + datos_slot(data) + bytes([ranura]))
+    carga = bytes([TRAMA_CONFIG, seq]) + datos_nivel(data)
+    if 'seed' in data:
+        carga += bytes([data['seed'] >> 8, data['seed'] & 0xFF])
+    return construir_trama(carga)
+
+
+def trama_slots(seq):
+    return construir_trama(bytes([TRAMA_SLOTS, seq]))
+
+
+def trama_jugar_slot(seq, ranura):
+    return construir_trama(bytes([TRAMA_JUGAR_SLOT, seq, ranura]))
+
+
+def hashes_slots(carga):
+    """TRAMA_SLOTS_RESP a la lista de hashes por ranura (SLOT_VACIO si está borrada)"""
+    n = min(carga[2], (len(carga) - 3) // 2) if len(carga) >= 3 else 0
+    return [carga[3 + 2 * i] << 8 | carga[4 + 2 * i] for i in range(n)]
+
+
+def trama_perfil(seq, fase, reiniciar=False):
+    return construir_trama(bytes([TRAMA_PERFIL, seq, fase | (PERF_REINICIA if reiniciar else 0)]))
+
+
+def fases_perfil(carga):
+    """TRAMA_PERFIL_RESP a (fases totales, contadores, {fase: dict}) con la media ya calculada"""
+    fase, fases = carga[2], carga[3]
+    contadores = {'tick_overruns': carga[4], 'rx_buffer_peak': carga[5], 'tick_max_ms': carga[6]}
+    resultado = {}
+    for i in range(7, len(carga) - 4, 5):
+        maximo, n, suma = carga[i] << 8 | carga[i + 1], carga[i + 2], carga[i + 3] << 8 | carga[i + 4]
+        nombre = FASES_PERFIL[fase] if fase < len(FASES_PERFIL) else f'fase{fase}'
+        resultado[nombre] = {'count': n, 'max_us': maximo if n else None,
+                             'avg_us': round(suma / n, 1) if n else None}
+        fase += 1
+    return fases, contadores, resultado
+
+
+def trama_ping(seq):
+    return construir_trama(bytes([TRAMA_PING, seq]))
+
+
+def trama_baud(seq, indice):
+    return construir_trama(bytes([TRAMA_BAUD, seq, indice]))
+
+
+def trama_eco(seq, datos=ECO_PATRON):
+    return construir_trama(bytes([TRAMA_ECO, seq]) + bytes(datos))
+
+
+def trama_stream(seq, divisor):
+    """Telemetría en vivo cada divisor ticks (0 la desactiva)"""
+    return construir_trama(bytes([TRAMA_STREAM, seq, divisor]))
+
+
+def trama_grabacion(seq, desde):
+    return construir_trama(bytes([TRAMA_GRABACION, seq, desde]))
+
+
+def trama_repetir(seq, total, semilla, desde, entradas):
+    """Un trozo de la grabación; el que llega a total arma la repetición"""
+    return construir_trama(bytes([TRAMA_REPETIR, seq, total, semilla >> 8, semilla & 0xFF, desde]) +
+                           bytes(entradas))
+
+
+def acciones_grabacion(entradas):
+    """Entradas grabadas a [{'tick', 'action'}], con el tick contado desde 1"""
+    acciones, tick = [], 0
+    for b in entradas:
+        tick += b & GRAB_ESPERA
+        if b & GRAB_ESPERA == GRAB_ESPERA:
+            continue
+        tick += 1
+        acciones.append({'tick': tick, 'action': 'jump' if b & GRAB_SALTA else 'duck'})
+    return acciones
+
+
+def decodificar_telemetria(carga):
+    """Carga de TRAMA_TELEMETRIA (tipo, tick, estado, esquivados, segundos) a dict"""
+    if len(carga) != 8 or carga[0] != TRAMA_TELEMETRIA:
+        return None
+    estado = carga[3]
+    muestra = {
+        'tick': carga[1] << 8 | carga[2],
+        'row': estado & TELE_FILA,
+        'obstacles_avoided': carga[4] << 8 | carga[5],
+        'survival_time': carga[6] << 8 | carga[7],
+        'spawn': None,
+        'finished': bool(estado & TELE_FIN),
+    }
+    if estado & TELE_GENERADO:
+        muestra['spawn'] = 1 if estado & TELE_FILA_GENERADO else 0
+    if muestra['finished']:
+        muestra['result'] = 'victory' if estado & TELE_VICTORIA else 'defeat'
+    return muestra
+
+
+def baudios_ofrecidos(mascara, maximo):
+    """Índices de BAUDIOS presentes en la máscara del PONG, de mayor a menor"""
+    return [i for i in reversed(range(len(BAUDIOS)))
+            if mascara & (1 << i) and BAUDIOS[i] <= maximo]
+
+
+class LectorTramas:
+    """Separa las tramas binarias de un flujo de bytes que también trae texto.
+
+    Los bytes de fuera de las tramas se acumulan en self.texto.
+    """
+
+    def __init__(self):
+        self.cuerpo = None
+        self.texto = bytearray()
+
+    def tomar_texto(self):
+        texto = self.texto.decode('ascii', errors='ignore')
+        self.texto = bytearray()
+        return texto
+
+    def alimentar(self, datos):
+        """Devuelve la lista de cargas válidas completadas con estos bytes"""
+        cargas = []
+        for byte in datos:
+            carga = self.byte(byte)
+            if carga is not None:
+                cargas.append(carga)
+        return cargas
+
+    def byte(self, byte):
+        """Procesa un byte; devuelve la carga si cierra una trama válida"""
+        if byte == 0:
+            carga = None
+            if self.cuerpo:
+                carga = decodificar_trama(bytes(self.cuerpo))
+                self.cuerpo = None
+            else:
+                self.cuerpo = bytearray()
+            return carga
+        if self.cuerpo is not None:
+            self.cuerpo.append(byte)
+            if len(self.cuerpo) > 255:
+                self.cuerpo = None
+        else:
+            self.byte_texto(byte)
+        return None
+
+    def byte_texto(self, byte):
+        self.texto.append(byte)
+
+
+class DecodificadorMensajes(LectorTramas):
+    """Decodificador incremental del flujo del PIC: tramas binarias y líneas de texto.
+
+    alimentar() devuelve los mensajes completados, en orden de llegada,
+    como tuplas ('trama', carga) o ('linea', texto sin fin de línea).
+    """
+
+    LINEA_MAX = 512
+
+    def __init__(self):
+        super().__init__()
+        self.mensajes = []
+
+    def alimentar(self, datos):
+        for byte in datos:
+            carga = self.byte(byte)
+            if carga is not None:
+                self.mensajes.append(('trama', carga))
+        mensajes, self.mensajes = self.mensajes, []
+        return mensajes
+
+    def byte_texto(self, byte):
+        if byte == 0x0A:
+            texto = self.tomar_texto().rstrip('\r')
+            if texto:
+                self.mensajes.append(('linea', texto))
+        elif len(self.texto) < self.LINEA_MAX:
+            self.texto.append(byte)
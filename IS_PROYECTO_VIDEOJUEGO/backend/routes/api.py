@@ -1,173 +1,127 @@
-from flask import Blueprint, request, jsonify
-import serial
+from flask import Blueprint, request, jsonify, Response, stream_with_context, abort, make_response
 import json
 import time
 import threading
+import os
+from collections import deque
 
 try:
     from ..config import Config
+    from .. import telemetry_store
+    from .. import dispositivos
+    from .. import protocol
 except ImportError:
     import sys
     import os
     sys.path.append(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
     from config import Config
+    import telemetry_store
+    import dispositivos
+    import protocol
 
 api_bp = Blueprint('api', __name__)
 
-ser = None
 watchdog_running = False
 watchdog_thread = None
-connection_status = {
-    'is_connected': False,
-    'last_check': None,
-    'disconnection_count': 0,
-    'reconnection_attempts': 0
-}
-
-latest_telemetry = None
-serial_reader_thread = None
-serial_reader_running = False
-
-# NUEVO: Lock para sincronizar acceso al puerto serial
-serial_lock = threading.Lock()
-
-def check_connection():
-    """Verifica si la conexión serial sigue activa"""
-    global ser
+
+# Eventos para /events (SSE): {'id', 'event', 'data', 'device'} con id
+# creciente y común a toda la flota. Se guardan los últimos para que un
+# cliente retome desde Last-Event-ID.
+eventos = deque(maxlen=Config.SSE_HISTORY)
+eventos_cond = threading.Condition()
+ultimo_evento_id = 0
+
+# Historial en disco (se abre en el primer uso)
+almacen = None
+almacen_lock = threading.Lock()
+
+def publicar_evento(tipo, datos, device):
+    """Añade un evento al historial y despierta a los clientes de /events"""
+    global ultimo_evento_id
+    
+    with eventos_cond:
+        ultimo_evento_id += 1
+        eventos.append({'id': ultimo_evento_id, 'event': tipo, 'data': dict(datos, device=device),
+                        'device': device})
+        eventos_cond.notify_all()
+
+def obtener_almacen():
+    global almacen
+    
+    with almacen_lock:
+        if almacen is None:
+            ruta = Config.TELEMETRY_DB
+            if not os.path.isabs(ruta):
+                ruta = os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), ruta)
+            almacen = telemetry_store.AlmacenTelemetria(ruta)
+        return almacen
+
+def guardar_partida(telemetria, source, config_hash, device):
+    """Encola la partida en el historial en disco sin esperar a la escritura"""
     try:
-        if ser is None:
-            return False
-        if not ser.is_open:
-            return False
-        return True
-    except:
-        return False
+        obtener_almacen().registrar(telemetria['obstacles_avoided'], telemetria['survival_time'],
+                                    telemetria['result'] == 'victory', config_hash, source, device=device)
+    except Exception as e:
+        print(f"[TELEMETRY_STORE] ✗ Error: {e}")
+
+# Un Dispositivo por puerto; el primero de SERIAL_PORTS (o SERIAL_PORT) es
+# el que atienden las rutas sin /devices/<device>
+flota = dispositivos.Flota(publicar_evento, guardar_partida)
+for puerto in Config.SERIAL_PORTS or [Config.SERIAL_PORT]:
+    flota.agregar(puerto)
+puerto_por_defecto = (Config.SERIAL_PORTS or [Config.SERIAL_PORT])[0]
+
+def ruta(regla, **opciones):
+    """Registra regla para el PIC por defecto y /devices/<device>regla para cualquiera de la flota"""
+    def registrar(vista):
+        api_bp.route(regla, **opciones)(vista)
+        api_bp.route('/devices/<device>' + regla, **opciones)(vista)
+        return vista
+    return registrar
+
+def dispositivo_de(device):
+    """Dispositivo de la ruta (id o puerto); 404 si no está en la flota"""
+    dispositivo = flota.obtener(puerto_por_defecto if device is None else device)
+    if dispositivo is None:
+        abort(make_response(jsonify({'error': f'Dispositivo desconocido: {device}'}), 404))
+    return dispositivo
 
 def watchdog_worker():
-    """Thread que verifica la conexión serial cada 5 segundos"""
-    global ser, watchdog_running, connection_status
+    """Thread que verifica la conexión de cada PIC de la flota cada 5 segundos"""
+    global watchdog_running
     
     print("[WATCHDOG] Iniciado - Verificando conexión cada 5 segundos")
     
     while watchdog_running:
         time.sleep(5)
         
-        connection_status['last_check'] = time.strftime('%Y-%m-%d %H:%M:%S')
-        
-        if not check_connection():
-            if connection_status['is_connected']:
-                connection_status['disconnection_count'] += 1
-                print(f"[WATCHDOG] ⚠️ Desconexión detectada (#{connection_status['disconnection_count']})")
-                connection_status['is_connected'] = False
-            
-            print(f"[WATCHDOG] Intentando reconectar...")
-            connection_status['reconnection_attempts'] += 1
+        for dispositivo in flota.todos():
+            estado = dispositivo.estado
+            estado['last_check'] = time.strftime('%Y-%m-%d %H:%M:%S')
             
-            if init_serial():
-                print(f"[WATCHDOG] ✓ Reconexión exitosa")
-                connection_status['is_connected'] = True
-                start_serial_reader()
-            else:
-                print(f"[WATCHDOG] ✗ Reconexión fallida (intento #{connection_status['reconnection_attempts']})")
-        else:
-            connection_status['is_connected'] = True
+            if dispositivo.conectado():
+                dispositivo.marcar_conexion(True)
+                continue
+            if estado['is_connected']:
+                estado['disconnection_count'] += 1
+                print(f"[WATCHDOG] ⚠️ {dispositivo.id}: desconexión detectada (#{estado['disconnection_count']})")
+                dispositivo.marcar_conexion(False)
+            # Cada reapertura espera al adaptador: en su propio thread, para
+            # que un PIC ausente no retrase a los demás
+            if dispositivo.abriendo.locked():
+                continue
+            estado['reconnection_attempts'] += 1
+            threading.Thread(target=reconectar, args=(dispositivo,), daemon=True).start()
     
     print("[WATCHDOG] Detenido")
 
-def serial_reader_worker():
-    """Thread que lee constantemente del puerto serial"""
-    global ser, serial_reader_running, latest_telemetry, serial_lock
-    
-    print("[SERIAL_READER] Iniciado - Escuchando telemetría del PIC")
-    
-    buffer = ""
-    
-    while serial_reader_running:
-        try:
-            # NUEVO: Usar lock para evitar conflictos
-            with serial_lock:
-                if ser and ser.is_open and ser.in_waiting > 0:
-                    chunk = ser.read(ser.in_waiting).decode('ascii', errors='ignore')
-                    buffer += chunk
-            
-            # Procesar telemetría
-            start_idx = buffer.find('{"obstacles"')
-            if start_idx != -1:
-                end_idx = buffer.find('}', start_idx)
-                if end_idx != -1:
-                    json_str = buffer[start_idx:end_idx+1]
-                    
-                    try:
-                        telemetry_data = json.loads(json_str)
-                        
-                        if 'obstacles' in telemetry_data and 'time' in telemetry_data and 'result' in telemetry_data:
-                            result = telemetry_data['result'].lower()
-                            normalized_result = 'victory' if result in ['win', 'victory'] else 'defeat'
-                            
-                            latest_telemetry = {
-                                'obstacles_avoided': int(telemetry_data['obstacles']),
-                                'survival_time': int(telemetry_data['time']),
-                                'result': normalized_result,
-                                'timestamp': time.strftime('%Y-%m-%d %H:%M:%S')
-                            }
-                            
-                            print(f"[SERIAL_READER] ✓ Telemetría recibida: {latest_telemetry}")
-                            buffer = buffer[end_idx+1:]
-                        else:
-                            print(f"[SERIAL_READER] ⚠️ JSON incompleto: {json_str}")
-                            buffer = buffer[end_idx+1:]
-                            
-                    except (json.JSONDecodeError, ValueError) as e:
-                        print(f"[SERIAL_READER] ✗ Error: {e}")
-                        buffer = buffer[end_idx+1:]
-            
-            # Limpiar mensajes de confirmación
-            if '{"status":"loaded"' in buffer:
-                conf_start = buffer.find('{"status":"loaded"')
-                conf_end = buffer.find('}', conf_start)
-                if conf_end != -1:
-                    buffer = buffer[:conf_start] + buffer[conf_end+1:]
-            
-            # Mantener buffer pequeño
-            if len(buffer) > 500:
-                buffer = buffer[-500:]
-                
-            # Pausa si no hay datos
-            time.sleep(0.1)
-                
-        except Exception as e:
-            print(f"[SERIAL_READER] ✗ Error: {e}")
-            time.sleep(0.5)
-    
-    print("[SERIAL_READER] Detenido")
-
-def start_serial_reader():
-    """Inicia el thread de lectura serial"""
-    global serial_reader_running, serial_reader_thread
-    
-    if serial_reader_running:
-        print("[SERIAL_READER] Ya está en ejecución")
-        return
-    
-    if ser is None or not ser.is_open:
-        print("[SERIAL_READER] No se puede iniciar - puerto serial no disponible")
-        return
-    
-    serial_reader_running = True
-    serial_reader_thread = threading.Thread(target=serial_reader_worker, daemon=True)
-    serial_reader_thread.start()
-    print("[SERIAL_READER] Thread iniciado")
-
-def stop_serial_reader():
-    """Detiene el thread de lectura serial"""
-    global serial_reader_running
-    
-    if not serial_reader_running:
-        return
-    
-    serial_reader_running = False
-    time.sleep(0.3)  # NUEVO: Esperar más tiempo para asegurar que se detenga
-    print("[SERIAL_READER] Detenido")
+def reconectar(dispositivo):
+    print(f"[WATCHDOG] {dispositivo.id}: intentando reconectar...")
+    if dispositivo.abrir():
+        print(f"[WATCHDOG] ✓ {dispositivo.id}: reconexión exitosa")
+    else:
+        print(f"[WATCHDOG] ✗ {dispositivo.id}: reconexión fallida "
+              f"(intento #{dispositivo.estado['reconnection_attempts']})")
 
 def start_watchdog():
     """Inicia el thread del watchdog"""
@@ -192,153 +146,49 @@ def stop_watchdog():
     watchdog_running = False
     print("[WATCHDOG] Deteniendo...")
 
-def init_serial():
-    """Inicializa la conexión serial con el PIC"""
-    global ser, connection_status
-    try:
-        if ser is not None and ser.is_open:
-            ser.close()
-        
-        # NUEVO: Configuración mejorada con timeouts más largos
-        ser = serial.Serial(
-            port=Config.SERIAL_PORT,
-            baudrate=Config.SERIAL_BAUDRATE,
-            timeout=Config.SERIAL_TIMEOUT,
-            write_timeout=3,  # Aumentado de 2 a 3 segundos
-            # NUEVO: Parámetros adicionales para estabilidad
-            bytesize=serial.EIGHTBITS,
-            parity=serial.PARITY_NONE,
-            stopbits=serial.STOPBITS_ONE,
-            xonxoff=False,
-            rtscts=False,
-            dsrdtr=False
-        )
-        
-        # NUEVO: Esperar más tiempo para el FT232BL
-        time.sleep(3)  # Aumentado de 2 a 3 segundos
-        
-        # Limpiar buffers múltiples veces
-        for _ in range(3):
-            ser.reset_input_buffer()
-            ser.reset_output_buffer()
-            time.sleep(0.1)
-        
-        connection_status['is_connected'] = True
-        print(f"✓ Puerto serial {Config.SERIAL_PORT} conectado")
-        
-        # NO iniciar el reader automáticamente
-        # Se iniciará después del primer envío exitoso
-        
-        return True
-    except serial.SerialException as e:
-        connection_status['is_connected'] = False
-        print(f"✗ Error al abrir puerto serial: {e}")
-        ser = None
-        return False
+# ============ FLOTA ============
+@api_bp.route('/devices', methods=['GET'])
+def list_devices():
+    """PICs registrados y su estado"""
+    return jsonify({
+        'status': 'ok',
+        'default': flota.obtener(puerto_por_defecto).id,
+        'data': [d.resumen() for d in flota.todos()]
+    }), 200
 
-def send_to_pic(data):
-    """Envía datos JSON al PIC vía serial y espera confirmación"""
-    global ser, serial_reader_running, serial_lock
+@api_bp.route('/devices', methods=['POST'])
+def add_device():
+    """Registra un PIC por puerto ({"port": "COM4"}) y trata de abrirlo"""
+    data = request.get_json(silent=True) or {}
+    puerto = data.get('port')
+    if not isinstance(puerto, str) or not puerto:
+        return jsonify({'error': 'port es obligatorio'}), 400
     
-    if ser is None or not ser.is_open:
-        if not init_serial():
-            return False, "Puerto serial no disponible", None
+    dispositivo = flota.agregar(puerto)
+    conectado = dispositivo.conectado() or dispositivo.abrir()
     
-    try:
-        # NUEVO: Detener reader y esperar más tiempo
-        reader_was_running = serial_reader_running
-        if reader_was_running:
-            print("[SEND_CONFIG] Deteniendo serial reader...")
-            stop_serial_reader()
-            time.sleep(0.5)  # Aumentado de 0.2 a 0.5 segundos
-        
-        json_str = json.dumps(data, separators=(',', ':'))
-        
-        # NUEVO: Usar lock para acceso exclusivo
-        with serial_lock:
-            # NUEVO: Limpieza AGRESIVA múltiple
-            print("[SEND_CONFIG] Limpiando buffers...")
-            for _ in range(5):  # Aumentado de 1 a 5 intentos
-                ser.reset_input_buffer()
-                ser.reset_output_buffer()
-                time.sleep(0.05)
-            
-            # Descartar datos residuales
-            time.sleep(0.2)
-            if ser.in_waiting > 0:
-                garbage = ser.read(ser.in_waiting)
-                print(f"[SEND_CONFIG] 🗑️ Descartados {len(garbage)} bytes: {garbage[:50]}")
-            
-            # Limpieza final
-            ser.reset_input_buffer()
-            ser.reset_output_buffer()
-            time.sleep(0.1)
-            
-            # NUEVO: Enviar con delay entre caracteres para FT232BL
-            print(f"[SEND_CONFIG] → Enviando: {json_str}")
-            for char in json_str:
-                ser.write(char.encode('ascii'))
-                time.sleep(0.001)  # 1ms entre caracteres
-            ser.flush()
-            
-            # NUEVO: Esperar más tiempo antes de leer respuesta
-            time.sleep(0.5)  # Dar tiempo al PIC para procesar
-            
-            # Espera respuesta del PIC con timeout extendido
-            response_timeout = 8  # Aumentado de 5 a 8 segundos
-            start_time = time.time()
-            response_buffer = ""
-            
-            print("[SEND_CONFIG] Esperando respuesta del PIC...")
-            
-            while (time.time() - start_time) < response_timeout:
-                if ser.in_waiting > 0:
-                    chunk = ser.read(ser.in_waiting).decode('ascii', errors='ignore')
-                    response_buffer += chunk
-                    print(f"[SEND_CONFIG] ← Recibido: {chunk}")
-                    
-                    # Busca el JSON de respuesta completo
-                    if '{"status":"loaded"' in response_buffer:
-                        start_idx = response_buffer.find('{"status":"loaded"')
-                        end_idx = response_buffer.find('}', start_idx)
-                        
-                        if end_idx != -1:
-                            json_response = response_buffer[start_idx:end_idx+1]
-                            print(f"[SEND_CONFIG] ✓ Respuesta completa: {json_response}")
-                            
-                            # NUEVO: Iniciar reader solo después del primer envío exitoso
-                            if reader_was_running or not serial_reader_running:
-                                time.sleep(0.5)
-                                start_serial_reader()
-                            
-                            return True, "Configuración cargada exitosamente", json_response
-                
-                time.sleep(0.05)
-        
-        # Si llegamos aquí, no se recibió la confirmación
-        print(f"[SEND_CONFIG] ⚠️ Timeout - Buffer recibido: {response_buffer}")
-        
-        # Reiniciar reader aunque haya fallado
-        if reader_was_running:
-            start_serial_reader()
-        
-        if response_buffer:
-            return False, f"Respuesta incompleta del PIC: {response_buffer}", response_buffer
-        else:
-            return False, "El PIC no respondió (timeout)", None
-        
-    except serial.SerialTimeoutException:
-        if reader_was_running:
-            start_serial_reader()
-        return False, "Timeout al enviar datos", None
-    except Exception as e:
-        if reader_was_running:
-            start_serial_reader()
-        return False, f"Error en comunicación serial: {str(e)}", None
+    return jsonify({
+        'status': 'ok',
+        'connected': conectado,
+        'data': dispositivo.resumen()
+    }), 201
 
-@api_bp.route('/send_config', methods=['POST'])
-def send_config():
+@api_bp.route('/devices/<device>', methods=['DELETE'])
+def remove_device(device):
+    """Cierra el puerto y quita el PIC de la flota"""
+    dispositivo = dispositivo_de(device)
+    if dispositivo.puerto == puerto_por_defecto:
+        return jsonify({'error': 'El dispositivo por defecto no se puede quitar'}), 400
+    flota.quitar(dispositivo)
+    
+    return jsonify({'status': 'success', 'message': f'{dispositivo.id} eliminado'}), 200
+
+# ============ CONFIGURACIÓN ============
+@ruta('/send_config', methods=['POST'])
+def send_config(device=None):
     """Recibe configuración del frontend y la envía al PIC"""
+    dispositivo = dispositivo_de(device)
+    
     try:
         data = request.get_json()
         
@@ -363,82 +213,160 @@ def send_config():
         if not isinstance(data['goalValue'], (int, float)) or data['goalValue'] <= 0:
             return jsonify({'error': 'goalValue debe ser un número positivo'}), 400
         
+        # seed es opcional: la misma semilla repite la secuencia de obstáculos
+        seed = data.get('seed')
+        if seed is not None and (not isinstance(seed, int) or isinstance(seed, bool) or not 0 < seed <= 0xFFFF):
+            return jsonify({'error': 'seed debe ser un entero entre 1 y 65535'}), 400
+        
         pic_data = {
             'character': data['character'],
             'obstacle': data['obstacle'],
             'goalType': data['goalType'],
             'goalValue': int(data['goalValue'])
         }
+        if seed is not None:
+            pic_data['seed'] = seed
         
-        # NUEVO: Intentar hasta 2 veces en caso de fallo
+        # Un segundo intento solo tras un timeout: la negociación se repite
+        # (el PIC pudo reiniciarse) sin cerrar el puerto
         max_attempts = 2
         for attempt in range(max_attempts):
-            print(f"[API] Intento {attempt + 1} de {max_attempts}")
+            print(f"[API] {dispositivo.id}: intento {attempt + 1} de {max_attempts}")
             
-            success, message, pic_response = send_to_pic(pic_data)
+            success, message, pic_response = dispositivo.enviar_config(pic_data)
             
             if success:
+                dispositivo.config_actual_hash = telemetry_store.hash_config(pic_data)
+                obtener_almacen().registrar_config(dispositivo.config_actual_hash, pic_data)
                 return jsonify({
                     'status': 'success',
                     'message': message,
+                    'device': dispositivo.id,
                     'data': data,
                     'pic_response': pic_response
                 }), 200
             
-            # Si falla el primer intento, esperar y reiniciar conexión
-            if attempt < max_attempts - 1:
-                print(f"[API] Intento {attempt + 1} falló, reiniciando conexión...")
-                time.sleep(1)
-                if ser and ser.is_open:
-                    ser.close()
-                    time.sleep(0.5)
-                init_serial()
+            if pic_response is not None:
+                break
+            print(f"[API] {dispositivo.id}: intento {attempt + 1} sin respuesta del PIC")
         
         # Si todos los intentos fallaron
         return jsonify({
             'status': 'error',
             'message': message,
+            'device': dispositivo.id,
             'data': data,
             'pic_response': pic_response
         }), 500
-        
+    
     except Exception as e:
         return jsonify({'error': str(e)}), 500
 
-@api_bp.route('/serial/status', methods=['GET'])
-def serial_status():
+@ruta('/slots', methods=['GET'])
+def get_slots(device=None):
+    """Ranuras de configuración de la EEPROM del PIC: hash de cada una"""
+    dispositivo = dispositivo_de(device)
+    success, message, slots = dispositivo.consultar_slots()
+    if not success:
+        return jsonify({'status': 'error', 'device': dispositivo.id, 'message': message}), 503
+    return jsonify({'status': 'ok', 'device': dispositivo.id, 'slots': slots}), 200
+
+@ruta('/profile', methods=['GET'])
+def get_profile(device=None):
+    """Tiempos por fase del loop del PIC (firmware con PERFILADO=1). ?reset=1 los pone a cero"""
+    dispositivo = dispositivo_de(device)
+    reiniciar = request.args.get('reset', '0') in ('1', 'true')
+    success, message, perfil = dispositivo.leer_perfil(reiniciar)
+    if not success:
+        return jsonify({'status': 'error', 'device': dispositivo.id, 'message': message}), 503
+    return jsonify({'status': 'ok', 'device': dispositivo.id, 'profile': perfil}), 200
+
+# ============ GRABACIÓN Y REPETICIÓN ============
+@ruta('/replay', methods=['GET'])
+def get_replay(device=None):
+    """Grabación de entradas de la última partida: semilla, entradas y acciones por tick"""
+    dispositivo = dispositivo_de(device)
+    success, message, grabacion = dispositivo.leer_grabacion()
+    if not success:
+        return jsonify({'status': 'error', 'device': dispositivo.id, 'message': message}), 503
+    return jsonify({'status': 'ok', 'device': dispositivo.id, 'data': grabacion}), 200
+
+@ruta('/replay', methods=['POST'])
+def load_replay(device=None):
+    """Arma una repetición con {"seed", "inputs"} de GET /replay. La partida
+    empieza con el siguiente /send_config, que debe llevar la misma meta."""
+    dispositivo = dispositivo_de(device)
+    data = request.get_json(silent=True) or {}
+    seed = data.get('seed')
+    if not isinstance(seed, int) or isinstance(seed, bool) or not 0 < seed <= 0xFFFF:
+        return jsonify({'error': 'seed debe ser un entero entre 1 y 65535'}), 400
+    try:
+        entradas = bytes.fromhex(data.get('inputs', ''))
+    except (TypeError, ValueError):
+        return jsonify({'error': 'inputs debe ser una cadena hexadecimal'}), 400
+    if len(entradas) > protocol.GRABACION_MAX:
+        return jsonify({'error': f'inputs admite como mucho {protocol.GRABACION_MAX} bytes'}), 400
+    
+    success, message, _ = dispositivo.cargar_repeticion(seed, entradas)
+    return jsonify({
+        'status': 'success' if success else 'error',
+        'device': dispositivo.id,
+        'message': message
+    }), 200 if success else 500
+
+# ============ PUERTO SERIAL ============
+@ruta('/serial/status', methods=['GET'])
+def serial_status(device=None):
     """Verifica el estado de la conexión serial"""
-    global ser
+    dispositivo = dispositivo_de(device)
     
-    if ser is None:
-        init_serial()
+    if dispositivo.ser is None:
+        dispositivo.abrir()
     
-    is_connected = ser is not None and ser.is_open
+    is_connected = dispositivo.conectado()
     
     return jsonify({
         'connected': is_connected,
-        'port': Config.SERIAL_PORT if is_connected else None,
-        'baudrate': Config.SERIAL_BAUDRATE if is_connected else None
+        'device': dispositivo.id,
+        'port': dispositivo.puerto if is_connected else None,
+        'baudrate': dispositivo.ser.baudrate if is_connected else None
     }), 200
 
-@api_bp.route('/serial/reconnect', methods=['POST'])
-def serial_reconnect():
-    """Intenta reconectar el puerto serial"""
-    global ser
+@ruta('/serial/stats', methods=['GET'])
+def serial_stats(device=None):
+    """Latencia de recepción a despacho, suscriptores e ida y vuelta de los comandos"""
+    dispositivo = dispositivo_de(device)
+    with dispositivo.suscriptores_lock:
+        n_suscriptores = len(dispositivo.suscriptores)
+    with dispositivo.comandos_lock:
+        en_vuelo = len(dispositivo.comandos_pendientes)
     
-    if ser is not None and ser.is_open:
-        ser.close()
-    
-    success = init_serial()
+    return jsonify({
+        'device': dispositivo.id,
+        'reader_running': flota.nucleo.activo(),
+        'subscribers': n_suscriptores,
+        'latency': dispositivo.estadisticas_latencia(),
+        'commands': dispositivo.estadisticas_comandos(),
+        'commands_in_flight': en_vuelo,
+        'fleet_dropped': flota.descartados
+    }), 200
+
+@ruta('/serial/reconnect', methods=['POST'])
+def serial_reconnect(device=None):
+    """Intenta reconectar el puerto serial"""
+    dispositivo = dispositivo_de(device)
+    success = dispositivo.abrir()
     
     return jsonify({
         'success': success,
+        'device': dispositivo.id,
         'message': 'Conectado' if success else 'No se pudo conectar'
     }), 200 if success else 500
 
+# ============ WATCHDOG ============
 @api_bp.route('/watchdog/start', methods=['POST'])
 def start_watchdog_endpoint():
-    """Inicia el watchdog de monitoreo de conexión serial"""
+    """Inicia el watchdog de monitoreo de conexión serial (toda la flota)"""
     start_watchdog()
     return jsonify({
         'success': True,
@@ -454,25 +382,30 @@ def stop_watchdog_endpoint():
         'message': 'Watchdog detenido'
     }), 200
 
-@api_bp.route('/watchdog/status', methods=['GET'])
-def watchdog_status():
+@ruta('/watchdog/status', methods=['GET'])
+def watchdog_status(device=None):
     """Obtiene el estado del watchdog y estadísticas de conexión"""
-    global watchdog_running, connection_status, serial_reader_running
+    dispositivo = dispositivo_de(device)
+    estado = dispositivo.estado
     
     return jsonify({
         'watchdog_active': watchdog_running,
-        'serial_reader_active': serial_reader_running,
+        'serial_reader_active': flota.nucleo.activo(),
+        'device': dispositivo.id,
         'connection': {
-            'is_connected': connection_status['is_connected'],
-            'last_check': connection_status['last_check'],
-            'disconnections': connection_status['disconnection_count'],
-            'reconnection_attempts': connection_status['reconnection_attempts']
+            'is_connected': estado['is_connected'],
+            'last_check': estado['last_check'],
+            'disconnections': estado['disconnection_count'],
+            'reconnection_attempts': estado['reconnection_attempts']
         }
     }), 200
 
-@api_bp.route('/telemetry', methods=['POST'])
-def receive_telemetry():
+# ============ TELEMETRÍA ============
+@ruta('/telemetry', methods=['POST'])
+def receive_telemetry(device=None):
     """Endpoint alternativo para recibir telemetría vía HTTP POST"""
+    dispositivo = dispositivo_de(device)
+    
     try:
         data = request.get_json()
         
@@ -495,29 +428,28 @@ def receive_telemetry():
         
         normalized_result = 'victory' if data['result'] in ['win', 'victory'] else 'defeat'
         
-        global latest_telemetry
-        latest_telemetry = {
+        dispositivo.registrar_partida({
             'obstacles_avoided': data['obstacles'],
             'survival_time': data['time'],
             'result': normalized_result,
             'timestamp': time.strftime('%Y-%m-%d %H:%M:%S')
-        }
+        }, 'http')
         
-        print(f"[TELEMETRY HTTP] Recibida: {latest_telemetry}")
+        print(f"[TELEMETRY HTTP] {dispositivo.id}: {dispositivo.latest_telemetry}")
         
         return jsonify({
             'status': 'success',
             'message': 'Telemetría recibida correctamente'
         }), 200
-        
+    
     except Exception as e:
         print(f"[TELEMETRY ERROR] {str(e)}")
         return jsonify({'error': str(e)}), 500
 
-@api_bp.route('/telemetry/latest', methods=['GET'])
-def get_latest_telemetry():
+@ruta('/telemetry/latest', methods=['GET'])
+def get_latest_telemetry(device=None):
     """Obtiene la última telemetría recibida"""
-    global latest_telemetry
+    latest_telemetry = dispositivo_de(device).latest_telemetry
     
     if latest_telemetry is None:
         return jsonify({
@@ -530,13 +462,156 @@ def get_latest_telemetry():
         'data': latest_telemetry
     }), 200
 
-@api_bp.route('/telemetry/clear', methods=['POST'])
-def clear_telemetry():
-    """Limpia la telemetría almacenada"""
-    global latest_telemetry
-    latest_telemetry = None
+@ruta('/telemetry/live', methods=['GET'])
+def get_live_telemetry(device=None):
+    """Muestras de la partida en curso con seq mayor que ?since="""
+    dispositivo = dispositivo_de(device)
+    since = request.args.get('since', default=0, type=int)
+    muestras = [m for m in list(dispositivo.live_telemetry) if m['seq'] > since]
     
-    print("[TELEMETRY] Buffer limpiado")
+    return jsonify({
+        'status': 'ok',
+        'seq': dispositivo.live_seq,
+        'data': muestras
+    }), 200
+
+def formato_sse(evento):
+    return f"id: {evento['id']}\nevent: {evento['event']}\ndata: {json.dumps(evento['data'])}\n\n"
+
+@ruta('/events', methods=['GET'])
+def events(device=None):
+    """Server-Sent Events: telemetría, muestras en vivo y cambios de conexión.
+
+    Solo los del PIC de la ruta; con ?all=1 los de toda la flota (cada
+    evento lleva data.device). Sin Last-Event-ID (cabecera o ?lastEventId=)
+    solo llegan los eventos nuevos, precedidos del estado de la conexión.
+    Con él se reenvían los que sigan en el historial; si ya no están, o el
+    id es de antes de reiniciar el backend, 'reset' avisa del hueco.
+    """
+    todos = device is None and request.args.get('all') == '1'
+    dispositivos_sse = flota.todos() if todos else [dispositivo_de(device)]
+    ids = {d.id for d in dispositivos_sse}
+    ultimo = request.headers.get('Last-Event-ID') or request.args.get('lastEventId')
+    try:
+        ultimo = int(ultimo) if ultimo is not None else None
+    except ValueError:
+        ultimo = None
+    
+    def propios(desde):
+        return [e for e in eventos if e['id'] > desde and (todos or e['device'] in ids)]
+    
+    def generar(ultimo):
+        with eventos_cond:
+            if ultimo is None:
+                ultimo = ultimo_evento_id
+                pendientes = [{'id': ultimo, 'event': 'connection',
+                               'data': {'connected': d.estado['is_connected'], 'port': d.puerto, 'device': d.id}}
+                              for d in dispositivos_sse]
+            elif ultimo > ultimo_evento_id or (eventos and eventos[0]['id'] > ultimo + 1):
+                # Id ya fuera del historial, o de un proceso anterior del backend
+                # (los ids vuelven a empezar al reiniciar): en los dos hay hueco
+                antiguo = eventos[0]['id'] if eventos else ultimo_evento_id + 1
+                pendientes = [{'id': min(ultimo, antiguo - 1), 'event': 'reset',
+                               'data': {'oldest': antiguo}}]
+                pendientes += propios(0)
+            else:
+                pendientes = propios(ultimo)
+            ultimo = ultimo_evento_id
+        # Reintento de EventSource tras un corte
+        yield f"retry: {Config.SSE_RETRY_MS}\n\n"
+        
+        while True:
+            for evento in pendientes:
+                yield formato_sse(evento)
+            with eventos_cond:
+                if ultimo_evento_id <= ultimo:
+                    eventos_cond.wait(timeout=Config.SSE_KEEPALIVE)
+                pendientes = propios(ultimo)
+                # Los de otros PICs también cuentan como vistos
+                ultimo = ultimo_evento_id
+            if not pendientes:
+                # Comentario SSE: mantiene viva la conexión a través de proxies
+                yield ": keepalive\n\n"
+    
+    return Response(stream_with_context(generar(ultimo)), mimetype='text/event-stream',
+                    headers={'Cache-Control': 'no-cache', 'X-Accel-Buffering': 'no'})
+
+# ============ HISTORIAL ============
+def parametro_desde():
+    """?since= en segundos epoch o AAAA-MM-DD; None si no viene"""
+    since = request.args.get('since')
+    if not since:
+        return None
+    try:
+        return float(since)
+    except ValueError:
+        return time.mktime(time.strptime(since, '%Y-%m-%d'))
+
+def dispositivo_historial(device):
+    """Filtro de historial: None (todas las partidas) o el id del PIC de la ruta"""
+    return None if device is None else dispositivo_de(device).id
+
+@ruta('/telemetry/history', methods=['GET'])
+def telemetry_history(device=None):
+    """Partidas guardadas, más recientes primero. ?limit=&before=<id>&config=<hash>"""
+    # Fuera de 1..1000 se recorta: 0 vaciaría la página y LIMIT -1 en SQLite no tiene tope
+    limite = max(1, min(request.args.get('limit', default=50, type=int), 1000))
+    antes_de = request.args.get('before', type=int)
+    partidas = obtener_almacen().historial(limite, antes_de, request.args.get('config'),
+                                           dispositivo_historial(device))
+    
+    return jsonify({
+        'status': 'ok',
+        'data': partidas,
+        'next_before': partidas[-1]['id'] if len(partidas) == limite else None
+    }), 200
+
+@ruta('/telemetry/stats', methods=['GET'])
+def telemetry_stats(device=None):
+    """Tasa de victorias y percentiles de obstáculos y tiempo. ?config=&since="""
+    try:
+        desde = parametro_desde()
+    except ValueError:
+        return jsonify({'error': 'since debe ser epoch o AAAA-MM-DD'}), 400
+    
+    return jsonify({
+        'status': 'ok',
+        'data': obtener_almacen().estadisticas(request.args.get('config'), desde, dispositivo_historial(device))
+    }), 200
+
+@ruta('/telemetry/histogram', methods=['GET'])
+def telemetry_histogram(device=None):
+    """Partidas y victorias por valor. ?field=obstacles|time&config=&since="""
+    campo = request.args.get('field', 'obstacles')
+    try:
+        filas = obtener_almacen().histograma(campo, request.args.get('config'), parametro_desde(),
+                                             dispositivo_historial(device))
+    except ValueError as e:
+        return jsonify({'error': str(e)}), 400
+    
+    return jsonify({
+        'status': 'ok',
+        'field': campo,
+        'data': [{'value': v, 'games': n, 'wins': w} for v, n, w in filas]
+    }), 200
+
+@ruta('/telemetry/configs', methods=['GET'])
+def telemetry_configs(device=None):
+    """Resumen por configuración (hash, partidas, tasa de victorias)"""
+    return jsonify({
+        'status': 'ok',
+        'current': dispositivo_de(device).config_actual_hash,
+        'data': obtener_almacen().por_config(dispositivo_historial(device))
+    }), 200
+
+@ruta('/telemetry/clear', methods=['POST'])
+def clear_telemetry(device=None):
+    """Limpia la telemetría en memoria; el historial en disco no se borra"""
+    dispositivo = dispositivo_de(device)
+    dispositivo.latest_telemetry = None
+    dispositivo.live_telemetry.clear()
+    
+    print(f"[TELEMETRY] {dispositivo.id}: buffer limpiado")
     
     return jsonify({
         'status': 'success',
@@ -552,5 +627,7 @@ def health():
     return jsonify({
         'status': 'ok',
         'watchdog_active': watchdog_running,
-        'serial_reader_active': serial_reader_running
-    }), 200
\ No newline at end of file
+        'serial_reader_active': flota.nucleo.activo(),
+        'devices': len(flota.todos()),
+        'devices_connected': sum(d.conectado() for d in flota.todos())
+    }), 200
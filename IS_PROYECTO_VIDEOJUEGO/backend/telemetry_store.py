@@ -0,0 +1,272 @@
+"""Historial persistente de partidas en SQLite.
+
+La tabla games es de solo inserción. Junto a cada partida se actualiza
+histograma (partidas y victorias por configuración, campo y valor), de
+modo que tasa de victorias, percentiles e histogramas cuestan lo que el
+número de valores distintos, no el de filas. histograma_dia guarda lo
+mismo por día (UTC) para los filtros de fecha, que van con resolución de
+día. games solo se lee para el historial: el índice por config_hash, que
+SQLite completa con el id, permite paginarlo por configuración.
+
+Con varios PICs cada partida lleva el id de su dispositivo, y los dos
+agregados también: su clave empieza por device ('' si la partida no lo
+trae). Las consultas de la flota suman todos los dispositivos y las de un
+PIC filtran el suyo, así que ambas salen de los agregados, con el mismo
+redondeo al día en since. El índice games_device queda para el historial.
+
+Las escrituras van a una cola que vacía un thread propio en lotes: quien
+registra (el lector serial) nunca espera al disco.
+"""
+
+import hashlib
+import json
+import queue
+import sqlite3
+import threading
+import time
+from contextlib import closing
+
+CAMPOS = ('obstacles', 'time')
+
+ESQUEMA = '''
+CREATE TABLE IF NOT EXISTS games (
+    id INTEGER PRIMARY KEY,
+    ts REAL NOT NULL,
+    config_hash TEXT,
+    obstacles INTEGER NOT NULL,
+    time INTEGER NOT NULL,
+    win INTEGER NOT NULL,
+    source TEXT,
+    device TEXT
+);
+CREATE INDEX IF NOT EXISTS games_config ON games (config_hash);
+
+CREATE TABLE IF NOT EXISTS configs (
+    hash TEXT PRIMARY KEY,
+    config TEXT NOT NULL,
+    first_seen REAL NOT NULL
+);
+
+CREATE TABLE IF NOT EXISTS histograma (
+    device TEXT NOT NULL,
+    config_hash TEXT NOT NULL,
+    campo TEXT NOT NULL,
+    valor INTEGER NOT NULL,
+    partidas INTEGER NOT NULL,
+    victorias INTEGER NOT NULL,
+    PRIMARY KEY (device, config_hash, campo, valor)
+) WITHOUT ROWID;
+
+CREATE TABLE IF NOT EXISTS histograma_dia (
+    campo TEXT NOT NULL,
+    dia INTEGER NOT NULL,
+    device TEXT NOT NULL,
+    config_hash TEXT NOT NULL,
+    valor INTEGER NOT NULL,
+    partidas INTEGER NOT NULL,
+    victorias INTEGER NOT NULL,
+    PRIMARY KEY (campo, dia, device, config_hash, valor)
+) WITHOUT ROWID;
+'''
+
+
+def hash_config(config):
+    """Hash estable de la configuración enviada al PIC (orden de claves irrelevante)"""
+    canonica = json.dumps(config, sort_keys=True, separators=(',', ':'))
+    return hashlib.sha1(canonica.encode()).hexdigest()[:16]
+
+
+def dia_de(ts):
+    return int(ts // 86400)
+
+
+def percentiles(histograma, ps=(50, 90, 99)):
+    """histograma: [(valor, cuenta)] ordenado por valor"""
+    total = sum(c for _, c in histograma)
+    if total == 0:
+        return {}
+    resultado = {}
+    for p in ps:
+        objetivo = max(1, -(-total * p // 100))
+        acumulado = 0
+        for valor, cuenta in histograma:
+            acumulado += cuenta
+            if acumulado >= objetivo:
+                resultado[f'p{p}'] = valor
+                break
+    resultado['mean'] = round(sum(v * c for v, c in histograma) / total, 2)
+    resultado['min'] = histograma[0][0]
+    resultado['max'] = histograma[-1][0]
+    return resultado
+
+
+class AlmacenTelemetria:
+    LOTE_MAX = 500
+
+    def __init__(self, ruta):
+        self.ruta = ruta
+        self.cola = queue.Queue()
+        self.escritas = 0
+        # closing cierra la conexión; el with interior confirma la transacción
+        with closing(self._conectar()) as conexion, conexion:
+            conexion.executescript(ESQUEMA)
+            # Bases anteriores a la flota: games sin columna device
+            columnas = [c[1] for c in conexion.execute('PRAGMA table_info(games)')]
+            if 'device' not in columnas:
+                conexion.execute('ALTER TABLE games ADD COLUMN device TEXT')
+            conexion.execute('CREATE INDEX IF NOT EXISTS games_device ON games (device)')
+            # Agregados anteriores a la clave por dispositivo: se rehacen desde games
+            columnas = [c[1] for c in conexion.execute('PRAGMA table_info(histograma)')]
+            if 'device' not in columnas:
+                self._reconstruir_agregados(conexion)
+        self.thread = threading.Thread(target=self._escritor, daemon=True)
+        self.thread.start()
+
+    def _reconstruir_agregados(self, conexion):
+        """Recorre games una vez; solo al migrar una base antigua"""
+        conexion.execute('DROP TABLE histograma')
+        conexion.execute('DROP TABLE histograma_dia')
+        conexion.executescript(ESQUEMA)
+        for campo in CAMPOS:
+            # campo sale de CAMPOS, no de la petición
+            conexion.execute(
+                f'''INSERT INTO histograma (device, config_hash, campo, valor, partidas, victorias)
+                   SELECT COALESCE(device, ''), COALESCE(config_hash, ''), ?, {campo}, COUNT(*), SUM(win)
+                   FROM games GROUP BY 1, 2, 4''', (campo,))
+            conexion.execute(
+                f'''INSERT INTO histograma_dia (campo, dia, device, config_hash, valor, partidas, victorias)
+                   SELECT ?, CAST(ts / 86400 AS INTEGER), COALESCE(device, ''), COALESCE(config_hash, ''),
+                          {campo}, COUNT(*), SUM(win)
+                   FROM games GROUP BY 2, 3, 4, 5''', (campo,))
+
+    def _conectar(self):
+        conexion = sqlite3.connect(self.ruta, timeout=10, check_same_thread=False)
+        # WAL: las consultas no bloquean al escritor ni al revés
+        conexion.execute('PRAGMA journal_mode=WAL')
+        conexion.execute('PRAGMA synchronous=NORMAL')
+        return conexion
+
+    # ============ ESCRITURA ============
+    def registrar(self, obstacles, time_s, win, config_hash=None, source='serial', ts=None, device=None):
+        """Encola una partida; no bloquea"""
+        self.cola.put((ts or time.time(), config_hash, int(obstacles), int(time_s), 1 if win else 0, source, device))
+
+    def registrar_config(self, config_hash, config):
+        self.cola.put(('config', config_hash, json.dumps(config, separators=(',', ':'))))
+
+    def esperar(self):
+        """Bloquea hasta que todo lo encolado está en disco"""
+        self.cola.join()
+
+    def _escritor(self):
+        conexion = self._conectar()
+        while True:
+            lote = [self.cola.get()]
+            while len(lote) < self.LOTE_MAX:
+                try:
+                    lote.append(self.cola.get_nowait())
+                except queue.Empty:
+                    break
+            try:
+                with conexion:
+                    self._escribir_lote(conexion, lote)
+                self.escritas += len(lote)
+            except sqlite3.Error as e:
+                print(f"[TELEMETRY_STORE] ✗ Error al escribir {len(lote)} registros: {e}")
+            for _ in lote:
+                self.cola.task_done()
+
+    def _escribir_lote(self, conexion, lote):
+        partidas = [r for r in lote if r[0] != 'config']
+        for _, config_hash, config in (r for r in lote if r[0] == 'config'):
+            conexion.execute('INSERT OR IGNORE INTO configs (hash, config, first_seen) VALUES (?, ?, ?)',
+                             (config_hash, config, time.time()))
+        conexion.executemany(
+            'INSERT INTO games (ts, config_hash, obstacles, time, win, source, device) VALUES (?, ?, ?, ?, ?, ?, ?)',
+            partidas)
+        valores = [(device or '', config_hash or '', campo, valor, win, dia_de(ts))
+                   for ts, config_hash, obstacles, time_s, win, _, device in partidas
+                   for campo, valor in (('obstacles', obstacles), ('time', time_s))]
+        conexion.executemany(
+            '''INSERT INTO histograma (device, config_hash, campo, valor, partidas, victorias)
+               VALUES (?, ?, ?, ?, 1, ?)
+               ON CONFLICT (device, config_hash, campo, valor)
+               DO UPDATE SET partidas = partidas + 1, victorias = victorias + excluded.victorias''',
+            [v[:5] for v in valores])
+        conexion.executemany(
+            '''INSERT INTO histograma_dia (device, config_hash, campo, valor, partidas, victorias, dia)
+               VALUES (?, ?, ?, ?, 1, ?, ?)
+               ON CONFLICT (campo, dia, device, config_hash, valor)
+               DO UPDATE SET partidas = partidas + 1, victorias = victorias + excluded.victorias''',
+            valores)
+
+    # ============ CONSULTAS ============
+    def histograma(self, campo, config_hash=None, desde=None, device=None):
+        """[(valor, partidas, victorias)] ordenado por valor; desde = epoch, se redondea al día"""
+        if campo not in CAMPOS:
+            raise ValueError(f'campo debe ser uno de {CAMPOS}')
+        if desde is None:
+            sql = 'SELECT valor, SUM(partidas), SUM(victorias) FROM histograma WHERE campo = ?'
+            args = [campo]
+        else:
+            sql = 'SELECT valor, SUM(partidas), SUM(victorias) FROM histograma_dia WHERE campo = ? AND dia >= ?'
+            args = [campo, dia_de(desde)]
+        if device is not None:
+            sql += ' AND device = ?'
+            args.append(device)
+        if config_hash is not None:
+            sql += ' AND config_hash = ?'
+            args.append(config_hash)
+        sql += ' GROUP BY 1 ORDER BY 1'
+        with closing(self._conectar()) as conexion:
+            return conexion.execute(sql, args).fetchall()
+
+    def estadisticas(self, config_hash=None, desde=None, device=None):
+        resultado = {}
+        for campo in CAMPOS:
+            filas = self.histograma(campo, config_hash, desde, device)
+            resultado[campo] = percentiles([(v, n) for v, n, _ in filas])
+            if campo == 'obstacles':
+                partidas = sum(n for _, n, _ in filas)
+                victorias = sum(w for _, _, w in filas)
+        resultado['games'] = partidas
+        resultado['wins'] = victorias
+        resultado['win_rate'] = round(victorias / partidas, 4) if partidas else None
+        return resultado
+
+    def por_config(self, device=None):
+        """Partidas y tasa de victorias de cada configuración"""
+        sql = '''SELECT h.config_hash, SUM(h.partidas), SUM(h.victorias), c.config
+                 FROM histograma h LEFT JOIN configs c ON c.hash = h.config_hash
+                 WHERE h.campo = ?'''
+        args = ['obstacles']
+        if device is not None:
+            sql += ' AND h.device = ?'
+            args.append(device)
+        sql += ' GROUP BY h.config_hash ORDER BY SUM(h.partidas) DESC'
+        with closing(self._conectar()) as conexion:
+            filas = conexion.execute(sql, args).fetchall()
+        return [{'config_hash': h or None, 'games': n, 'wins': w, 'win_rate': round(w / n, 4),
+                 'config': json.loads(c) if c else None} for h, n, w, c in filas]
+
+    def historial(self, limite=50, antes_de=None, config_hash=None, device=None):
+        """Partidas más recientes primero; antes_de = id para paginar"""
+        sql = 'SELECT id, ts, config_hash, obstacles, time, win, source, device FROM games WHERE 1'
+        args = []
+        if device is not None:
+            sql += ' AND device = ?'
+            args.append(device)
+        if antes_de is not None:
+            sql += ' AND id < ?'
+            args.append(antes_de)
+        if config_hash is not None:
+            sql += ' AND config_hash = ?'
+            args.append(config_hash)
+        sql += ' ORDER BY id DESC LIMIT ?'
+        args.append(limite)
+        with closing(self._conectar()) as conexion:
+            filas = conexion.execute(sql, args).fetchall()
+        return [{'id': i, 'timestamp': time.strftime('%Y-%m-%d %H:%M:%S', time.localtime(ts)),
+                 'config_hash': h, 'obstacles_avoided': o, 'survival_time': t,
+                 'result': 'victory' if w else 'defeat', 'source': s, 'device': d}
+                for i, ts, h, o, t, w, s, d in filas]